@@ -0,0 +1,245 @@
+/*
+ * delay based bandwidth estimator, see bwe.h
+ *
+ * - packets sent within BWE_GROUP_SPAN form an arrival group
+ * - delay variation between groups is accumulated, smoothed and fitted
+ *   with a line, a rising line means queues are building up
+ * - the slope is compared to a threshold that adapts to the noise level
+ * - overuse cuts the target to BWE_BETA of what actually got through,
+ *   otherwise the target grows slowly, heavy loss caps it too
+ */
+#include "bwe.h"
+
+#include <string.h>
+
+void bwe_init(struct bwe* e, int bitrate, int min_bitrate, int max_bitrate)
+{
+    memset(e, 0, sizeof(struct bwe));
+    e->bitrate = bitrate;
+    e->min_bitrate = min_bitrate;
+    e->max_bitrate = max_bitrate;
+    e->threshold = BWE_THRESHOLD_INIT;
+}
+
+static double dabs(double v)
+{
+    return v < 0 ? -v : v;
+}
+
+/*
+ * least squares slope of smoothed delay (ms) over arrival time (ms)
+ */
+static double trendline_slope(const struct bwe* e)
+{
+    double mx = 0, my = 0;
+    double num = 0, den = 0;
+
+    for (int i=0; i<e->samples; i++)
+    {
+        mx += e->x[i];
+        my += e->y[i];
+    }
+    mx /= e->samples;
+    my /= e->samples;
+    for (int i=0; i<e->samples; i++)
+    {
+        num += (e->x[i] - mx) * (e->y[i] - my);
+        den += (e->x[i] - mx) * (e->x[i] - mx);
+    }
+    return den==0 ? 0 : num / den;
+}
+
+static void update_threshold(struct bwe* e, double trend, int64_t now)
+{
+    double t = dabs(trend);
+    double dt;
+
+    if (e->last_threshold_update==0)
+        e->last_threshold_update = now;
+    //single spikes should not drag the threshold along
+    if (t > e->threshold + 15)
+    {
+        e->last_threshold_update = now;
+        return;
+    }
+    dt = (now - e->last_threshold_update) / 1000.0;
+    if (dt > 100)
+        dt = 100;
+    e->threshold += (t < e->threshold ? BWE_K_DOWN : BWE_K_UP)
+        * (t - e->threshold) * dt;
+    if (e->threshold < BWE_THRESHOLD_MIN)
+        e->threshold = BWE_THRESHOLD_MIN;
+    if (e->threshold > BWE_THRESHOLD_MAX)
+        e->threshold = BWE_THRESHOLD_MAX;
+    e->last_threshold_update = now;
+}
+
+static void detect(struct bwe* e, double trend, int64_t now)
+{
+    if (trend > e->threshold)
+    {
+        //two samples in a row and not getting better
+        e->overuse_count++;
+        if (e->overuse_count >= 2 && trend >= e->prev_trend)
+        {
+            if (e->usage!=BWE_OVERUSE)
+                e->overuses++;
+            e->usage = BWE_OVERUSE;
+        }
+    }else if (trend < -e->threshold)
+    {
+        e->overuse_count = 0;
+        e->usage = BWE_UNDERUSE;
+    }else
+    {
+        e->overuse_count = 0;
+        e->usage = BWE_NORMAL;
+    }
+    e->prev_trend = trend;
+    update_threshold(e, trend, now);
+}
+
+static void trendline_update(struct bwe* e, double delta, int64_t arrival,
+        int64_t now)
+{
+    int n;
+
+    if (e->nsamples==0)
+        e->first_arrival = arrival;
+    e->acc_delay += delta;
+    e->smoothed_delay = BWE_TRENDLINE_SMOOTHING * e->smoothed_delay
+        + (1 - BWE_TRENDLINE_SMOOTHING) * e->acc_delay;
+    if (e->samples==BWE_TRENDLINE_WINDOW)
+    {
+        memmove(e->x, e->x + 1, (BWE_TRENDLINE_WINDOW - 1) * sizeof(double));
+        memmove(e->y, e->y + 1, (BWE_TRENDLINE_WINDOW - 1) * sizeof(double));
+        e->samples--;
+    }
+    e->x[e->samples] = (arrival - e->first_arrival) / 1000.0;
+    e->y[e->samples] = e->smoothed_delay;
+    e->samples++;
+    e->nsamples++;
+    if (e->samples < BWE_TRENDLINE_WINDOW)
+        return;
+
+    n = e->nsamples < 60 ? e->nsamples : 60;
+    detect(e, trendline_slope(e) * n * BWE_TRENDLINE_GAIN, now);
+}
+
+/*
+ * a packet that does not fit into the current group closes it
+ * and the group is compared with the one before
+ */
+static void arrival_group(struct bwe* e, const struct bwe_packet* p, int64_t now)
+{
+    if (e->in_group)
+    {
+        //reordered, nothing to learn from it
+        if (p->send < e->group_first_send)
+            return;
+        if (p->send - e->group_first_send <= BWE_GROUP_SPAN)
+        {
+            if (p->send > e->group_send)
+                e->group_send = p->send;
+            if (p->arrival > e->group_arrival)
+                e->group_arrival = p->arrival;
+            return;
+        }
+        if (e->have_prev)
+        {
+            int64_t ds = e->group_send - e->prev_send;
+            int64_t da = e->group_arrival - e->prev_arrival;
+            trendline_update(e, (da - ds) / 1000.0, e->group_arrival, now);
+        }
+        e->prev_send = e->group_send;
+        e->prev_arrival = e->group_arrival;
+        e->have_prev = 1;
+    }
+    e->in_group = 1;
+    e->group_first_send = p->send;
+    e->group_send = p->send;
+    e->group_arrival = p->arrival;
+}
+
+static void acked_update(struct bwe* e, const struct bwe_packet* p)
+{
+    if (!e->acked_started)
+    {
+        e->acked_started = 1;
+        e->acked_start = p->arrival;
+    }
+    e->acked_bytes += p->size;
+    if (p->arrival - e->acked_start >= BWE_ACKED_WINDOW)
+    {
+        int rate = e->acked_bytes * 8 * 1000000 / (p->arrival - e->acked_start);
+        e->acked_bitrate = e->acked_bitrate ? (3 * e->acked_bitrate + rate) / 4 : rate;
+        e->acked_start = p->arrival;
+        e->acked_bytes = 0;
+    }
+}
+
+int bwe_feedback(struct bwe* e, const struct bwe_packet* pkts, int n,
+        int64_t now)
+{
+    int lost = 0;
+    int can_decrease;
+    double dt;
+    double rate = e->bitrate;
+
+    for (int i=0; i<n; i++)
+    {
+        if (pkts[i].arrival==BWE_LOST)
+        {
+            lost++;
+            continue;
+        }
+        acked_update(e, &pkts[i]);
+        arrival_group(e, &pkts[i], now);
+    }
+    e->feedbacks++;
+    e->packets += n;
+    e->lost += lost;
+    e->loss = n ? (double)lost / n : 0;
+
+    dt = e->last_update ? (now - e->last_update) / 1000000.0 : 0;
+    if (dt < 0)
+        dt = 0;
+    if (dt > 1)
+        dt = 1;
+    e->last_update = now;
+    can_decrease = e->decreases==0 || now - e->last_decrease >= BWE_DECREASE_INTERVAL;
+
+    if (e->usage==BWE_OVERUSE)
+    {
+        if (can_decrease)
+        {
+            double acked = e->acked_bitrate ? e->acked_bitrate : e->bitrate;
+            rate = BWE_BETA * (acked < e->bitrate ? acked : e->bitrate);
+            e->last_decrease = now;
+            e->decreases++;
+        }
+    }else if (e->loss > 0.1)
+    {
+        //loss based, queues may be short enough to drop before delay grows
+        if (can_decrease)
+        {
+            rate = e->bitrate * (1 - 0.5 * e->loss);
+            e->last_decrease = now;
+            e->decreases++;
+        }
+    }else if (e->usage==BWE_NORMAL && e->loss < 0.02)
+    {
+        rate *= 1 + BWE_INCREASE * dt;
+        //don't run away from what actually gets through
+        if (e->acked_bitrate && rate > 1.5 * e->acked_bitrate + 10000)
+            rate = 1.5 * e->acked_bitrate + 10000 > e->bitrate
+                ? 1.5 * e->acked_bitrate + 10000 : e->bitrate;
+    }
+
+    if (rate < e->min_bitrate)
+        rate = e->min_bitrate;
+    if (rate > e->max_bitrate)
+        rate = e->max_bitrate;
+    e->bitrate = rate;
+    return e->bitrate;
+}
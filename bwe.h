@@ -0,0 +1,106 @@
+#ifndef _BWE_
+#define _BWE_
+
+#include <stdint.h>
+
+/*
+ * delay based bandwidth estimator for transport-wide congestion control
+ * feedback, a cut down version of Google congestion control
+ * (draft-ietf-rmcat-gcc): arrival groups, trendline filter, adaptive
+ * threshold, AIMD rate control and a loss based cap
+ *
+ * no clock, socket or encoder access, everything comes in through
+ * bwe_feedback(), so it can be replayed from recorded feedback traces
+ *
+ * trace format, one line per packet reported in a feedback message:
+ *   <feedback time us> <send time us> <arrival time us, -1 if lost> <size>
+ * arrival times are in the receiver's clock, only differences matter
+ */
+
+#define BWE_LOST INT64_MIN
+
+#define BWE_GROUP_SPAN 5000//us, packets sent within one group
+#define BWE_TRENDLINE_WINDOW 20
+#define BWE_TRENDLINE_SMOOTHING 0.9
+#define BWE_TRENDLINE_GAIN 4.0
+#define BWE_THRESHOLD_INIT 12.5//ms
+#define BWE_THRESHOLD_MIN 6.0
+#define BWE_THRESHOLD_MAX 600.0
+#define BWE_K_UP 0.0087
+#define BWE_K_DOWN 0.039
+#define BWE_BETA 0.85//decrease to this fraction of acked bitrate
+#define BWE_INCREASE 0.08//per second when nothing is wrong
+#define BWE_DECREASE_INTERVAL 200000//us between two decreases
+#define BWE_ACKED_WINDOW 500000//us of arrivals for acked bitrate
+
+enum bwe_usage {
+    BWE_NORMAL = 0,
+    BWE_OVERUSE,
+    BWE_UNDERUSE,
+};
+
+struct bwe_packet {
+    int64_t send;//us, sender clock
+    int64_t arrival;//us, receiver clock, BWE_LOST if not received
+    int size;//bytes
+};
+
+struct bwe {
+    int bitrate;//current target, bits per second
+    int min_bitrate;
+    int max_bitrate;
+
+    //arrival group being collected and the one before it
+    int in_group;
+    int64_t group_first_send;
+    int64_t group_send;
+    int64_t group_arrival;
+    int have_prev;
+    int64_t prev_send;
+    int64_t prev_arrival;
+
+    //trendline over accumulated delay variation
+    int64_t first_arrival;
+    double acc_delay;//ms
+    double smoothed_delay;//ms
+    double x[BWE_TRENDLINE_WINDOW];
+    double y[BWE_TRENDLINE_WINDOW];
+    int samples;
+    int nsamples;//total, for the gain
+
+    //overuse detector
+    double threshold;//ms
+    int64_t last_threshold_update;
+    double prev_trend;
+    int overuse_count;
+    enum bwe_usage usage;
+
+    //acked bitrate from arrivals
+    int acked_started;
+    int64_t acked_start;
+    int64_t acked_bytes;
+    int acked_bitrate;//0 until the first window is done
+
+    int64_t last_update;//us, feedback time
+    int64_t last_decrease;
+
+    //statistics
+    uint64_t feedbacks;
+    uint64_t packets;
+    uint64_t lost;
+    uint64_t overuses;
+    uint64_t decreases;
+    double loss;//fraction lost in the last feedback
+};
+
+void bwe_init(struct bwe* e, int bitrate, int min_bitrate, int max_bitrate);
+
+/*
+ * packets of one feedback message in transport sequence order,
+ * now is when the feedback arrived (sender clock)
+ * return the new target bitrate
+ */
+int bwe_feedback(struct bwe* e, const struct bwe_packet* pkts, int n,
+        int64_t now);
+
+#endif
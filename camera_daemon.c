@@ -47,6 +47,15 @@
 #endif
 
 #define IMAGE_BUFFER_SIZE 3*VIDEO_WIDTH*VIDEO_HEIGHT
+#define VIDEO_BITRATE 300000//starting point, transport-cc feedback moves it
+#define VIDEO_BITRATE_MIN 100000
+#define VIDEO_BITRATE_MAX 2000000
+
+//simulcast layer for thin links, from its own splitter output
+#define LOW_VIDEO_SPLITTER_OUTPUT 2
+#define LOW_VIDEO_WIDTH 640
+#define LOW_VIDEO_HEIGHT 360
+#define LOW_VIDEO_BITRATE 150000
 
 #define PORT 7777
 
@@ -59,14 +68,19 @@ typedef struct {
     MMAL_COMPONENT_T *video_encoder;
     MMAL_COMPONENT_T *jpeg_component;
     MMAL_COMPONENT_T *resize_component;
+    MMAL_COMPONENT_T *low_resize_component;
+    MMAL_COMPONENT_T *low_encoder;//NULL if the low layer is not available
 
     MMAL_CONNECTION_T *splitter_connection;
     MMAL_CONNECTION_T *resize_connection;
     MMAL_CONNECTION_T *video_encoder_connection;
     MMAL_CONNECTION_T *jpeg_connection;
+    MMAL_CONNECTION_T *low_resize_connection;
+    MMAL_CONNECTION_T *low_encoder_connection;
 
     MMAL_POOL_T* video_encoder_output_pool;
     MMAL_POOL_T* jpeg_encoder_output_pool;
+    MMAL_POOL_T* low_encoder_output_pool;
 
     //mmal_output camera_output;
     //mmal_output secondary_output;
@@ -81,8 +95,9 @@ typedef struct {
     size_t image_max_size;
     size_t image_size;
     uint8_t have_active_client;
-    uint8_t have_active_srtp_receiver;
+    uint8_t live_replay;//new /live client, send the cached GOP first
     int client_fd;
+    struct gop_cache live_gop;//touched by encoder callback only
 
     //used by http parser
     char* last_url;
@@ -148,10 +163,134 @@ end:
     }
 }
 
+/*
+ * srtp sender thread is done with a buffer it held on to,
+ * return it to the pool and hand the encoder a fresh one
+ */
+static void srtp_release_to(MMAL_BUFFER_HEADER_T *buffer,
+        MMAL_PORT_T *port, MMAL_POOL_T *pool)
+{
+    mmal_buffer_header_mem_unlock(buffer);
+    mmal_buffer_header_release(buffer);
+    if (port->is_enabled) {
+        MMAL_BUFFER_HEADER_T *new_buffer = mmal_queue_get(pool->queue);
+        if (new_buffer)
+            mmal_port_send_buffer(port, new_buffer);
+    }
+}
+
+static void srtp_release_buffer(void* opaque)
+{
+    srtp_release_to((MMAL_BUFFER_HEADER_T *) opaque,
+            userdata.video_encoder->output[0],
+            userdata.video_encoder_output_pool);
+}
+
+static void srtp_release_low_buffer(void* opaque)
+{
+    srtp_release_to((MMAL_BUFFER_HEADER_T *) opaque,
+            userdata.low_encoder->output[0],
+            userdata.low_encoder_output_pool);
+}
+
+/*
+ * receiver lost a keyframe (PLI/FIR) or just joined, called from RTCP thread
+ */
+static void srtp_request_keyframe(int layer)
+{
+    MMAL_COMPONENT_T *encoder = layer==SRTP_LAYER_LOW
+        ? userdata.low_encoder : userdata.video_encoder;
+    MMAL_PORT_T *port;
+
+    if (!encoder)
+        return;
+    port = encoder->output[0];
+    if (mmal_port_parameter_set_boolean(port,
+                MMAL_PARAMETER_VIDEO_REQUEST_I_FRAME, 1) != MMAL_SUCCESS)
+        fprintf(stderr, "Unable to request I-frame\n");
+}
+
+/*
+ * bandwidth estimate changed, called from RTCP thread
+ */
+static void srtp_set_encoder_bitrate(int bitrate)
+{
+    MMAL_PORT_T *port = userdata.video_encoder->output[0];
+
+    if (mmal_port_parameter_set_uint32(port,
+                MMAL_PARAMETER_VIDEO_BIT_RATE, bitrate) != MMAL_SUCCESS)
+        fprintf(stderr, "Unable to set encoder bitrate %d\n", bitrate);
+}
+
+/*
+ * queue an encoded buffer for the srtp sender
+ * return 1 if it is held, release is called once it is sent
+ */
+static int srtp_send_encoded(int layer, MMAL_BUFFER_HEADER_T *buffer,
+        srtp_release_fn release)
+{
+    int flags = 0;
+    int held;
+
+    if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+        flags |= H264_AU_END;
+    if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME)
+        flags |= SRTP_KEYFRAME;
+
+    //large buffers stay locked and referenced until the sender
+    //thread calls release
+    mmal_buffer_header_mem_lock(buffer);
+    mmal_buffer_header_acquire(buffer);
+    held = srtp_sender_layer_callback(layer, buffer->data, buffer->length, flags,
+            buffer->pts==MMAL_TIME_UNKNOWN ? SRTP_PTS_UNKNOWN : buffer->pts,
+            release, buffer);
+    if (!held)
+    {
+        mmal_buffer_header_release(buffer);
+        mmal_buffer_header_mem_unlock(buffer);
+    }
+    return held;
+}
+
+/*
+ * simulcast layer, only srtp receivers that selected it get this
+ */
+static void low_encoder_output_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
+    PORT_USERDATA *userdata = (PORT_USERDATA *) port->userdata;
+    MMAL_POOL_T *pool = userdata->low_encoder_output_pool;
+    int srtp_held = 0;
+
+    if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)
+    {
+        //the sender keeps a copy
+        mmal_buffer_header_mem_lock(buffer);
+        srtp_sender_set_layer_header(SRTP_LAYER_LOW, buffer->data, buffer->length);
+        mmal_buffer_header_mem_unlock(buffer);
+    }else if (!(buffer->flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO))
+    {
+        srtp_held = srtp_send_encoded(SRTP_LAYER_LOW, buffer,
+                srtp_release_low_buffer);
+    }
+
+    mmal_buffer_header_release(buffer);
+    if (port->is_enabled) {
+        MMAL_BUFFER_HEADER_T *new_buffer = mmal_queue_get(pool->queue);
+
+        //a held buffer is returned by srtp_release_low_buffer() later
+        if (new_buffer) {
+            if (mmal_port_send_buffer(port, new_buffer) != MMAL_SUCCESS)
+                fprintf(stderr, "Unable to return a buffer to the low video port\n");
+        }else if (!srtp_held) {
+            fprintf(stderr, "Unable to return a buffer to the low video port\n");
+        }
+    }
+}
+
 static void video_encoder_output_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer) {
     MMAL_BUFFER_HEADER_T *new_buffer;
     PORT_USERDATA *userdata = (PORT_USERDATA *) port->userdata;
     MMAL_POOL_T *pool = userdata->video_encoder_output_pool;
+    int srtp_held = 0;
     //fprintf(stderr, "INFO:%s\n", __func__);
 
     if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)
@@ -163,18 +302,45 @@ static void video_encoder_output_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_
         mmal_buffer_header_mem_lock(buffer);
         memcpy(userdata->stream_header, buffer->data, buffer->length);
         mmal_buffer_header_mem_unlock(buffer);
+        srtp_sender_set_stream_header(userdata->stream_header,
+                userdata->stream_header_size);
     }else if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO)
     {
     }else
     {
-        static int srtp_frame_start = -1;
-
         //TODO: send data to connected clients
         //fwrite(buffer->data, 1, buffer->length, stdout);
+        static int au_start = 1;
+        int idr = au_start && (buffer->flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME);
+        au_start = !!(buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END);
+
+        mmal_buffer_header_mem_lock(buffer);
+        gop_cache_add(&userdata->live_gop, buffer->data, buffer->length,
+                0, 0, idr);
+        mmal_buffer_header_mem_unlock(buffer);
+
         if (userdata->have_active_client)
         {
             //need to send key frame first
             static int frame_start = -1;
+            struct gop_cache* gop = &userdata->live_gop;
+            if (userdata->live_replay)
+            {
+                //cached GOP ends with this buffer, it is live from here on
+                userdata->live_replay = 0;
+                if (gop->valid && !idr)
+                {
+                    frame_start = 1;
+                    gop->replays++;
+                    if (write(userdata->client_fd, gop->data, gop->used)<0)
+                    {
+                        frame_start = -1;
+                        userdata->have_active_client = 0;
+                        printf("connection closed\n");
+                    }
+                    goto next;
+                }
+            }
             if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME)
                 frame_start = 1;
             if (frame_start==-1)
@@ -190,22 +356,11 @@ static void video_encoder_output_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_
             mmal_buffer_header_mem_unlock(buffer);
         }
 next:
-        if (userdata->have_active_srtp_receiver)
-        {
-            if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME)
-                srtp_frame_start = 1;
-            if (srtp_frame_start==-1)
-                goto end;
-
-            mmal_buffer_header_mem_lock(buffer);
-            srtp_sender_callback(buffer->data, buffer->length);
-            mmal_buffer_header_mem_unlock(buffer);
-        }else
-        {
-            srtp_frame_start = -1;
-        }
+        //every receiver waits for its own first keyframe, or gets the
+        //cached GOP, keep feeding the sender so the cache is ready
+        srtp_held = srtp_send_encoded(SRTP_LAYER_MAIN, buffer,
+                srtp_release_buffer);
     }
-end:
 
     mmal_buffer_header_release(buffer);
     if (port->is_enabled) {
@@ -217,7 +372,8 @@ end:
             status = mmal_port_send_buffer(port, new_buffer);
         }
 
-        if (!new_buffer || status != MMAL_SUCCESS) {
+        //a held buffer is returned by srtp_release_buffer() later
+        if ((!new_buffer && !srtp_held) || (new_buffer && status != MMAL_SUCCESS)) {
             fprintf(stderr, "Unable to return a buffer to the video port\n");
         }
     }
@@ -386,20 +542,19 @@ error:
 
 }
 
-int setup_resizer(PORT_USERDATA *userdata, int width, int height) {
+static int create_resizer(MMAL_PORT_T *source_port, int width, int height,
+        MMAL_COMPONENT_T **component, MMAL_CONNECTION_T **connection) {
     MMAL_STATUS_T status;
-    MMAL_COMPONENT_T *resize_component;
+    MMAL_COMPONENT_T *resize_component = NULL;
     MMAL_PORT_T *input_port;
 
-    MMAL_PORT_T *source_port = userdata->splitter_component->output[1];
-
     status = mmal_component_create("vc.ril.resize", &resize_component);
 
     if (status != MMAL_SUCCESS) {
         fprintf(stderr, "Failed to create resize component\n");
         goto error;
     }
-    userdata->resize_component = resize_component;
+    *component = resize_component;
 
     input_port = resize_component->input[0];
     mmal_format_copy(input_port->format, source_port->format);
@@ -429,7 +584,7 @@ int setup_resizer(PORT_USERDATA *userdata, int width, int height) {
     }
     if (connect_ports(source_port,
             resize_component->input[0],
-            &userdata->resize_connection)!=MMAL_SUCCESS)
+            connection)!=MMAL_SUCCESS)
     {
         fprintf(stderr,"can't connect resize ports\n");
         goto error;
@@ -440,14 +595,26 @@ int setup_resizer(PORT_USERDATA *userdata, int width, int height) {
 error:
     if (resize_component) {
         mmal_component_destroy(resize_component);
+        *component = NULL;
     }
     return -1;
 }
 
-int setup_video_encoder(PORT_USERDATA *userdata) {
+int setup_resizer(PORT_USERDATA *userdata, int width, int height) {
+    return create_resizer(userdata->splitter_component->output[1],
+            width, height,
+            &userdata->resize_component, &userdata->resize_connection);
+}
+
+/*
+ * H264 encoder fed from source_port, output buffers go to callback
+ */
+static int create_h264_encoder(PORT_USERDATA *userdata, MMAL_PORT_T *source_port,
+        int width, int height, int bitrate, MMAL_PORT_BH_CB_T callback,
+        MMAL_COMPONENT_T **component, MMAL_CONNECTION_T **connection,
+        MMAL_POOL_T **pool) {
     MMAL_STATUS_T status;
     MMAL_COMPONENT_T *encoder = 0;
-    MMAL_PORT_T *source_port = userdata->splitter_component->output[0];
 
     MMAL_PORT_T *encoder_input_port = NULL, *encoder_output_port = NULL;
 
@@ -456,7 +623,7 @@ int setup_video_encoder(PORT_USERDATA *userdata) {
         fprintf(stderr, "Error: unable to create preview (%u)\n", status);
         return -1;
     }
-    userdata->video_encoder = encoder;
+    *component = encoder;
 
     encoder_input_port = encoder->input[0];
     encoder_output_port = encoder->output[0];
@@ -465,7 +632,8 @@ int setup_video_encoder(PORT_USERDATA *userdata) {
     mmal_format_copy(encoder_output_port->format, encoder_input_port->format);
 
     encoder_output_port->buffer_size = encoder_output_port->buffer_size_recommended;
-    encoder_output_port->buffer_num = 2;
+    //srtp sender may hold up to SRTP_RING_MAX_HELD buffers
+    encoder_output_port->buffer_num = 2 + SRTP_RING_MAX_HELD;
     // Commit the port changes to the input port 
     status = mmal_port_format_commit(encoder_input_port);
     if (status != MMAL_SUCCESS) {
@@ -475,9 +643,9 @@ int setup_video_encoder(PORT_USERDATA *userdata) {
 
     // Only supporting H264 at the moment
     encoder_output_port->format->encoding = MMAL_ENCODING_H264;
-    encoder_output_port->format->bitrate = 300000;
-    encoder_output_port->format->es->video.crop.width = VIDEO_WIDTH;
-    encoder_output_port->format->es->video.crop.height = VIDEO_HEIGHT;
+    encoder_output_port->format->bitrate = bitrate;
+    encoder_output_port->format->es->video.crop.width = width;
+    encoder_output_port->format->es->video.crop.height = height;
     encoder_output_port->format->es->video.frame_rate.num = VIDEO_FPS;
     encoder_output_port->format->es->video.frame_rate.den = 1;
 
@@ -531,23 +699,53 @@ int setup_video_encoder(PORT_USERDATA *userdata) {
     }
 
     connect_ports(source_port,
-            encoder_input_port, &userdata->video_encoder_connection);
+            encoder_input_port, connection);
 
-    userdata->video_encoder_output_pool
-        = (MMAL_POOL_T *) mmal_port_pool_create(encoder_output_port,
+    *pool = (MMAL_POOL_T *) mmal_port_pool_create(encoder_output_port,
                 encoder_output_port->buffer_num, encoder_output_port->buffer_size);
     encoder_output_port->userdata = (struct MMAL_PORT_USERDATA_T *) userdata;
 
-    status = mmal_port_enable(encoder_output_port, video_encoder_output_callback);
+    status = mmal_port_enable(encoder_output_port, callback);
     if (status != MMAL_SUCCESS) {
         fprintf(stderr, "Error: unable to enable encoder output port (%u)\n", status);
         return -1;
     }
-    fill_port_buffer(encoder_output_port, userdata->video_encoder_output_pool);
+    fill_port_buffer(encoder_output_port, *pool);
     fprintf(stderr, "INFO:Encoder has been created\n");
     return 0;
 }
 
+int setup_video_encoder(PORT_USERDATA *userdata) {
+    return create_h264_encoder(userdata,
+            userdata->splitter_component->output[0],
+            VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_BITRATE,
+            video_encoder_output_callback,
+            &userdata->video_encoder, &userdata->video_encoder_connection,
+            &userdata->video_encoder_output_pool);
+}
+
+/*
+ * simulcast layer, a spare splitter output scaled down and encoded on its own
+ */
+int setup_low_encoder(PORT_USERDATA *userdata) {
+    if (create_resizer(userdata->splitter_component->output[LOW_VIDEO_SPLITTER_OUTPUT],
+                LOW_VIDEO_WIDTH, LOW_VIDEO_HEIGHT,
+                &userdata->low_resize_component,
+                &userdata->low_resize_connection))
+        return -1;
+    if (create_h264_encoder(userdata,
+                userdata->low_resize_component->output[0],
+                LOW_VIDEO_WIDTH, LOW_VIDEO_HEIGHT, LOW_VIDEO_BITRATE,
+                low_encoder_output_callback,
+                &userdata->low_encoder, &userdata->low_encoder_connection,
+                &userdata->low_encoder_output_pool))
+    {
+        userdata->low_encoder = NULL;
+        return -1;
+    }
+    return 0;
+}
+
 int setup_jpeg_encoder(PORT_USERDATA *userdata) {
     MMAL_STATUS_T status;
     MMAL_COMPONENT_T *jpeg_component = 0;
@@ -636,6 +834,198 @@ void send_html_response(int fd, const char* body)
     free(http_header);
 }
 
+void send_srtp_stats(int fd)
+{
+    struct srtp_sender_stats stats;
+    srtp_sender_get_stats(&stats);
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "frames", stats.frames);
+    cJSON_AddNumberToObject(json, "payloads", stats.payloads);
+    cJSON_AddNumberToObject(json, "packets", stats.packets);
+    cJSON_AddNumberToObject(json, "slicer_packets", stats.slicer_packets);
+    cJSON_AddNumberToObject(json, "packets_per_frame",
+            stats.frames ? (double)stats.payloads/stats.frames : 0);
+    cJSON_AddNumberToObject(json, "slicer_packets_per_frame",
+            stats.frames ? (double)stats.slicer_packets/stats.frames : 0);
+    cJSON_AddNumberToObject(json, "nals", stats.nals);
+    cJSON_AddNumberToObject(json, "single_nal_packets", stats.single_pkts);
+    cJSON_AddNumberToObject(json, "fu_a_packets", stats.fu_pkts);
+    cJSON_AddNumberToObject(json, "stap_a_packets", stats.stap_pkts);
+    cJSON_AddNumberToObject(json, "batch_size", stats.batch_size);
+    cJSON_AddNumberToObject(json, "ring_size", SRTP_RING_SIZE);
+    cJSON_AddNumberToObject(json, "ring_occupancy", stats.ring_occupancy);
+    cJSON_AddNumberToObject(json, "ring_max_occupancy", stats.ring_max_occupancy);
+    cJSON_AddNumberToObject(json, "ring_copied", stats.ring_copied);
+    cJSON_AddNumberToObject(json, "ring_copied_bytes", stats.ring_copied_bytes);
+    cJSON_AddNumberToObject(json, "ring_held", stats.ring_held);
+    cJSON_AddNumberToObject(json, "ring_overflows", stats.ring_overflows);
+    cJSON_AddNumberToObject(json, "keyframe_requests", stats.keyframe_requests);
+    cJSON_AddNumberToObject(json, "keyframes_requested", stats.keyframes_requested);
+    cJSON_AddNumberToObject(json, "pts_missing", stats.pts_missing);
+    cJSON_AddBoolToObject(json, "gop_cached", stats.gop_valid);
+    cJSON_AddNumberToObject(json, "gop_buffers", stats.gop_buffers);
+    cJSON_AddNumberToObject(json, "gop_bytes", stats.gop_bytes);
+    cJSON_AddNumberToObject(json, "gop_peak_bytes", stats.gop_peak_bytes);
+    cJSON_AddNumberToObject(json, "gop_memory", stats.gop_memory);
+    cJSON_AddNumberToObject(json, "gop_max_bytes", stats.gop_max_bytes);
+    cJSON_AddNumberToObject(json, "gop_overflows", stats.gop_overflows);
+    cJSON_AddNumberToObject(json, "gop_replays", stats.gop_replays);
+    //encoder callback owns it, numbers may be a frame old
+    cJSON_AddNumberToObject(json, "live_gop_bytes", userdata.live_gop.used);
+    cJSON_AddNumberToObject(json, "live_gop_memory", gop_cache_memory(&userdata.live_gop));
+    cJSON_AddNumberToObject(json, "live_gop_overflows", userdata.live_gop.overflows);
+    cJSON_AddNumberToObject(json, "live_gop_replays", userdata.live_gop.replays);
+    cJSON_AddNumberToObject(json, "encoded_bytes", stats.encoded_bytes);
+    cJSON_AddNumberToObject(json, "copied_bytes", stats.copied_bytes);
+    cJSON_AddNumberToObject(json, "copied_per_encoded_byte",
+            stats.encoded_bytes ? (double)stats.copied_bytes/stats.encoded_bytes : 0);
+    cJSON_AddNumberToObject(json, "legacy_copied_per_encoded_byte",
+            stats.encoded_bytes ? (double)stats.legacy_copied_bytes/stats.encoded_bytes : 0);
+    cJSON_AddNumberToObject(json, "fec_row", stats.fec_row);
+    cJSON_AddNumberToObject(json, "fec_col", stats.fec_col);
+    cJSON_AddNumberToObject(json, "bitrate", stats.bitrate);
+    cJSON_AddNumberToObject(json, "bitrate_changes", stats.bitrate_changes);
+    cJSON_AddNumberToObject(json, "pace_rate", stats.pace_rate);
+    cJSON_AddNumberToObject(json, "pace_latency_us", stats.pace_latency);
+    cJSON_AddNumberToObject(json, "pace_waits", stats.pace_waits);
+    cJSON_AddNumberToObject(json, "pace_wait_us", stats.pace_wait_us);
+    cJSON_AddNumberToObject(json, "pace_deadline_misses", stats.pace_deadline_misses);
+    cJSON_AddBoolToObject(json, "txtime", stats.txtime);
+    cJSON_AddNumberToObject(json, "txtime_packets", stats.txtime_packets);
+    cJSON_AddNumberToObject(json, "txtime_max_lead_us", stats.txtime_max_lead_us);
+    cJSON_AddNumberToObject(json, "dscp", stats.dscp);
+    cJSON_AddNumberToObject(json, "priority", stats.priority);
+    cJSON_AddNumberToObject(json, "sndbuf", stats.sndbuf);
+    cJSON_AddNumberToObject(json, "keyframe_bytes", stats.keyframe_bytes);
+    cJSON_AddStringToObject(json, "uring", stats.uring==SRTP_URING_SQPOLL ? "sqpoll" :
+            stats.uring==SRTP_URING_ON ? "on" : "off");
+    cJSON_AddNumberToObject(json, "uring_submits", stats.uring_submits);
+    cJSON_AddNumberToObject(json, "uring_enters", stats.uring_enters);
+    cJSON_AddNumberToObject(json, "uring_wakeups", stats.uring_wakeups);
+    cJSON_AddNumberToObject(json, "uring_packets", stats.uring_packets);
+    cJSON_AddNumberToObject(json, "uring_fixed_packets", stats.uring_fixed_packets);
+    cJSON_AddNumberToObject(json, "uring_errors", stats.uring_errors);
+    cJSON_AddStringToObject(json, "cipher", stats.cipher ? stats.cipher : "");
+    cJSON_AddStringToObject(json, "sha1", stats.sha1 ? stats.sha1 : "");
+    cJSON_AddNumberToObject(json, "keystream_packets", stats.keystream_packets);
+    cJSON_AddNumberToObject(json, "protect_threads", stats.protect_threads);
+    cJSON_AddNumberToObject(json, "parallel_jobs", stats.parallel_jobs);
+    cJSON_AddNumberToObject(json, "parallel_packets", stats.parallel_packets);
+    cJSON_AddNumberToObject(json, "keyframe_sends", stats.keyframe_sends);
+    cJSON_AddNumberToObject(json, "keyframe_send_us", stats.keyframe_send_us);
+    cJSON_AddNumberToObject(json, "keyframe_send_max_us", stats.keyframe_send_max_us);
+
+    //bucket i counts inter-packet gaps below 2^i us, last one the rest
+    cJSON* gaps = cJSON_AddArrayToObject(json, "gap_histogram");
+    for (int i=0; i<SRTP_GAP_BUCKETS; i++)
+    {
+        cJSON* bucket = cJSON_CreateObject();
+        if (i < SRTP_GAP_BUCKETS-1)
+            cJSON_AddNumberToObject(bucket, "lt_us", 1<<i);
+        else
+            cJSON_AddNumberToObject(bucket, "ge_us", 1<<(i-1));
+        cJSON_AddNumberToObject(bucket, "count", stats.gaps[i]);
+        cJSON_AddItemToArray(gaps, bucket);
+    }
+    cJSON_AddNumberToObject(json, "send_calls", stats.send_calls);
+    cJSON_AddNumberToObject(json, "syscalls_saved", stats.syscalls_saved);
+    cJSON_AddNumberToObject(json, "syscalls_saved_per_frame",
+            stats.frames ? (double)stats.syscalls_saved/stats.frames : 0);
+
+    cJSON* layers = cJSON_AddArrayToObject(json, "layers");
+    for (int i=0; i<SRTP_LAYERS; i++)
+    {
+        struct srtp_layer_stats* ls = &stats.layers[i];
+        cJSON* jl = cJSON_CreateObject();
+        cJSON_AddStringToObject(jl, "layer", i==SRTP_LAYER_LOW ? "low" : "main");
+        cJSON_AddNumberToObject(jl, "frames", ls->frames);
+        cJSON_AddNumberToObject(jl, "receivers", ls->receivers);
+        cJSON_AddNumberToObject(jl, "ring_overflows", ls->ring_overflows);
+        cJSON_AddBoolToObject(jl, "gop_valid", ls->gop_valid);
+        cJSON_AddNumberToObject(jl, "gop_bytes", ls->gop_bytes);
+        cJSON_AddItemToArray(layers, jl);
+    }
+
+    cJSON* sessions = cJSON_AddArrayToObject(json, "receivers");
+    for (int i=0; i<stats.nsessions; i++)
+    {
+        struct srtp_session_stats* ss = &stats.sessions[i];
+        cJSON* js = cJSON_CreateObject();
+        cJSON_AddStringToObject(js, "addr", inet_ntoa(ss->raddr.sin_addr));
+        cJSON_AddNumberToObject(js, "port", ntohs(ss->raddr.sin_port));
+        cJSON_AddNumberToObject(js, "ssrc", ss->ssrc);
+        cJSON_AddStringToObject(js, "layer",
+                ss->layer==SRTP_LAYER_LOW ? "low" : "main");
+        cJSON_AddNumberToObject(js, "media_ssrc", ss->media_ssrc);
+        cJSON_AddNumberToObject(js, "sndbuf", ss->sndbuf);
+        cJSON_AddBoolToObject(js, "txtime", ss->txtime);
+        cJSON_AddBoolToObject(js, "registered_buffers", ss->fixed);
+        cJSON_AddStringToObject(js, "send_mode",
+                ss->send_mode==SRTP_SEND_TCP ? "tcp"
+                : ss->send_mode==SRTP_SEND_GSO ? "gso" : "sendmmsg");
+        cJSON_AddBoolToObject(js, "waiting_keyframe", ss->need_keyframe);
+        cJSON_AddNumberToObject(js, "packets", ss->packets);
+        cJSON_AddNumberToObject(js, "send_calls", ss->send_calls);
+        cJSON_AddNumberToObject(js, "gso_sends", ss->gso_sends);
+        cJSON_AddNumberToObject(js, "gso_segments", ss->gso_segments);
+        cJSON_AddNumberToObject(js, "fec_packets", ss->fec_packets);
+        cJSON_AddNumberToObject(js, "fec_overhead",
+                ss->packets ? (double)ss->fec_packets/(ss->packets - ss->fec_packets) : 0);
+        cJSON_AddNumberToObject(js, "sender_reports", ss->srs);
+        cJSON_AddNumberToObject(js, "plis", ss->plis);
+        cJSON_AddNumberToObject(js, "firs", ss->firs);
+        cJSON_AddNumberToObject(js, "fraction_lost", ss->fraction_lost/256.0);
+        cJSON_AddNumberToObject(js, "cumulative_lost", ss->cumulative_lost);
+        cJSON_AddNumberToObject(js, "jitter", ss->jitter);
+        cJSON_AddNumberToObject(js, "rtt_us", ss->rtt);
+        cJSON_AddNumberToObject(js, "rtcp_packets", ss->rtcp_packets);
+        cJSON_AddNumberToObject(js, "rtcp_errors", ss->rtcp_errors);
+        cJSON_AddNumberToObject(js, "nacks", ss->nacks);
+        cJSON_AddNumberToObject(js, "rtx_packets", ss->rtx_packets);
+        cJSON_AddNumberToObject(js, "rtx_limited", ss->rtx_limited);
+        cJSON_AddNumberToObject(js, "retransmit_rate",
+                ss->packets ? (double)ss->rtx_packets/ss->packets : 0);
+        cJSON_AddNumberToObject(js, "rtx_ring_hit_rate",
+                ss->nacks ? (double)ss->rtx_hits/ss->nacks : 0);
+        cJSON_AddNumberToObject(js, "twcc_id", ss->twcc_id);
+        cJSON_AddNumberToObject(js, "twcc_feedbacks", ss->twcc_feedbacks);
+        cJSON_AddNumberToObject(js, "twcc_errors", ss->twcc_errors);
+        cJSON_AddNumberToObject(js, "twcc_loss",
+                ss->twcc_packets ? (double)ss->twcc_lost/ss->twcc_packets : 0);
+        cJSON_AddNumberToObject(js, "bwe_bitrate", ss->bwe_bitrate);
+        cJSON_AddNumberToObject(js, "acked_bitrate", ss->acked_bitrate);
+        cJSON_AddStringToObject(js, "bwe_usage",
+                ss->bwe_usage==BWE_OVERUSE ? "overuse"
+                : ss->bwe_usage==BWE_UNDERUSE ? "underuse" : "normal");
+        cJSON_AddNumberToObject(js, "bwe_loss", ss->bwe_loss);
+        cJSON_AddNumberToObject(js, "bwe_overuses", ss->bwe_overuses);
+        cJSON_AddNumberToObject(js, "bwe_decreases", ss->bwe_decreases);
+        cJSON_AddNumberToObject(js, "keystream_generated", ss->keystream_generated);
+        cJSON_AddNumberToObject(js, "keystream_hits", ss->keystream_hits);
+        cJSON_AddNumberToObject(js, "keystream_misses", ss->keystream_misses);
+        if (ss->send_mode==SRTP_SEND_TCP)
+        {
+            cJSON_AddNumberToObject(js, "tcp_queued", ss->tcp_queued);
+            cJSON_AddNumberToObject(js, "tcp_max_queued", ss->tcp_max_queued);
+            cJSON_AddNumberToObject(js, "tcp_drops", ss->tcp_drops);
+            cJSON_AddNumberToObject(js, "tcp_dropped_packets", ss->tcp_dropped_packets);
+        }
+        if (ss->multicast)
+        {
+            cJSON_AddBoolToObject(js, "multicast", 1);
+            cJSON_AddNumberToObject(js, "ttl", ss->mcast_ttl);
+            cJSON_AddNumberToObject(js, "viewers", ss->mcast_viewers);
+        }
+        cJSON_AddItemToArray(sessions, js);
+    }
+
+    char* body = cJSON_PrintUnformatted(json);
+    send_html_response(fd, body);
+    free(body);
+    cJSON_Delete(json);
+}
+
 int server_on_url(http_parser *parser, const char *data, size_t length)
 {
     int filedes = *(int*)parser->data;
@@ -695,16 +1085,39 @@ int server_on_url(http_parser *parser, const char *data, size_t length)
             write(filedes, userdata.stream_header, userdata.stream_header_size);
 
             userdata.client_fd = filedes;
+            userdata.live_replay = 1;
             userdata.have_active_client = 1;
         }else if (!strncmp(data, "/stop_srtp", length)) {
             printf("request /stop_srtp\n");
-            userdata.have_active_srtp_receiver = 0;
+            destroy_srtp_sender();
             send_html_response(filedes, "OK");
+        }else if (!strncmp(data, "/srtp_stats", length)) {
+            send_srtp_stats(filedes);
         }
     }
     return 0;
 }
 
+/*
+ * "low" is the simulcast layer, anything else the main one
+ */
+static int srtp_layer_from_json(const cJSON* json_layer)
+{
+    if (cJSON_IsString(json_layer) && !strcmp(json_layer->valuestring, "low"))
+        return SRTP_LAYER_LOW;
+    return SRTP_LAYER_MAIN;
+}
+
+/*
+ * the low layer is only there if its encoder could be set up
+ */
+static int select_srtp_layer(const char* addr, int port, int ssrc, int layer)
+{
+    if (layer==SRTP_LAYER_LOW && !userdata.low_encoder)
+        return -1;
+    return srtp_sender_select_layer(addr, port, ssrc, layer);
+}
+
 int server_on_body(http_parser *parser, const char* data, size_t length)
 {
     int filedes = *(int*)parser->data;
@@ -713,17 +1126,13 @@ int server_on_body(http_parser *parser, const char* data, size_t length)
         int url_len = strlen(userdata.last_url);
         if (!strncmp(userdata.last_url, "/srtp_cast_to", url_len))
         {
-            //prepare srtp and cast to address
-            send_html_response(filedes, "OK");
-            //initialize srtp backend
-            //need remote address, port, ssrc, key, video header, video header length
+            //prepare srtp and cast to address, more receivers can be added
+            //need remote address, port, ssrc, key
             char* body = malloc(length+1);
             memcpy(body, data, length);
             body[length] = 0;
             cJSON* srtp_cfg = cJSON_Parse(body);
 
-            //prepare_srtp_sender(remote_address, port, ssrc, key,
-            //                        userdata.video_header, userdata.video_header_length);
             const cJSON* json_addr = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "addr");
             const char* remote_address = json_addr->valuestring;
             assert(cJSON_IsString(json_addr));
@@ -740,15 +1149,195 @@ int server_on_body(http_parser *parser, const char* data, size_t length)
             assert(cJSON_IsString(json_key));
             const char* key = json_key->valuestring;
 
-            prepare_srtp_sender(remote_address,
-                    port, 
-                    ssrc,
-                    key);
+            //optional, number of packets per sendmmsg()
+            const cJSON* json_batch = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "batch");
+            if (cJSON_IsNumber(json_batch))
+                srtp_sender_set_batch_size(json_batch->valueint);
+            //optional, pacing rate as multiple of encoder bitrate, 0 is off
+            const cJSON* json_pace = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "pace");
+            const cJSON* json_pace_latency = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "pace_latency_ms");
+            srtp_sender_set_pacing(
+                    cJSON_IsNumber(json_pace) ? json_pace->valuedouble : -1,
+                    cJSON_IsNumber(json_pace_latency) ? json_pace_latency->valueint * 1000 : -1);
+            //optional, true hands paced packets to the fq qdisc with a launch time
+            const cJSON* json_txtime = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "txtime");
+            if (cJSON_IsBool(json_txtime))
+                srtp_sender_set_txtime(cJSON_IsTrue(json_txtime));
+            //optional, socket options of the media sockets, sndbuf 0 follows keyframes
+            const cJSON* json_dscp = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "dscp");
+            const cJSON* json_priority = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "priority");
+            const cJSON* json_sndbuf = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "sndbuf");
+            srtp_sender_set_socket_options(
+                    cJSON_IsNumber(json_dscp) ? json_dscp->valueint : -1,
+                    cJSON_IsNumber(json_priority) ? json_priority->valueint : -1,
+                    cJSON_IsNumber(json_sndbuf) ? json_sndbuf->valueint : -1);
+            //optional, pacing of the cached GOP sent to a joining receiver
+            const cJSON* json_gop_pace = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "gop_pace");
+            if (cJSON_IsNumber(json_gop_pace))
+                srtp_sender_set_gop_cache(GOP_CACHE_MAX_BYTES, json_gop_pace->valuedouble);
+            //optional, packets of keystream generated ahead per stream, 0 is off
+            const cJSON* json_precompute = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "precompute");
+            if (cJSON_IsNumber(json_precompute))
+                srtp_sender_set_keystream_precompute(json_precompute->valueint);
+            //optional, threads generating keystream of large frames, 1 is serial
+            const cJSON* json_threads = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "protect_threads");
+            if (cJSON_IsNumber(json_threads))
+                srtp_sender_set_protect_threads(json_threads->valueint);
+            //optional, "on" or "sqpoll" sends UDP receivers' packets through io_uring
+            const cJSON* json_uring = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "uring");
+            if (cJSON_IsString(json_uring))
+                srtp_sender_set_uring(
+                        !strcmp(json_uring->valuestring, "sqpoll") ? SRTP_URING_SQPOLL :
+                        !strcmp(json_uring->valuestring, "on") ? SRTP_URING_ON : SRTP_URING_OFF);
+            //optional, "table", "bitsliced" or "hw" AES for receivers added from now on
+            const cJSON* json_aes = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "aes");
+            if (cJSON_IsString(json_aes))
+                srtp_sender_set_aes(
+                        !strcmp(json_aes->valuestring, "table") ? srtp_aes_icm_impl_table :
+                        !strcmp(json_aes->valuestring, "bitsliced") ? srtp_aes_icm_impl_bitsliced :
+                        !strcmp(json_aes->valuestring, "hw") ? srtp_aes_icm_impl_hw :
+                        srtp_aes_icm_impl_auto);
+            //optional, send equal sized packets with UDP GSO
+            const cJSON* json_gso = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "gso");
+            //optional, "tcp" connects to addr:port and frames packets (RFC 4571)
+            const cJSON* json_transport = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "transport");
+            const int tcp = cJSON_IsString(json_transport)
+                && strcmp(json_transport->valuestring, "tcp")==0;
+            //optional, how long a packet may wait in the TCP queue
+            const cJSON* json_tcp_latency = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "tcp_latency_ms");
+            if (cJSON_IsNumber(json_tcp_latency))
+                srtp_sender_set_tcp_latency(json_tcp_latency->valueint * 1000);
+            //optional, transport-wide sequence number extension id, 0 is off
+            const cJSON* json_twcc = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "twcc_id");
+            //optional, for a multicast addr, hop limit and local interface address
+            const cJSON* json_ttl = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "ttl");
+            const cJSON* json_iface = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "iface");
+            //optional, "low" sends the simulcast layer instead of the main one
+            const int layer = srtp_layer_from_json(
+                    cJSON_GetObjectItemCaseSensitive(srtp_cfg, "layer"));
+
+            struct in_addr group;
+            if (inet_aton(remote_address, &group) && IN_MULTICAST(ntohl(group.s_addr)))
+            {
+                //reply with the group parameters, the key may be the one
+                //set up by the first viewer
+                struct srtp_multicast mcast;
+                int ret = srtp_sender_join_multicast(remote_address,
+                        port,
+                        ssrc,
+                        key,
+                        cJSON_IsTrue(json_gso) ? SRTP_SEND_GSO : SRTP_SEND_MMSG,
+                        cJSON_IsNumber(json_ttl) ? json_ttl->valueint : SRTP_MULTICAST_TTL_DEFAULT,
+                        cJSON_IsString(json_iface) ? json_iface->valuestring : NULL,
+                        &mcast);
+                if (!ret && layer!=SRTP_LAYER_MAIN)
+                    ret = select_srtp_layer(remote_address, port, ssrc, layer);
+                if (ret)
+                {
+                    send_html_response(filedes, "error");
+                }else
+                {
+                    cJSON* reply = cJSON_CreateObject();
+                    cJSON_AddStringToObject(reply, "group", remote_address);
+                    cJSON_AddNumberToObject(reply, "port", port);
+                    cJSON_AddNumberToObject(reply, "ssrc", ssrc);
+                    cJSON_AddStringToObject(reply, "key", mcast.key);
+                    cJSON_AddNumberToObject(reply, "ttl", mcast.ttl);
+                    cJSON_AddStringToObject(reply, "iface", inet_ntoa(mcast.iface));
+                    cJSON_AddNumberToObject(reply, "viewers", mcast.viewers);
+                    char* text = cJSON_PrintUnformatted(reply);
+                    send_html_response(filedes, text);
+                    free(text);
+                    cJSON_Delete(reply);
+                }
+            }else
+            {
+                int ret = prepare_srtp_sender(remote_address,
+                        port, 
+                        ssrc,
+                        key,
+                        tcp ? SRTP_SEND_TCP
+                        : cJSON_IsTrue(json_gso) ? SRTP_SEND_GSO : SRTP_SEND_MMSG,
+                        cJSON_IsNumber(json_twcc) ? json_twcc->valueint : SRTP_TWCC_ID_DEFAULT);
+                if (!ret && layer!=SRTP_LAYER_MAIN)
+                    ret = select_srtp_layer(remote_address, port, ssrc, layer);
+                send_html_response(filedes, ret ? "error" : "OK");
+            }
+            cJSON_Delete(srtp_cfg);
+            free(body);
+        }else if (!strncmp(userdata.last_url, "/srtp_fec", url_len))
+        {
+            //parity per row of "row" packets and per column of "col" rows
+            char* body = malloc(length+1);
+            memcpy(body, data, length);
+            body[length] = 0;
+            cJSON* fec_cfg = cJSON_Parse(body);
+
+            const cJSON* json_row = cJSON_GetObjectItemCaseSensitive(fec_cfg, "row");
+            const cJSON* json_col = cJSON_GetObjectItemCaseSensitive(fec_cfg, "col");
+            srtp_sender_set_fec(cJSON_IsNumber(json_row) ? json_row->valueint : 0,
+                    cJSON_IsNumber(json_col) ? json_col->valueint : 0);
+            cJSON_Delete(fec_cfg);
+            free(body);
+
+            send_html_response(filedes, "OK");
+        }else if (!strncmp(userdata.last_url, "/srtp_twcc_trace", url_len))
+        {
+            //record transport-cc feedback to "path", no path stops it
+            char* body = malloc(length+1);
+            memcpy(body, data, length);
+            body[length] = 0;
+            cJSON* trace_cfg = cJSON_Parse(body);
+
+            const cJSON* json_path = cJSON_GetObjectItemCaseSensitive(trace_cfg, "path");
+            int ret = srtp_sender_set_twcc_trace(
+                    cJSON_IsString(json_path) ? json_path->valuestring : NULL);
+            cJSON_Delete(trace_cfg);
+            free(body);
+
+            send_html_response(filedes, ret ? "error" : "OK");
+        }else if (!strncmp(userdata.last_url, "/srtp_layer", url_len))
+        {
+            //switch one receiver between "main" and "low"
+            char* body = malloc(length+1);
+            memcpy(body, data, length);
+            body[length] = 0;
+            cJSON* srtp_cfg = cJSON_Parse(body);
+
+            const cJSON* json_addr = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "addr");
+            const cJSON* json_port = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "port");
+            const cJSON* json_ssrc = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "ssrc");
+            const cJSON* json_layer = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "layer");
+            int ret = -1;
+            if (cJSON_IsString(json_addr) && cJSON_IsNumber(json_port)
+                    && cJSON_IsNumber(json_ssrc) && cJSON_IsString(json_layer))
+                ret = select_srtp_layer(json_addr->valuestring,
+                        json_port->valueint, json_ssrc->valueint,
+                        srtp_layer_from_json(json_layer));
             cJSON_Delete(srtp_cfg);
             free(body);
 
-            srtp_sender_callback(userdata.stream_header, userdata.stream_header_size);
-            userdata.have_active_srtp_receiver = 1;
+            send_html_response(filedes, ret ? "error" : "OK");
+        }else if (!strncmp(userdata.last_url, "/srtp_remove", url_len))
+        {
+            //stop casting to one receiver
+            char* body = malloc(length+1);
+            memcpy(body, data, length);
+            body[length] = 0;
+            cJSON* srtp_cfg = cJSON_Parse(body);
+
+            const cJSON* json_addr = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "addr");
+            const cJSON* json_port = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "port");
+            const cJSON* json_ssrc = cJSON_GetObjectItemCaseSensitive(srtp_cfg, "ssrc");
+            int ret = -1;
+            if (cJSON_IsString(json_addr) && cJSON_IsNumber(json_port)
+                    && cJSON_IsNumber(json_ssrc))
+                ret = remove_srtp_receiver(json_addr->valuestring,
+                        json_port->valueint, json_ssrc->valueint);
+            cJSON_Delete(srtp_cfg);
+            free(body);
+
+            send_html_response(filedes, ret ? "no such receiver" : "OK");
         }else
         {
             send_html_response(filedes, "unknown command");
@@ -876,8 +1465,13 @@ int main(int argc, char** argv) {
     MMAL_STATUS_T status;
 
     srtp_backend_init();
+    srtp_sender_set_bitrate(VIDEO_BITRATE);
+    srtp_sender_set_keyframe_callback(srtp_request_keyframe);
+    srtp_sender_set_bitrate_callback(srtp_set_encoder_bitrate,
+            VIDEO_BITRATE_MIN, VIDEO_BITRATE_MAX);
 
     memset(&userdata, 0, sizeof (PORT_USERDATA));
+    gop_cache_init(&userdata.live_gop, GOP_CACHE_MAX_BYTES);
 
     userdata.width = VIDEO_WIDTH;
     userdata.height = VIDEO_HEIGHT;
@@ -931,6 +1525,11 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    //second, smaller encode for thin links, main stream works without it
+    printf("creat low video encoder\n");
+    if (setup_low_encoder(&userdata))
+        fprintf(stderr, "Error: setup low encoder, no simulcast layer\n");
+
     //initialize h264 video output
     //mmal_output_init("mmalcam", &userdata->camera_output,
     //        userdata->resize_component->output[0], 0);
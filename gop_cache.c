@@ -0,0 +1,112 @@
+/*
+ * in-memory GOP cache, see gop_cache.h
+ *
+ * buffers are packed back to back into one allocation that grows up to
+ * max_bytes, an index keeps their boundaries and flags
+ */
+#include "gop_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void gop_cache_init(struct gop_cache* c, size_t max_bytes)
+{
+    memset(c, 0, sizeof(struct gop_cache));
+    c->max_bytes = max_bytes;
+}
+
+void gop_cache_reset(struct gop_cache* c)
+{
+    c->valid = 0;
+    c->used = 0;
+    c->count = 0;
+}
+
+void gop_cache_set_limit(struct gop_cache* c, size_t max_bytes)
+{
+    c->max_bytes = max_bytes;
+    if (c->size <= max_bytes)
+        return;
+    gop_cache_reset(c);
+    free(c->data);
+    c->data = NULL;
+    c->size = 0;
+    if (!max_bytes)
+    {
+        free(c->entries);
+        c->entries = NULL;
+        c->capacity = 0;
+    }
+}
+
+size_t gop_cache_memory(const struct gop_cache* c)
+{
+    return c->size + c->capacity * sizeof(struct gop_entry);
+}
+
+/*
+ * make room for length more bytes and one more entry
+ */
+static int gop_cache_grow(struct gop_cache* c, size_t length)
+{
+    if (c->used + length > c->size)
+    {
+        size_t n = c->size ? c->size : 64*1024;
+        uint8_t* p;
+        while (n < c->used + length)
+            n *= 2;
+        if (n > c->max_bytes)
+            n = c->max_bytes;
+        p = realloc(c->data, n);
+        if (!p)
+            return -1;
+        c->data = p;
+        c->size = n;
+    }
+    if (c->count==c->capacity)
+    {
+        int n = c->capacity ? c->capacity * 2 : 64;
+        struct gop_entry* p = realloc(c->entries, n * sizeof(struct gop_entry));
+        if (!p)
+            return -1;
+        c->entries = p;
+        c->capacity = n;
+    }
+    return 0;
+}
+
+int gop_cache_add(struct gop_cache* c, const uint8_t* data, size_t length,
+        int flags, uint32_t ts, int idr)
+{
+    struct gop_entry* e;
+
+    if (!c->max_bytes)
+        return -1;
+    if (idr)
+    {
+        gop_cache_reset(c);
+        c->valid = 1;
+        c->gops++;
+    }
+    if (!c->valid)
+        return -1;
+    if (c->used + length > c->max_bytes || gop_cache_grow(c, length))
+    {
+        //a partial GOP can't be decoded, drop all of it
+        gop_cache_reset(c);
+        c->overflows++;
+        return -1;
+    }
+
+    e = &c->entries[c->count++];
+    e->offset = c->used;
+    e->length = length;
+    e->flags = flags;
+    e->ts = ts;
+    memcpy(c->data + c->used, data, length);
+    c->used += length;
+    c->copied_bytes += length;
+    if (c->used > c->peak_bytes)
+        c->peak_bytes = c->used;
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef _GOP_CACHE_
+#define _GOP_CACHE_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * copy of every encoder buffer since the last IDR, so a viewer that joins
+ * mid GOP can be sent the whole GOP at once instead of waiting for the
+ * next keyframe
+ * the cache starts at a keyframe access unit, a GOP larger than max_bytes
+ * is dropped and the cache stays empty until the next keyframe
+ * not thread safe, the owner serializes add and replay
+ */
+
+#define GOP_CACHE_MAX_BYTES (1024*1024)
+
+struct gop_entry {
+    size_t offset;//into data
+    size_t length;
+    int flags;//caller's, e.g. H264_AU_END
+    uint32_t ts;//caller's timestamp
+};
+
+struct gop_cache {
+    size_t max_bytes;//0 disables the cache
+    int valid;//holds a GOP from its keyframe on
+
+    uint8_t* data;
+    size_t size;//allocated
+    size_t used;
+    struct gop_entry* entries;
+    int count;
+    int capacity;
+
+    //statistics
+    size_t peak_bytes;
+    uint64_t gops;
+    uint64_t overflows;//GOPs too large to cache
+    uint64_t copied_bytes;
+    uint64_t replays;
+};
+
+void gop_cache_init(struct gop_cache* c, size_t max_bytes);
+
+/*
+ * append one encoder buffer, idr is set for the first buffer of a keyframe
+ * access unit and starts a new GOP
+ * return 0 if the buffer is cached
+ */
+int gop_cache_add(struct gop_cache* c, const uint8_t* data, size_t length,
+        int flags, uint32_t ts, int idr);
+
+/*
+ * forget the cached GOP, wait for the next keyframe
+ */
+void gop_cache_reset(struct gop_cache* c);
+
+/*
+ * change the limit, memory above it is given back
+ */
+void gop_cache_set_limit(struct gop_cache* c, size_t max_bytes);
+
+//bytes held by the cache, data and index
+size_t gop_cache_memory(const struct gop_cache* c);
+
+#endif
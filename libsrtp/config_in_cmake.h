@@ -18,6 +18,9 @@
 /* Define this to use OpenSSL crypto. */
 #cmakedefine OPENSSL 1
 
+/* Define this to use the ARMv8 Crypto Extensions where the CPU has them. */
+#cmakedefine ENABLE_ARMV8_CRYPTO 1
+
 /* Define this to use AES-GCM. */
 #cmakedefine GCM 1
 
@@ -2158,6 +2158,37 @@ void srtp_aes_encrypt(v128_t *plaintext, const srtp_aes_expanded_key_t *exp_key)
     }
 }
 
+/*
+ * four blocks go through the rounds side by side, their table lookups
+ * are independent and overlap instead of waiting on each other
+ */
+void srtp_aes_encrypt_blocks(v128_t *blocks,
+                             int num_blocks,
+                             const srtp_aes_expanded_key_t *exp_key)
+{
+    int i;
+
+    for (; num_blocks >= 4; num_blocks -= 4, blocks += 4) {
+        v128_xor_eq(&blocks[0], &exp_key->round[0]);
+        v128_xor_eq(&blocks[1], &exp_key->round[0]);
+        v128_xor_eq(&blocks[2], &exp_key->round[0]);
+        v128_xor_eq(&blocks[3], &exp_key->round[0]);
+        for (i = 1; i < exp_key->num_rounds; i++) {
+            aes_round(&blocks[0], &exp_key->round[i]);
+            aes_round(&blocks[1], &exp_key->round[i]);
+            aes_round(&blocks[2], &exp_key->round[i]);
+            aes_round(&blocks[3], &exp_key->round[i]);
+        }
+        aes_final_round(&blocks[0], &exp_key->round[i]);
+        aes_final_round(&blocks[1], &exp_key->round[i]);
+        aes_final_round(&blocks[2], &exp_key->round[i]);
+        aes_final_round(&blocks[3], &exp_key->round[i]);
+    }
+    for (; num_blocks > 0; num_blocks--, blocks++) {
+        srtp_aes_encrypt(blocks, exp_key);
+    }
+}
+
 void srtp_aes_decrypt(v128_t *plaintext, const srtp_aes_expanded_key_t *exp_key)
 {
     /* add in the subkey */
@@ -0,0 +1,172 @@
+/*
+ * aes_bs.c
+ *
+ * bitsliced constant time AES, encryption only
+ *
+ * the layout follows the aes_ct64 code of BearSSL (Thomas Pornin, MIT
+ * license): four blocks are spread over eight 64-bit words, word i
+ * holding bit i of every byte, and the S-box is the circuit of Boyar and
+ * Peralta, "A new combinational logic minimization technique with
+ * applications to cryptology" (https://eprint.iacr.org/2009/191.pdf)
+ *
+ * this file has the key schedule and the rounds on 64-bit words, which a
+ * 32-bit core runs as pairs of 32-bit operations, aes_bs_vector.c has the
+ * same rounds on NEON (or SSE2) words of two 64-bit lanes, eight blocks
+ * per pass, and is used when the CPU has them
+ *
+ * the round keys are kept in the 2 words per round compressed form, so
+ * they fit srtp_aes_expanded_key_t, and expanded on every call
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "aes_bs.h"
+
+/* 32-bit ARM has NEON or not, the vector file is built for it anyway */
+#if defined(__GNUC__) && defined(__arm__) && defined(__linux__)
+#define SRTP_AES_BS_NEON_HWCAP 1
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+typedef uint64_t srtp_aes_bs_word_t;
+#define SRTP_AES_BS_LANES 1
+
+#include "aes_bs_core.h"
+
+typedef void (*srtp_aes_bs_blocks_func_t)(
+    v128_t *blocks,
+    int num_blocks,
+    const srtp_aes_expanded_key_t *exp_key);
+
+/*
+ * the rounds srtp_aes_bs_encrypt_blocks() runs, chosen on first use
+ */
+static srtp_aes_bs_blocks_func_t srtp_aes_bs_blocks_func = NULL;
+
+/*
+ * SubWord() of the key schedule through the bitsliced S-box, so that the
+ * key doesn't index a table either
+ */
+static uint32_t srtp_aes_bs_sub_word(uint32_t x)
+{
+    uint64_t q[8] = { 0 };
+
+    q[0] = x;
+    srtp_aes_bs_ortho(q);
+    srtp_aes_bs_sbox(q);
+    srtp_aes_bs_ortho(q);
+    return (uint32_t)q[0];
+}
+
+srtp_err_status_t srtp_aes_bs_expand_encryption_key(
+    const uint8_t *key,
+    int key_len,
+    srtp_aes_expanded_key_t *expanded_key)
+{
+    static const uint8_t rcon[] = { 0x01, 0x02, 0x04, 0x08, 0x10,
+                                    0x20, 0x40, 0x80, 0x1B, 0x36 };
+    uint32_t w[60];
+    uint32_t tmp;
+    int num_rounds, nk, nkf, i, j, k;
+
+    if (key_len == 16) {
+        num_rounds = 10;
+    } else if (key_len == 32) {
+        num_rounds = 14;
+    } else {
+        /* AES-192 is not supported by the table version either */
+        return srtp_err_status_bad_param;
+    }
+    nk = key_len / 4;
+    nkf = (num_rounds + 1) * 4;
+
+    /* the standard key schedule on little endian words */
+    for (i = 0; i < nk; i++) {
+        w[i] = (uint32_t)key[4 * i] | ((uint32_t)key[4 * i + 1] << 8) |
+               ((uint32_t)key[4 * i + 2] << 16) |
+               ((uint32_t)key[4 * i + 3] << 24);
+    }
+    tmp = w[nk - 1];
+    for (i = nk, j = 0, k = 0; i < nkf; i++) {
+        if (j == 0) {
+            tmp = (tmp << 24) | (tmp >> 8);
+            tmp = srtp_aes_bs_sub_word(tmp) ^ rcon[k];
+        } else if (nk > 6 && j == 4) {
+            tmp = srtp_aes_bs_sub_word(tmp);
+        }
+        tmp ^= w[i - nk];
+        w[i] = tmp;
+        if (++j == nk) {
+            j = 0;
+            k++;
+        }
+    }
+
+    /* bitslice each round key, keep one bit of each plane per nibble */
+    for (i = 0; i <= num_rounds; i++) {
+        uint64_t q[8];
+        uint8_t b[16];
+
+        for (j = 0; j < 4; j++) {
+            b[4 * j] = (uint8_t)w[4 * i + j];
+            b[4 * j + 1] = (uint8_t)(w[4 * i + j] >> 8);
+            b[4 * j + 2] = (uint8_t)(w[4 * i + j] >> 16);
+            b[4 * j + 3] = (uint8_t)(w[4 * i + j] >> 24);
+        }
+        srtp_aes_bs_interleave_in(&q[0], &q[4], b);
+        q[1] = q[2] = q[3] = q[0];
+        q[5] = q[6] = q[7] = q[4];
+        srtp_aes_bs_ortho(q);
+        expanded_key->round[i].v64[0] =
+            (q[0] & 0x1111111111111111ULL) | (q[1] & 0x2222222222222222ULL) |
+            (q[2] & 0x4444444444444444ULL) | (q[3] & 0x8888888888888888ULL);
+        expanded_key->round[i].v64[1] =
+            (q[4] & 0x1111111111111111ULL) | (q[5] & 0x2222222222222222ULL) |
+            (q[6] & 0x4444444444444444ULL) | (q[7] & 0x8888888888888888ULL);
+        octet_string_set_to_zero(b, sizeof(b));
+    }
+    expanded_key->num_rounds = num_rounds;
+    octet_string_set_to_zero(w, sizeof(w));
+
+    return srtp_err_status_ok;
+}
+
+void srtp_aes_bs_scalar_blocks(v128_t *blocks,
+                               int num_blocks,
+                               const srtp_aes_expanded_key_t *exp_key)
+{
+    srtp_aes_bs_encrypt_passes(blocks, num_blocks, exp_key);
+}
+
+int srtp_aes_bs_vector_available(void)
+{
+    if (!srtp_aes_bs_vector_built()) {
+        return 0;
+    }
+#ifdef SRTP_AES_BS_NEON_HWCAP
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+    /* NEON on aarch64 and SSE2 on x86-64 are always there */
+    return 1;
+#endif
+}
+
+void srtp_aes_bs_encrypt_blocks(v128_t *blocks,
+                                int num_blocks,
+                                const srtp_aes_expanded_key_t *exp_key)
+{
+    if (srtp_aes_bs_blocks_func == NULL) {
+        srtp_aes_bs_blocks_func = srtp_aes_bs_vector_available()
+                                      ? srtp_aes_bs_vector_blocks
+                                      : srtp_aes_bs_scalar_blocks;
+    }
+    srtp_aes_bs_blocks_func(blocks, num_blocks, exp_key);
+}
+
+const char *srtp_aes_bs_name(void)
+{
+    return srtp_aes_bs_vector_available() ? "128 bit vector" : "64 bit";
+}
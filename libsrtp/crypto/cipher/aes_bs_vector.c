@@ -0,0 +1,50 @@
+/*
+ * aes_bs_vector.c
+ *
+ * the rounds of aes_bs.c on NEON (or SSE2) words of two 64-bit lanes,
+ * one pass encrypts eight blocks
+ *
+ * on 32-bit ARM this file alone is built with -mfpu=neon, nothing in it
+ * runs unless srtp_aes_bs_vector_available() found NEON at run time
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "aes_bs.h"
+
+#if defined(__GNUC__) && (defined(__ARM_NEON) || defined(__SSE2__))
+
+typedef uint64_t srtp_aes_bs_word_t __attribute__((vector_size(16)));
+#define SRTP_AES_BS_LANES 2
+
+#include "aes_bs_core.h"
+
+int srtp_aes_bs_vector_built(void)
+{
+    return 1;
+}
+
+void srtp_aes_bs_vector_blocks(v128_t *blocks,
+                               int num_blocks,
+                               const srtp_aes_expanded_key_t *exp_key)
+{
+    srtp_aes_bs_encrypt_passes(blocks, num_blocks, exp_key);
+}
+
+#else
+
+int srtp_aes_bs_vector_built(void)
+{
+    return 0;
+}
+
+void srtp_aes_bs_vector_blocks(v128_t *blocks,
+                               int num_blocks,
+                               const srtp_aes_expanded_key_t *exp_key)
+{
+    srtp_aes_bs_scalar_blocks(blocks, num_blocks, exp_key);
+}
+
+#endif
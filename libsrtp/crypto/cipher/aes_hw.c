@@ -0,0 +1,217 @@
+/*
+ * aes_hw.c
+ *
+ * AES block encryption with AES-NI or the ARMv8 Crypto Extensions
+ *
+ * the instructions are enabled per function, the rest of the library is
+ * built for the baseline CPU and this code only runs after
+ * srtp_aes_hw_available() found them at run time
+ *
+ * the ARMv8 code is only built with ENABLE_ARMV8_CRYPTO, otherwise aarch64
+ * uses the tables
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "aes_hw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SRTP_AES_HW_X86 1
+#include <cpuid.h>
+#include <wmmintrin.h>
+#elif defined(ENABLE_ARMV8_CRYPTO) && defined(__GNUC__) &&                     \
+    defined(__aarch64__) && defined(__linux__)
+#define SRTP_AES_HW_ARMV8 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/* blocks in flight in srtp_aes_hw_encrypt_blocks() */
+#define SRTP_AES_HW_BLOCKS 8
+
+#ifdef SRTP_AES_HW_X86
+
+static int srtp_aes_hw_probe(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+
+const char *srtp_aes_hw_name(void)
+{
+    return "AES-NI";
+}
+
+__attribute__((target("aes,sse2"))) void srtp_aes_hw_encrypt(
+    v128_t *plaintext,
+    const srtp_aes_expanded_key_t *exp_key)
+{
+    const __m128i *rk = (const __m128i *)exp_key->round;
+    __m128i s;
+    int i;
+
+    s = _mm_loadu_si128((const __m128i *)plaintext);
+    s = _mm_xor_si128(s, _mm_loadu_si128(&rk[0]));
+    for (i = 1; i < exp_key->num_rounds; i++) {
+        s = _mm_aesenc_si128(s, _mm_loadu_si128(&rk[i]));
+    }
+    s = _mm_aesenclast_si128(s, _mm_loadu_si128(&rk[exp_key->num_rounds]));
+    _mm_storeu_si128((__m128i *)plaintext, s);
+}
+
+/*
+ * AESENC has a latency of several cycles but a new one can start every
+ * cycle, eight independent blocks keep the unit busy
+ */
+__attribute__((target("aes,sse2"))) void srtp_aes_hw_encrypt_blocks(
+    v128_t *blocks,
+    int num_blocks,
+    const srtp_aes_expanded_key_t *exp_key)
+{
+    const __m128i *rk = (const __m128i *)exp_key->round;
+    __m128i s[SRTP_AES_HW_BLOCKS], k;
+    int i, j;
+
+    for (; num_blocks >= SRTP_AES_HW_BLOCKS;
+         num_blocks -= SRTP_AES_HW_BLOCKS, blocks += SRTP_AES_HW_BLOCKS) {
+        k = _mm_loadu_si128(&rk[0]);
+        for (j = 0; j < SRTP_AES_HW_BLOCKS; j++) {
+            s[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blocks[j]),
+                                 k);
+        }
+        for (i = 1; i < exp_key->num_rounds; i++) {
+            k = _mm_loadu_si128(&rk[i]);
+            for (j = 0; j < SRTP_AES_HW_BLOCKS; j++) {
+                s[j] = _mm_aesenc_si128(s[j], k);
+            }
+        }
+        k = _mm_loadu_si128(&rk[i]);
+        for (j = 0; j < SRTP_AES_HW_BLOCKS; j++) {
+            _mm_storeu_si128((__m128i *)&blocks[j],
+                             _mm_aesenclast_si128(s[j], k));
+        }
+    }
+    for (; num_blocks > 0; num_blocks--, blocks++) {
+        srtp_aes_hw_encrypt(blocks, exp_key);
+    }
+}
+
+#elif defined(SRTP_AES_HW_ARMV8)
+
+static int srtp_aes_hw_probe(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+}
+
+const char *srtp_aes_hw_name(void)
+{
+    return "ARMv8 CE";
+}
+
+/*
+ * AESE is AddRoundKey, SubBytes and ShiftRows, AESMC is MixColumns, so
+ * the first key goes into the first AESE and the last one is a plain xor
+ */
+#ifdef __clang__
+__attribute__((target("aes")))
+#else
+__attribute__((target("+crypto")))
+#endif
+void srtp_aes_hw_encrypt(v128_t *plaintext,
+                         const srtp_aes_expanded_key_t *exp_key)
+{
+    const uint8_t *rk = exp_key->round[0].v8;
+    uint8x16_t s;
+    int i;
+
+    s = vld1q_u8(plaintext->v8);
+    for (i = 0; i < exp_key->num_rounds - 1; i++) {
+        s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(rk + 16 * i)));
+    }
+    s = vaeseq_u8(s, vld1q_u8(rk + 16 * i));
+    s = veorq_u8(s, vld1q_u8(rk + 16 * (i + 1)));
+    vst1q_u8(plaintext->v8, s);
+}
+
+/*
+ * AESE and AESMC of independent blocks pair up and pipeline, eight of
+ * them hide the latency
+ */
+#ifdef __clang__
+__attribute__((target("aes")))
+#else
+__attribute__((target("+crypto")))
+#endif
+void srtp_aes_hw_encrypt_blocks(v128_t *blocks,
+                                int num_blocks,
+                                const srtp_aes_expanded_key_t *exp_key)
+{
+    const uint8_t *rk = exp_key->round[0].v8;
+    uint8x16_t s[SRTP_AES_HW_BLOCKS], k;
+    int i, j;
+
+    for (; num_blocks >= SRTP_AES_HW_BLOCKS;
+         num_blocks -= SRTP_AES_HW_BLOCKS, blocks += SRTP_AES_HW_BLOCKS) {
+        for (j = 0; j < SRTP_AES_HW_BLOCKS; j++) {
+            s[j] = vld1q_u8(blocks[j].v8);
+        }
+        for (i = 0; i < exp_key->num_rounds - 1; i++) {
+            k = vld1q_u8(rk + 16 * i);
+            for (j = 0; j < SRTP_AES_HW_BLOCKS; j++) {
+                s[j] = vaesmcq_u8(vaeseq_u8(s[j], k));
+            }
+        }
+        k = vld1q_u8(rk + 16 * i);
+        for (j = 0; j < SRTP_AES_HW_BLOCKS; j++) {
+            s[j] = veorq_u8(vaeseq_u8(s[j], k), vld1q_u8(rk + 16 * (i + 1)));
+            vst1q_u8(blocks[j].v8, s[j]);
+        }
+    }
+    for (; num_blocks > 0; num_blocks--, blocks++) {
+        srtp_aes_hw_encrypt(blocks, exp_key);
+    }
+}
+
+#else
+
+static int srtp_aes_hw_probe(void)
+{
+    return 0;
+}
+
+const char *srtp_aes_hw_name(void)
+{
+    return "none";
+}
+
+void srtp_aes_hw_encrypt(v128_t *plaintext,
+                         const srtp_aes_expanded_key_t *exp_key)
+{
+    srtp_aes_encrypt(plaintext, exp_key);
+}
+
+void srtp_aes_hw_encrypt_blocks(v128_t *blocks,
+                                int num_blocks,
+                                const srtp_aes_expanded_key_t *exp_key)
+{
+    srtp_aes_encrypt_blocks(blocks, num_blocks, exp_key);
+}
+
+#endif
+
+int srtp_aes_hw_available(void)
+{
+    static int available = -1;
+
+    if (available < 0) {
+        available = srtp_aes_hw_probe();
+    }
+    return available;
+}
@@ -47,9 +47,9 @@
 #include <config.h>
 #endif
 
-#define ALIGN_32 0
-
 #include "aes_icm.h"
+#include "aes_hw.h"
+#include "aes_bs.h"
 #include "alloc.h"
 #include "cipher_types.h"
 
@@ -177,7 +177,19 @@ static srtp_err_status_t srtp_aes_icm_dealloc(srtp_cipher_t *c)
  * randomizes the starting point in the keystream
  */
 
-static srtp_err_status_t srtp_aes_icm_context_init(void *cv, const uint8_t *key)
+/*
+ * the key schedule of the block cipher, bitsliced round keys differ from
+ * the ones of the table and hardware versions
+ */
+typedef srtp_err_status_t (*srtp_aes_icm_expand_func_t)(
+    const uint8_t *key,
+    int key_len,
+    srtp_aes_expanded_key_t *expanded_key);
+
+static inline srtp_err_status_t srtp_aes_icm_init(
+    void *cv,
+    const uint8_t *key,
+    srtp_aes_icm_expand_func_t expand)
 {
     srtp_aes_icm_ctx_t *c = (srtp_aes_icm_ctx_t *)cv;
     srtp_err_status_t status;
@@ -212,8 +224,7 @@ static srtp_err_status_t srtp_aes_icm_context_init(void *cv, const uint8_t *key)
     debug_print(srtp_mod_aes_icm, "offset: %s", v128_hex_string(&c->offset));
 
     /* expand key */
-    status =
-        srtp_aes_expand_encryption_key(key, base_key_len, &c->expanded_key);
+    status = expand(key, base_key_len, &c->expanded_key);
     if (status) {
         v128_set_to_zero(&c->counter);
         v128_set_to_zero(&c->offset);
@@ -226,6 +237,17 @@ static srtp_err_status_t srtp_aes_icm_context_init(void *cv, const uint8_t *key)
     return srtp_err_status_ok;
 }
 
+static srtp_err_status_t srtp_aes_icm_context_init(void *cv, const uint8_t *key)
+{
+    return srtp_aes_icm_init(cv, key, srtp_aes_expand_encryption_key);
+}
+
+static srtp_err_status_t srtp_aes_icm_bs_context_init(void *cv,
+                                                      const uint8_t *key)
+{
+    return srtp_aes_icm_init(cv, key, srtp_aes_bs_expand_encryption_key);
+}
+
 /*
  * aes_icm_set_iv(c, iv) sets the counter value to the exor of iv with
  * the offset
@@ -254,17 +276,30 @@ static srtp_err_status_t srtp_aes_icm_set_iv(void *cv,
     return srtp_err_status_ok;
 }
 
+/* counter blocks that go through the block cipher together */
+#define SRTP_AES_ICM_BLOCKS 8
+
+/*
+ * the block cipher behind the counter mode, the table implementation
+ * srtp_aes_encrypt_blocks() or srtp_aes_hw_encrypt_blocks()
+ */
+typedef void (*srtp_aes_icm_block_func_t)(
+    v128_t *blocks,
+    int num_blocks,
+    const srtp_aes_expanded_key_t *exp_key);
+
 /*
  * aes_icm_advance(...) refills the keystream_buffer and
  * advances the block index of the sicm_context forward by one
  *
  * this is an internal, hopefully inlined function
  */
-static void srtp_aes_icm_advance(srtp_aes_icm_ctx_t *c)
+static inline void srtp_aes_icm_advance(srtp_aes_icm_ctx_t *c,
+                                        srtp_aes_icm_block_func_t encrypt)
 {
     /* fill buffer with new keystream */
     v128_copy(&c->keystream_buffer, &c->counter);
-    srtp_aes_encrypt(&c->keystream_buffer, &c->expanded_key);
+    encrypt(&c->keystream_buffer, 1, &c->expanded_key);
     c->bytes_in_buffer = sizeof(v128_t);
 
     debug_print(srtp_mod_aes_icm, "counter:    %s",
@@ -278,27 +313,56 @@ static void srtp_aes_icm_advance(srtp_aes_icm_ctx_t *c)
     }
 }
 
+/*
+ * aes_icm_keystream(...) writes the next num_blocks blocks of keystream
+ * to blocks and advances the block index by num_blocks, the blocks are
+ * encrypted in one call so that their rounds can overlap
+ *
+ * the block index is the last 16 bits of the counter and wraps like in
+ * srtp_aes_icm_advance()
+ */
+static inline void srtp_aes_icm_keystream(srtp_aes_icm_ctx_t *c,
+                                          v128_t *blocks,
+                                          int num_blocks,
+                                          srtp_aes_icm_block_func_t encrypt)
+{
+    uint16_t index = ntohs(c->counter.v16[7]);
+    int i;
+
+    for (i = 0; i < num_blocks; i++) {
+        v128_copy(&blocks[i], &c->counter);
+        blocks[i].v16[7] = htons((uint16_t)(index + i));
+    }
+    c->counter.v16[7] = htons((uint16_t)(index + num_blocks));
+
+    encrypt(blocks, num_blocks, &c->expanded_key);
+}
+
 /*
  * icm_encrypt deals with the following cases:
  *
- * bytes_to_encr < bytes_in_buffer
+ * bytes_to_encr <= bytes_in_buffer
  *  - add keystream into data
  *
  * bytes_to_encr > bytes_in_buffer
  *  - add keystream into data until keystream_buffer is depleted
- *  - loop over blocks, filling keystream_buffer and then
- *    adding keystream into data
+ *  - loop over runs of up to SRTP_AES_ICM_BLOCKS blocks, generating
+ *    their keystream at once and adding it into data
  *  - fill buffer then add in remaining (< 16) bytes of keystream
+ *
+ * keystream is added a word at a time by srtp_octet_string_xor()
  */
 
-static srtp_err_status_t srtp_aes_icm_encrypt(void *cv,
-                                              unsigned char *buf,
-                                              unsigned int *enc_len)
+static inline srtp_err_status_t srtp_aes_icm_crypt(
+    void *cv,
+    unsigned char *buf,
+    unsigned int *enc_len,
+    srtp_aes_icm_block_func_t encrypt)
 {
     srtp_aes_icm_ctx_t *c = (srtp_aes_icm_ctx_t *)cv;
     unsigned int bytes_to_encr = *enc_len;
-    unsigned int i;
-    uint32_t *b;
+    v128_t keystream[SRTP_AES_ICM_BLOCKS];
+    unsigned int n;
 
     /* check that there's enough segment left*/
     if ((bytes_to_encr + htons(c->counter.v16[7])) > 0xffff) {
@@ -306,98 +370,133 @@ static srtp_err_status_t srtp_aes_icm_encrypt(void *cv,
     }
 
     debug_print(srtp_mod_aes_icm, "block index: %d", htons(c->counter.v16[7]));
-    if (bytes_to_encr <= (unsigned int)c->bytes_in_buffer) {
-        /* deal with odd case of small bytes_to_encr */
-        for (i = (sizeof(v128_t) - c->bytes_in_buffer);
-             i < (sizeof(v128_t) - c->bytes_in_buffer + bytes_to_encr); i++) {
-            *buf++ ^= c->keystream_buffer.v8[i];
-        }
 
-        c->bytes_in_buffer -= bytes_to_encr;
-
-        /* return now to avoid the main loop */
-        return srtp_err_status_ok;
+    /* use up the keystream left over from the last call */
+    n = (unsigned int)c->bytes_in_buffer;
+    if (n > bytes_to_encr) {
+        n = bytes_to_encr;
+    }
+    srtp_octet_string_xor(
+        buf, c->keystream_buffer.v8 + sizeof(v128_t) - c->bytes_in_buffer, n);
+    buf += n;
+    bytes_to_encr -= n;
+    c->bytes_in_buffer -= n;
 
-    } else {
-        /* encrypt bytes until the remaining data is 16-byte aligned */
-        for (i = (sizeof(v128_t) - c->bytes_in_buffer); i < sizeof(v128_t);
-             i++) {
-            *buf++ ^= c->keystream_buffer.v8[i];
+    /* now loop over entire 16-byte blocks of keystream */
+    while (bytes_to_encr >= sizeof(v128_t)) {
+        n = bytes_to_encr / sizeof(v128_t);
+        if (n > SRTP_AES_ICM_BLOCKS) {
+            n = SRTP_AES_ICM_BLOCKS;
         }
-
-        bytes_to_encr -= c->bytes_in_buffer;
-        c->bytes_in_buffer = 0;
+        srtp_aes_icm_keystream(c, keystream, n, encrypt);
+        srtp_octet_string_xor(buf, keystream[0].v8, n * sizeof(v128_t));
+        buf += n * sizeof(v128_t);
+        bytes_to_encr -= n * sizeof(v128_t);
     }
 
-    /* now loop over entire 16-byte blocks of keystream */
-    for (i = 0; i < (bytes_to_encr / sizeof(v128_t)); i++) {
+    /* if there is a tail end of the data, process it */
+    if (bytes_to_encr != 0) {
         /* fill buffer with new keystream */
-        srtp_aes_icm_advance(c);
+        srtp_aes_icm_advance(c, encrypt);
+        srtp_octet_string_xor(buf, c->keystream_buffer.v8, bytes_to_encr);
+
+        /* reset the keystream buffer size to right value */
+        c->bytes_in_buffer = sizeof(v128_t) - bytes_to_encr;
+    }
+
+    return srtp_err_status_ok;
+}
+
+static srtp_err_status_t srtp_aes_icm_encrypt(void *cv,
+                                              unsigned char *buf,
+                                              unsigned int *enc_len)
+{
+    return srtp_aes_icm_crypt(cv, buf, enc_len, srtp_aes_encrypt_blocks);
+}
 
 /*
- * add keystream into the data buffer (this would be a lot faster
- * if we could assume 32-bit alignment!)
+ * same counter mode with the AES instructions of the CPU, the context
+ * and the key schedule are shared with the table version
  */
+static srtp_err_status_t srtp_aes_icm_hw_encrypt(void *cv,
+                                                 unsigned char *buf,
+                                                 unsigned int *enc_len)
+{
+    return srtp_aes_icm_crypt(cv, buf, enc_len, srtp_aes_hw_encrypt_blocks);
+}
 
-#if ALIGN_32
-        b = (uint32_t *)buf;
-        *b++ ^= c->keystream_buffer.v32[0];
-        *b++ ^= c->keystream_buffer.v32[1];
-        *b++ ^= c->keystream_buffer.v32[2];
-        *b++ ^= c->keystream_buffer.v32[3];
-        buf = (uint8_t *)b;
-#else
-        if ((((uintptr_t)buf) & 0x03) != 0) {
-            *buf++ ^= c->keystream_buffer.v8[0];
-            *buf++ ^= c->keystream_buffer.v8[1];
-            *buf++ ^= c->keystream_buffer.v8[2];
-            *buf++ ^= c->keystream_buffer.v8[3];
-            *buf++ ^= c->keystream_buffer.v8[4];
-            *buf++ ^= c->keystream_buffer.v8[5];
-            *buf++ ^= c->keystream_buffer.v8[6];
-            *buf++ ^= c->keystream_buffer.v8[7];
-            *buf++ ^= c->keystream_buffer.v8[8];
-            *buf++ ^= c->keystream_buffer.v8[9];
-            *buf++ ^= c->keystream_buffer.v8[10];
-            *buf++ ^= c->keystream_buffer.v8[11];
-            *buf++ ^= c->keystream_buffer.v8[12];
-            *buf++ ^= c->keystream_buffer.v8[13];
-            *buf++ ^= c->keystream_buffer.v8[14];
-            *buf++ ^= c->keystream_buffer.v8[15];
-        } else {
-            b = (uint32_t *)buf;
-            *b++ ^= c->keystream_buffer.v32[0];
-            *b++ ^= c->keystream_buffer.v32[1];
-            *b++ ^= c->keystream_buffer.v32[2];
-            *b++ ^= c->keystream_buffer.v32[3];
-            buf = (uint8_t *)b;
-        }
-#endif /* #if ALIGN_32 */
-    }
-
-    /* if there is a tail end of the data, process it */
-    if ((bytes_to_encr & 0xf) != 0) {
-        /* fill buffer with new keystream */
-        srtp_aes_icm_advance(c);
+/*
+ * same counter mode with the bitsliced AES, slower than the tables on
+ * most CPUs but without lookups that depend on the key or the data
+ */
+static srtp_err_status_t srtp_aes_icm_bs_encrypt(void *cv,
+                                                 unsigned char *buf,
+                                                 unsigned int *enc_len)
+{
+    return srtp_aes_icm_crypt(cv, buf, enc_len, srtp_aes_bs_encrypt_blocks);
+}
 
-        for (i = 0; i < (bytes_to_encr & 0xf); i++) {
-            *buf++ ^= c->keystream_buffer.v8[i];
-        }
+/*
+ * allocates like srtp_aes_icm_alloc() for one of the other
+ * implementations
+ */
+static srtp_err_status_t srtp_aes_icm_alloc_type(
+    srtp_cipher_t **c,
+    int key_len,
+    int tlen,
+    const srtp_cipher_type_t *type_128,
+    const srtp_cipher_type_t *type_256)
+{
+    srtp_err_status_t status;
 
-        /* reset the keystream buffer size to right value */
-        c->bytes_in_buffer = sizeof(v128_t) - i;
+    status = srtp_aes_icm_alloc(c, key_len, tlen);
+    if (status) {
+        return status;
+    }
+    if ((*c)->algorithm == SRTP_AES_ICM_256) {
+        (*c)->type = type_256;
     } else {
-        /* no tail, so just reset the keystream buffer size to zero */
-        c->bytes_in_buffer = 0;
+        (*c)->type = type_128;
     }
 
     return srtp_err_status_ok;
 }
 
+static srtp_err_status_t srtp_aes_icm_hw_alloc(srtp_cipher_t **c,
+                                               int key_len,
+                                               int tlen)
+{
+    return srtp_aes_icm_alloc_type(c, key_len, tlen, &srtp_aes_icm_128_hw,
+                                   &srtp_aes_icm_256_hw);
+}
+
+static srtp_err_status_t srtp_aes_icm_bs_alloc(srtp_cipher_t **c,
+                                               int key_len,
+                                               int tlen)
+{
+    return srtp_aes_icm_alloc_type(c, key_len, tlen, &srtp_aes_icm_128_bs,
+                                   &srtp_aes_icm_256_bs);
+}
+
 static const char srtp_aes_icm_128_description[] =
     "AES-128 integer counter mode";
 static const char srtp_aes_icm_256_description[] =
     "AES-256 integer counter mode";
+#if defined(__x86_64__) || defined(__i386__)
+static const char srtp_aes_icm_128_hw_description[] =
+    "AES-128 integer counter mode (AES-NI)";
+static const char srtp_aes_icm_256_hw_description[] =
+    "AES-256 integer counter mode (AES-NI)";
+#else
+static const char srtp_aes_icm_128_hw_description[] =
+    "AES-128 integer counter mode (ARMv8 CE)";
+static const char srtp_aes_icm_256_hw_description[] =
+    "AES-256 integer counter mode (ARMv8 CE)";
+#endif
+static const char srtp_aes_icm_128_bs_description[] =
+    "AES-128 integer counter mode (bitsliced)";
+static const char srtp_aes_icm_256_bs_description[] =
+    "AES-256 integer counter mode (bitsliced)";
 
 /* clang-format off */
 static const uint8_t srtp_aes_icm_128_test_case_0_key[SRTP_AES_ICM_128_KEY_LEN_WSALT] = {
@@ -528,3 +627,69 @@ const srtp_cipher_type_t srtp_aes_icm_256 = {
     &srtp_aes_icm_256_test_case_0, /* */
     SRTP_AES_ICM_256               /* */
 };
+
+/*
+ * the hardware versions pass the same test cases, srtp_crypto_kernel_init()
+ * loads them instead of the table versions if srtp_aes_hw_available()
+ */
+
+const srtp_cipher_type_t srtp_aes_icm_128_hw = {
+    srtp_aes_icm_hw_alloc,           /* */
+    srtp_aes_icm_dealloc,            /* */
+    srtp_aes_icm_context_init,       /* */
+    0,                               /* set_aad */
+    srtp_aes_icm_hw_encrypt,         /* */
+    srtp_aes_icm_hw_encrypt,         /* */
+    srtp_aes_icm_set_iv,             /* */
+    0,                               /* get_tag */
+    srtp_aes_icm_128_hw_description, /* */
+    &srtp_aes_icm_128_test_case_0,   /* */
+    SRTP_AES_ICM_128                 /* */
+};
+
+const srtp_cipher_type_t srtp_aes_icm_256_hw = {
+    srtp_aes_icm_hw_alloc,           /* */
+    srtp_aes_icm_dealloc,            /* */
+    srtp_aes_icm_context_init,       /* */
+    0,                               /* set_aad */
+    srtp_aes_icm_hw_encrypt,         /* */
+    srtp_aes_icm_hw_encrypt,         /* */
+    srtp_aes_icm_set_iv,             /* */
+    0,                               /* get_tag */
+    srtp_aes_icm_256_hw_description, /* */
+    &srtp_aes_icm_256_test_case_0,   /* */
+    SRTP_AES_ICM_256                 /* */
+};
+
+/*
+ * the bitsliced versions are only used when selected with
+ * srtp_set_aes_icm_impl()
+ */
+
+const srtp_cipher_type_t srtp_aes_icm_128_bs = {
+    srtp_aes_icm_bs_alloc,           /* */
+    srtp_aes_icm_dealloc,            /* */
+    srtp_aes_icm_bs_context_init,    /* */
+    0,                               /* set_aad */
+    srtp_aes_icm_bs_encrypt,         /* */
+    srtp_aes_icm_bs_encrypt,         /* */
+    srtp_aes_icm_set_iv,             /* */
+    0,                               /* get_tag */
+    srtp_aes_icm_128_bs_description, /* */
+    &srtp_aes_icm_128_test_case_0,   /* */
+    SRTP_AES_ICM_128                 /* */
+};
+
+const srtp_cipher_type_t srtp_aes_icm_256_bs = {
+    srtp_aes_icm_bs_alloc,           /* */
+    srtp_aes_icm_dealloc,            /* */
+    srtp_aes_icm_bs_context_init,    /* */
+    0,                               /* set_aad */
+    srtp_aes_icm_bs_encrypt,         /* */
+    srtp_aes_icm_bs_encrypt,         /* */
+    srtp_aes_icm_set_iv,             /* */
+    0,                               /* get_tag */
+    srtp_aes_icm_256_bs_description, /* */
+    &srtp_aes_icm_256_test_case_0,   /* */
+    SRTP_AES_ICM_256                 /* */
+};
@@ -118,6 +118,7 @@ static srtp_err_status_t srtp_hmac_init(void *statev,
     srtp_hmac_ctx_t *state = (srtp_hmac_ctx_t *)statev;
     int i;
     uint8_t ipad[64];
+    uint8_t opad[64];
 
     /*
      * check key length - note that we don't support keys larger
@@ -133,12 +134,12 @@ static srtp_err_status_t srtp_hmac_init(void *statev,
      */
     for (i = 0; i < key_len; i++) {
         ipad[i] = key[i] ^ 0x36;
-        state->opad[i] = key[i] ^ 0x5c;
+        opad[i] = key[i] ^ 0x5c;
     }
     /* set the rest of ipad, opad to constant values */
     for (; i < 64; i++) {
         ipad[i] = 0x36;
-        ((uint8_t *)state->opad)[i] = 0x5c;
+        opad[i] = 0x5c;
     }
 
     debug_print(srtp_mod_hmac, "ipad: %s",
@@ -151,6 +152,16 @@ static srtp_err_status_t srtp_hmac_init(void *statev,
     srtp_sha1_update(&state->init_ctx, ipad, 64);
     memcpy(&state->ctx, &state->init_ctx, sizeof(srtp_sha1_ctx_t));
 
+    /*
+     * hash opad ^ key once here, so that every tag costs one compression
+     * less
+     */
+    srtp_sha1_init(&state->opad_ctx);
+    srtp_sha1_update(&state->opad_ctx, opad, 64);
+
+    octet_string_set_to_zero(ipad, sizeof(ipad));
+    octet_string_set_to_zero(opad, sizeof(opad));
+
     return srtp_err_status_ok;
 }
 
@@ -205,11 +216,8 @@ static srtp_err_status_t srtp_hmac_compute(void *statev,
     debug_print(srtp_mod_hmac, "intermediate state: %s",
                 srtp_octet_string_hex_string((uint8_t *)H, 20));
 
-    /* re-initialize hash context */
-    srtp_sha1_init(&state->ctx);
-
-    /* hash opad ^ key  */
-    srtp_sha1_update(&state->ctx, (uint8_t *)state->opad, 64);
+    /* start from the state after opad ^ key */
+    memcpy(&state->ctx, &state->opad_ctx, sizeof(srtp_sha1_ctx_t));
 
     /* hash the result of the inner hash */
     srtp_sha1_update(&state->ctx, (uint8_t *)H, 20);
@@ -47,8 +47,17 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
-
 #include "sha1.h"
+#include "sha1_hw.h"
+
+/* 32-bit ARM has NEON or not, sha1_vector.c is built for it anyway */
+#if defined(__GNUC__) && defined(__arm__) && defined(__linux__)
+#define SRTP_SHA1_NEON_HWCAP 1
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include <string.h>
 
 srtp_debug_module_t srtp_mod_sha1 = {
     0,      /* debugging is off by default */
@@ -76,6 +85,13 @@ uint32_t SHA_K1 = 0x6ED9EBA1; /* Kt for 20 <= t <= 39 */
 uint32_t SHA_K2 = 0x8F1BBCDC; /* Kt for 40 <= t <= 59 */
 uint32_t SHA_K3 = 0xCA62C1D6; /* Kt for 60 <= t <= 79 */
 
+/*
+ * the compression function srtp_sha1_blocks() runs, chosen on first use
+ * or by srtp_sha1_set_blocks_func()
+ */
+static srtp_sha1_blocks_func_t srtp_sha1_blocks_func = NULL;
+static const char *srtp_sha1_blocks_name = NULL;
+
 void srtp_sha1(const uint8_t *msg, int octets_in_msg, uint32_t hash_value[5])
 {
     srtp_sha1_ctx_t ctx;
@@ -86,100 +102,25 @@ void srtp_sha1(const uint8_t *msg, int octets_in_msg, uint32_t hash_value[5])
 }
 
 /*
- *  srtp_sha1_core(M, H) computes the core compression function, where M is
- *  the next part of the message (in network byte order) and H is the
- *  intermediate state { H0, H1, ...} (in host byte order)
- *
- *  this function does not do any of the padding required in the
- *  complete SHA1 function
- *
- *  this function is used in the SEAL 3.0 key setup routines
- *  (crypto/cipher/seal.c)
+ * the 80 rounds over W[t] + Kt + K[t / 20], shared by the scalar schedule
+ * (Kt in K) and the vector one of sha1_vector.c (Kt already added to W,
+ * K zero)
  */
-
-void srtp_sha1_core(const uint32_t M[16], uint32_t hash_value[5])
+void srtp_sha1_rounds(const uint32_t W[80],
+                      const uint32_t K[4],
+                      uint32_t hash_value[5])
 {
-    uint32_t H0;
-    uint32_t H1;
-    uint32_t H2;
-    uint32_t H3;
-    uint32_t H4;
-    uint32_t W[80];
     uint32_t A, B, C, D, E, TEMP;
     int t;
 
-    /* copy hash_value into H0, H1, H2, H3, H4 */
-    H0 = hash_value[0];
-    H1 = hash_value[1];
-    H2 = hash_value[2];
-    H3 = hash_value[3];
-    H4 = hash_value[4];
-
-    /* copy/xor message into array */
-
-    W[0] = be32_to_cpu(M[0]);
-    W[1] = be32_to_cpu(M[1]);
-    W[2] = be32_to_cpu(M[2]);
-    W[3] = be32_to_cpu(M[3]);
-    W[4] = be32_to_cpu(M[4]);
-    W[5] = be32_to_cpu(M[5]);
-    W[6] = be32_to_cpu(M[6]);
-    W[7] = be32_to_cpu(M[7]);
-    W[8] = be32_to_cpu(M[8]);
-    W[9] = be32_to_cpu(M[9]);
-    W[10] = be32_to_cpu(M[10]);
-    W[11] = be32_to_cpu(M[11]);
-    W[12] = be32_to_cpu(M[12]);
-    W[13] = be32_to_cpu(M[13]);
-    W[14] = be32_to_cpu(M[14]);
-    W[15] = be32_to_cpu(M[15]);
-    TEMP = W[13] ^ W[8] ^ W[2] ^ W[0];
-    W[16] = S1(TEMP);
-    TEMP = W[14] ^ W[9] ^ W[3] ^ W[1];
-    W[17] = S1(TEMP);
-    TEMP = W[15] ^ W[10] ^ W[4] ^ W[2];
-    W[18] = S1(TEMP);
-    TEMP = W[16] ^ W[11] ^ W[5] ^ W[3];
-    W[19] = S1(TEMP);
-    TEMP = W[17] ^ W[12] ^ W[6] ^ W[4];
-    W[20] = S1(TEMP);
-    TEMP = W[18] ^ W[13] ^ W[7] ^ W[5];
-    W[21] = S1(TEMP);
-    TEMP = W[19] ^ W[14] ^ W[8] ^ W[6];
-    W[22] = S1(TEMP);
-    TEMP = W[20] ^ W[15] ^ W[9] ^ W[7];
-    W[23] = S1(TEMP);
-    TEMP = W[21] ^ W[16] ^ W[10] ^ W[8];
-    W[24] = S1(TEMP);
-    TEMP = W[22] ^ W[17] ^ W[11] ^ W[9];
-    W[25] = S1(TEMP);
-    TEMP = W[23] ^ W[18] ^ W[12] ^ W[10];
-    W[26] = S1(TEMP);
-    TEMP = W[24] ^ W[19] ^ W[13] ^ W[11];
-    W[27] = S1(TEMP);
-    TEMP = W[25] ^ W[20] ^ W[14] ^ W[12];
-    W[28] = S1(TEMP);
-    TEMP = W[26] ^ W[21] ^ W[15] ^ W[13];
-    W[29] = S1(TEMP);
-    TEMP = W[27] ^ W[22] ^ W[16] ^ W[14];
-    W[30] = S1(TEMP);
-    TEMP = W[28] ^ W[23] ^ W[17] ^ W[15];
-    W[31] = S1(TEMP);
-
-    /* process the remainder of the array */
-    for (t = 32; t < 80; t++) {
-        TEMP = W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16];
-        W[t] = S1(TEMP);
-    }
-
-    A = H0;
-    B = H1;
-    C = H2;
-    D = H3;
-    E = H4;
+    A = hash_value[0];
+    B = hash_value[1];
+    C = hash_value[2];
+    D = hash_value[3];
+    E = hash_value[4];
 
     for (t = 0; t < 20; t++) {
-        TEMP = S5(A) + f0(B, C, D) + E + W[t] + SHA_K0;
+        TEMP = S5(A) + f0(B, C, D) + E + W[t] + K[0];
         E = D;
         D = C;
         C = S30(B);
@@ -187,7 +128,7 @@ void srtp_sha1_core(const uint32_t M[16], uint32_t hash_value[5])
         A = TEMP;
     }
     for (; t < 40; t++) {
-        TEMP = S5(A) + f1(B, C, D) + E + W[t] + SHA_K1;
+        TEMP = S5(A) + f1(B, C, D) + E + W[t] + K[1];
         E = D;
         D = C;
         C = S30(B);
@@ -195,7 +136,7 @@ void srtp_sha1_core(const uint32_t M[16], uint32_t hash_value[5])
         A = TEMP;
     }
     for (; t < 60; t++) {
-        TEMP = S5(A) + f2(B, C, D) + E + W[t] + SHA_K2;
+        TEMP = S5(A) + f2(B, C, D) + E + W[t] + K[2];
         E = D;
         D = C;
         C = S30(B);
@@ -203,7 +144,7 @@ void srtp_sha1_core(const uint32_t M[16], uint32_t hash_value[5])
         A = TEMP;
     }
     for (; t < 80; t++) {
-        TEMP = S5(A) + f3(B, C, D) + E + W[t] + SHA_K3;
+        TEMP = S5(A) + f3(B, C, D) + E + W[t] + K[3];
         E = D;
         D = C;
         C = S30(B);
@@ -211,13 +152,128 @@ void srtp_sha1_core(const uint32_t M[16], uint32_t hash_value[5])
         A = TEMP;
     }
 
-    hash_value[0] = H0 + A;
-    hash_value[1] = H1 + B;
-    hash_value[2] = H2 + C;
-    hash_value[3] = H3 + D;
-    hash_value[4] = H4 + E;
+    hash_value[0] += A;
+    hash_value[1] += B;
+    hash_value[2] += C;
+    hash_value[3] += D;
+    hash_value[4] += E;
+}
 
-    return;
+void srtp_sha1_scalar_blocks(uint32_t hash_value[5],
+                             const uint8_t *msg,
+                             int num_blocks)
+{
+    const uint32_t K[4] = { SHA_K0, SHA_K1, SHA_K2, SHA_K3 };
+    uint32_t W[80];
+    uint32_t TEMP;
+    int t;
+
+    for (; num_blocks > 0; num_blocks--, msg += 64) {
+        /* copy message into array, in host byte order */
+        memcpy(W, msg, 64);
+        for (t = 0; t < 16; t++) {
+            W[t] = be32_to_cpu(W[t]);
+        }
+
+        for (t = 16; t < 80; t++) {
+            TEMP = W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16];
+            W[t] = S1(TEMP);
+        }
+
+        srtp_sha1_rounds(W, K, hash_value);
+    }
+}
+
+
+int srtp_sha1_vector_available(void)
+{
+    if (!srtp_sha1_vector_built()) {
+        return 0;
+    }
+#ifdef SRTP_SHA1_NEON_HWCAP
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+    /* NEON on aarch64 and SSE2 on x86-64 are always there */
+    return 1;
+#endif
+}
+
+static void srtp_sha1_select_default(void)
+{
+    if (srtp_sha1_hw_available() &&
+        srtp_sha1_set_blocks_func(srtp_sha1_hw_blocks, srtp_sha1_hw_name()) ==
+            srtp_err_status_ok) {
+        return;
+    }
+    if (srtp_sha1_vector_available() &&
+        srtp_sha1_set_blocks_func(srtp_sha1_vector_blocks,
+                                  "vector schedule") == srtp_err_status_ok) {
+        return;
+    }
+    srtp_sha1_set_blocks_func(srtp_sha1_scalar_blocks, "scalar");
+}
+
+srtp_err_status_t srtp_sha1_set_blocks_func(srtp_sha1_blocks_func_t func,
+                                            const char *name)
+{
+    uint8_t msg[3 * 64];
+    uint32_t H[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                      0xc3d2e1f0 };
+    uint32_t ref[5];
+    int i;
+
+    /* the scalar code is the reference, over one and over several blocks */
+    for (i = 0; i < (int)sizeof(msg); i++) {
+        msg[i] = (uint8_t)(i * 167 + 13);
+    }
+    memcpy(ref, H, sizeof(ref));
+    srtp_sha1_scalar_blocks(ref, msg, 1);
+    srtp_sha1_scalar_blocks(ref, msg + 64, 2);
+    func(H, msg, 1);
+    func(H, msg + 64, 2);
+    if (memcmp(H, ref, sizeof(ref))) {
+        debug_print(srtp_mod_sha1, "%s disagrees with the scalar code", name);
+        return srtp_err_status_algo_fail;
+    }
+
+    srtp_sha1_blocks_func = func;
+    srtp_sha1_blocks_name = name;
+    return srtp_err_status_ok;
+}
+
+const char *srtp_sha1_get_blocks_name(void)
+{
+    if (srtp_sha1_blocks_func == NULL) {
+        srtp_sha1_select_default();
+    }
+    return srtp_sha1_blocks_name;
+}
+
+void srtp_sha1_blocks(uint32_t hash_value[5],
+                      const uint8_t *msg,
+                      int num_blocks)
+{
+    if (srtp_sha1_blocks_func == NULL) {
+        srtp_sha1_select_default();
+    }
+    srtp_sha1_blocks_func(hash_value, msg, num_blocks);
+}
+
+/*
+ *  srtp_sha1_core(M, H) computes the core compression function, where M is
+ *  the next part of the message (in network byte order) and H is the
+ *  intermediate state { H0, H1, ...} (in host byte order)
+ *
+ *  this function does not do any of the padding required in the
+ *  complete SHA1 function
+ *
+ *  this function is used in the SEAL 3.0 key setup routines
+ *  (crypto/cipher/seal.c)
+ */
+
+void srtp_sha1_core(const uint32_t M[16], uint32_t hash_value[5])
+{
+    srtp_sha1_blocks(hash_value, (const uint8_t *)M, 1);
 }
 
 void srtp_sha1_init(srtp_sha1_ctx_t *ctx)
@@ -240,44 +296,43 @@ void srtp_sha1_update(srtp_sha1_ctx_t *ctx,
                       const uint8_t *msg,
                       int octets_in_msg)
 {
-    int i;
     uint8_t *buf = (uint8_t *)ctx->M;
+    int n;
 
     /* update message bit-count */
     ctx->num_bits_in_msg += octets_in_msg * 8;
 
-    /* loop over 16-word blocks of M */
-    while (octets_in_msg > 0) {
-        if (octets_in_msg + ctx->octets_in_buffer >= 64) {
-            /*
-             * copy words of M into msg buffer until that buffer is full,
-             * converting them into host byte order as needed
-             */
-            octets_in_msg -= (64 - ctx->octets_in_buffer);
-            for (i = ctx->octets_in_buffer; i < 64; i++) {
-                buf[i] = *msg++;
-            }
-            ctx->octets_in_buffer = 0;
-
-            /* process a whole block */
-
-            debug_print(srtp_mod_sha1, "(update) running srtp_sha1_core()",
-                        NULL);
-
-            srtp_sha1_core(ctx->M, ctx->H);
-
-        } else {
+    /* complete a partially filled block first */
+    if (ctx->octets_in_buffer > 0) {
+        n = 64 - ctx->octets_in_buffer;
+        if (n > octets_in_msg) {
+            n = octets_in_msg;
+        }
+        memcpy(buf + ctx->octets_in_buffer, msg, n);
+        ctx->octets_in_buffer += n;
+        msg += n;
+        octets_in_msg -= n;
+        if (ctx->octets_in_buffer < 64) {
             debug_print(srtp_mod_sha1, "(update) not running srtp_sha1_core()",
                         NULL);
-
-            for (i = ctx->octets_in_buffer;
-                 i < (ctx->octets_in_buffer + octets_in_msg); i++) {
-                buf[i] = *msg++;
-            }
-            ctx->octets_in_buffer += octets_in_msg;
-            octets_in_msg = 0;
+            return;
         }
+        debug_print(srtp_mod_sha1, "(update) running srtp_sha1_core()", NULL);
+        srtp_sha1_blocks(ctx->H, buf, 1);
+        ctx->octets_in_buffer = 0;
+    }
+
+    /* whole blocks straight from the message, without a copy */
+    n = octets_in_msg / 64;
+    if (n > 0) {
+        debug_print(srtp_mod_sha1, "(update) running srtp_sha1_core()", NULL);
+        srtp_sha1_blocks(ctx->H, msg, n);
+        msg += 64 * n;
+        octets_in_msg -= 64 * n;
     }
+
+    memcpy(buf, msg, octets_in_msg);
+    ctx->octets_in_buffer = octets_in_msg;
 }
 
 /*
@@ -287,178 +342,30 @@ void srtp_sha1_update(srtp_sha1_ctx_t *ctx,
 
 void srtp_sha1_final(srtp_sha1_ctx_t *ctx, uint32_t *output)
 {
-    uint32_t A, B, C, D, E, TEMP;
-    uint32_t W[80];
-    int i, t;
+    uint8_t *buf = (uint8_t *)ctx->M;
+    int n = ctx->octets_in_buffer;
+
+    /* set the high bit of the octet immediately following the message */
+    buf[n++] = 0x80;
 
     /*
-     * process the remaining octets_in_buffer, padding and terminating as
-     * necessary
+     * if there is no room for the bit-length of the message at the end of
+     * the block, then zero it and run one more compression
      */
-    {
-        int tail = ctx->octets_in_buffer % 4;
-
-        /* copy/xor message into array */
-        for (i = 0; i < (ctx->octets_in_buffer + 3) / 4; i++) {
-            W[i] = be32_to_cpu(ctx->M[i]);
-        }
-
-        /* set the high bit of the octet immediately following the message */
-        switch (tail) {
-        case (3):
-            W[i - 1] = (be32_to_cpu(ctx->M[i - 1]) & 0xffffff00) | 0x80;
-            W[i] = 0x0;
-            break;
-        case (2):
-            W[i - 1] = (be32_to_cpu(ctx->M[i - 1]) & 0xffff0000) | 0x8000;
-            W[i] = 0x0;
-            break;
-        case (1):
-            W[i - 1] = (be32_to_cpu(ctx->M[i - 1]) & 0xff000000) | 0x800000;
-            W[i] = 0x0;
-            break;
-        case (0):
-            W[i] = 0x80000000;
-            break;
-        }
-
-        /* zeroize remaining words */
-        for (i++; i < 15; i++) {
-            W[i] = 0x0;
-        }
-
-        /*
-         * if there is room at the end of the word array, then set the
-         * last word to the bit-length of the message; otherwise, set that
-         * word to zero and then we need to do one more run of the
-         * compression algo.
-         */
-        if (ctx->octets_in_buffer < 56) {
-            W[15] = ctx->num_bits_in_msg;
-        } else if (ctx->octets_in_buffer < 60) {
-            W[15] = 0x0;
-        }
-
-        /* process the word array */
-        for (t = 16; t < 80; t++) {
-            TEMP = W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16];
-            W[t] = S1(TEMP);
-        }
-
-        A = ctx->H[0];
-        B = ctx->H[1];
-        C = ctx->H[2];
-        D = ctx->H[3];
-        E = ctx->H[4];
-
-        for (t = 0; t < 20; t++) {
-            TEMP = S5(A) + f0(B, C, D) + E + W[t] + SHA_K0;
-            E = D;
-            D = C;
-            C = S30(B);
-            B = A;
-            A = TEMP;
-        }
-        for (; t < 40; t++) {
-            TEMP = S5(A) + f1(B, C, D) + E + W[t] + SHA_K1;
-            E = D;
-            D = C;
-            C = S30(B);
-            B = A;
-            A = TEMP;
-        }
-        for (; t < 60; t++) {
-            TEMP = S5(A) + f2(B, C, D) + E + W[t] + SHA_K2;
-            E = D;
-            D = C;
-            C = S30(B);
-            B = A;
-            A = TEMP;
-        }
-        for (; t < 80; t++) {
-            TEMP = S5(A) + f3(B, C, D) + E + W[t] + SHA_K3;
-            E = D;
-            D = C;
-            C = S30(B);
-            B = A;
-            A = TEMP;
-        }
-
-        ctx->H[0] += A;
-        ctx->H[1] += B;
-        ctx->H[2] += C;
-        ctx->H[3] += D;
-        ctx->H[4] += E;
-    }
-
-    debug_print(srtp_mod_sha1, "(final) running srtp_sha1_core()", NULL);
-
-    if (ctx->octets_in_buffer >= 56) {
+    if (n > 56) {
         debug_print(srtp_mod_sha1, "(final) running srtp_sha1_core() again",
                     NULL);
+        memset(buf + n, 0, 64 - n);
+        srtp_sha1_blocks(ctx->H, buf, 1);
+        n = 0;
+    }
+    memset(buf + n, 0, 56 - n);
+    ctx->M[14] = 0;
+    ctx->M[15] = be32_to_cpu(ctx->num_bits_in_msg);
 
-        /* we need to do one final run of the compression algo */
-
-        /*
-         * set initial part of word array to zeros, and set the
-         * final part to the number of bits in the message
-         */
-        for (i = 0; i < 15; i++) {
-            W[i] = 0x0;
-        }
-        W[15] = ctx->num_bits_in_msg;
-
-        /* process the word array */
-        for (t = 16; t < 80; t++) {
-            TEMP = W[t - 3] ^ W[t - 8] ^ W[t - 14] ^ W[t - 16];
-            W[t] = S1(TEMP);
-        }
-
-        A = ctx->H[0];
-        B = ctx->H[1];
-        C = ctx->H[2];
-        D = ctx->H[3];
-        E = ctx->H[4];
-
-        for (t = 0; t < 20; t++) {
-            TEMP = S5(A) + f0(B, C, D) + E + W[t] + SHA_K0;
-            E = D;
-            D = C;
-            C = S30(B);
-            B = A;
-            A = TEMP;
-        }
-        for (; t < 40; t++) {
-            TEMP = S5(A) + f1(B, C, D) + E + W[t] + SHA_K1;
-            E = D;
-            D = C;
-            C = S30(B);
-            B = A;
-            A = TEMP;
-        }
-        for (; t < 60; t++) {
-            TEMP = S5(A) + f2(B, C, D) + E + W[t] + SHA_K2;
-            E = D;
-            D = C;
-            C = S30(B);
-            B = A;
-            A = TEMP;
-        }
-        for (; t < 80; t++) {
-            TEMP = S5(A) + f3(B, C, D) + E + W[t] + SHA_K3;
-            E = D;
-            D = C;
-            C = S30(B);
-            B = A;
-            A = TEMP;
-        }
+    debug_print(srtp_mod_sha1, "(final) running srtp_sha1_core()", NULL);
 
-        ctx->H[0] += A;
-        ctx->H[1] += B;
-        ctx->H[2] += C;
-        ctx->H[3] += D;
-        ctx->H[4] += E;
-    }
+    srtp_sha1_blocks(ctx->H, buf, 1);
 
     /* copy result into output buffer */
     output[0] = be32_to_cpu(ctx->H[0]);
@@ -0,0 +1,249 @@
+/*
+ * sha1_hw.c
+ *
+ * the SHA-1 compression function with the SHA extensions of x86 or the
+ * SHA1 instructions of ARMv8
+ *
+ * like aes_hw.c the instructions are enabled per function and only run
+ * after srtp_sha1_hw_available() found them at run time, and the ARMv8
+ * code is only built with ENABLE_ARMV8_CRYPTO
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "sha1_hw.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SRTP_SHA1_HW_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(ENABLE_ARMV8_CRYPTO) && defined(__GNUC__) &&                     \
+    defined(__aarch64__) && defined(__linux__)
+#define SRTP_SHA1_HW_ARMV8 1
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#ifdef SRTP_SHA1_HW_X86
+
+static int srtp_sha1_hw_probe(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) {
+        return 0;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ebx & bit_SHA) != 0;
+}
+
+const char *srtp_sha1_hw_name(void)
+{
+    return "SHA-NI";
+}
+
+/*
+ * one group is four rounds, SHA1RNDS4 does them and SHA1NEXTE derives
+ * the E of the next group from A, the schedule of W[4g+4..4g+7] is
+ * spread over the three groups before it with SHA1MSG1, a xor and
+ * SHA1MSG2, the same order as Intel's reference code
+ */
+#define SRTP_SHA1_NI_GROUP(g)                                                  \
+    do {                                                                       \
+        if ((g) == 0) {                                                        \
+            e[0] = _mm_add_epi32(e[0], m[0]);                                  \
+        } else {                                                               \
+            e[(g)&1] = _mm_sha1nexte_epu32(e[(g)&1], m[(g)&3]);                \
+        }                                                                      \
+        e[((g) + 1) & 1] = abcd;                                               \
+        abcd = _mm_sha1rnds4_epu32(abcd, e[(g)&1], (g) / 5);                   \
+        if ((g) >= 1 && (g) <= 16) {                                           \
+            m[((g) + 3) & 3] = _mm_sha1msg1_epu32(m[((g) + 3) & 3], m[(g)&3]); \
+        }                                                                      \
+        if ((g) >= 2 && (g) <= 17) {                                           \
+            m[((g) + 2) & 3] = _mm_xor_si128(m[((g) + 2) & 3], m[(g)&3]);      \
+        }                                                                      \
+        if ((g) >= 3 && (g) <= 18) {                                           \
+            m[((g) + 1) & 3] = _mm_sha1msg2_epu32(m[((g) + 1) & 3], m[(g)&3]); \
+        }                                                                      \
+    } while (0)
+
+#define SRTP_SHA1_NI_LOAD(g)                                                   \
+    m[g] = _mm_shuffle_epi8(                                                   \
+        _mm_loadu_si128((const __m128i *)(msg + 16 * (g))), bswap)
+
+__attribute__((target("sha,ssse3,sse4.1"))) void srtp_sha1_hw_blocks(
+    uint32_t hash_value[5],
+    const uint8_t *msg,
+    int num_blocks)
+{
+    const __m128i bswap =
+        _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcd_save, e_save, e[2], m[4];
+
+    /* A in the high lane, E in the high lane of its own register */
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)hash_value),
+                             0x1b);
+    e[0] = _mm_set_epi32((int)hash_value[4], 0, 0, 0);
+
+    for (; num_blocks > 0; num_blocks--, msg += 64) {
+        abcd_save = abcd;
+        e_save = e[0];
+
+        SRTP_SHA1_NI_LOAD(0);
+        SRTP_SHA1_NI_GROUP(0);
+        SRTP_SHA1_NI_LOAD(1);
+        SRTP_SHA1_NI_GROUP(1);
+        SRTP_SHA1_NI_LOAD(2);
+        SRTP_SHA1_NI_GROUP(2);
+        SRTP_SHA1_NI_LOAD(3);
+        SRTP_SHA1_NI_GROUP(3);
+        SRTP_SHA1_NI_GROUP(4);
+        SRTP_SHA1_NI_GROUP(5);
+        SRTP_SHA1_NI_GROUP(6);
+        SRTP_SHA1_NI_GROUP(7);
+        SRTP_SHA1_NI_GROUP(8);
+        SRTP_SHA1_NI_GROUP(9);
+        SRTP_SHA1_NI_GROUP(10);
+        SRTP_SHA1_NI_GROUP(11);
+        SRTP_SHA1_NI_GROUP(12);
+        SRTP_SHA1_NI_GROUP(13);
+        SRTP_SHA1_NI_GROUP(14);
+        SRTP_SHA1_NI_GROUP(15);
+        SRTP_SHA1_NI_GROUP(16);
+        SRTP_SHA1_NI_GROUP(17);
+        SRTP_SHA1_NI_GROUP(18);
+        SRTP_SHA1_NI_GROUP(19);
+
+        /* e[0] holds the A of before the last group */
+        e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)hash_value, _mm_shuffle_epi32(abcd, 0x1b));
+    hash_value[4] = (uint32_t)_mm_extract_epi32(e[0], 3);
+}
+
+#elif defined(SRTP_SHA1_HW_ARMV8)
+
+static int srtp_sha1_hw_probe(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+}
+
+const char *srtp_sha1_hw_name(void)
+{
+    return "ARMv8 SHA1";
+}
+
+/*
+ * SHA1C, SHA1P and SHA1M do four rounds with the choose, parity and
+ * majority functions, SHA1H is the rotated A that becomes E four rounds
+ * later, SHA1SU0 and SHA1SU1 compute the next four schedule words
+ */
+#define SRTP_SHA1_CE_GROUP(g, op)                                              \
+    do {                                                                       \
+        uint32x4_t wk_ = vaddq_u32(m[(g)&3], vdupq_n_u32(k[(g) / 5]));        \
+        uint32_t e_ = vsha1h_u32(vgetq_lane_u32(abcd, 0));                     \
+        abcd = op(abcd, e, wk_);                                               \
+        e = e_;                                                                \
+        if ((g) < 16) {                                                        \
+            m[(g)&3] = vsha1su1q_u32(                                          \
+                vsha1su0q_u32(m[(g)&3], m[((g) + 1) & 3], m[((g) + 2) & 3]),   \
+                m[((g) + 3) & 3]);                                             \
+        }                                                                      \
+    } while (0)
+
+#ifdef __clang__
+__attribute__((target("sha2")))
+#else
+__attribute__((target("+crypto")))
+#endif
+void srtp_sha1_hw_blocks(uint32_t hash_value[5],
+                         const uint8_t *msg,
+                         int num_blocks)
+{
+    static const uint32_t k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC,
+                                   0xCA62C1D6 };
+    uint32x4_t abcd, abcd_save, m[4];
+    uint32_t e, e_save;
+    int i;
+
+    abcd = vld1q_u32(hash_value);
+    e = hash_value[4];
+
+    for (; num_blocks > 0; num_blocks--, msg += 64) {
+        abcd_save = abcd;
+        e_save = e;
+
+        for (i = 0; i < 4; i++) {
+            m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(msg + 16 * i)));
+        }
+
+        SRTP_SHA1_CE_GROUP(0, vsha1cq_u32);
+        SRTP_SHA1_CE_GROUP(1, vsha1cq_u32);
+        SRTP_SHA1_CE_GROUP(2, vsha1cq_u32);
+        SRTP_SHA1_CE_GROUP(3, vsha1cq_u32);
+        SRTP_SHA1_CE_GROUP(4, vsha1cq_u32);
+        SRTP_SHA1_CE_GROUP(5, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(6, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(7, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(8, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(9, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(10, vsha1mq_u32);
+        SRTP_SHA1_CE_GROUP(11, vsha1mq_u32);
+        SRTP_SHA1_CE_GROUP(12, vsha1mq_u32);
+        SRTP_SHA1_CE_GROUP(13, vsha1mq_u32);
+        SRTP_SHA1_CE_GROUP(14, vsha1mq_u32);
+        SRTP_SHA1_CE_GROUP(15, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(16, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(17, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(18, vsha1pq_u32);
+        SRTP_SHA1_CE_GROUP(19, vsha1pq_u32);
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        e += e_save;
+    }
+
+    vst1q_u32(hash_value, abcd);
+    hash_value[4] = e;
+}
+
+#else
+
+static int srtp_sha1_hw_probe(void)
+{
+    return 0;
+}
+
+const char *srtp_sha1_hw_name(void)
+{
+    return "none";
+}
+
+void srtp_sha1_hw_blocks(uint32_t hash_value[5],
+                         const uint8_t *msg,
+                         int num_blocks)
+{
+    srtp_sha1_blocks(hash_value, msg, num_blocks);
+}
+
+#endif
+
+int srtp_sha1_hw_available(void)
+{
+    static int available = -1;
+
+    if (available < 0) {
+        available = srtp_sha1_hw_probe();
+    }
+    return available;
+}
@@ -0,0 +1,106 @@
+/*
+ * sha1_vector.c
+ *
+ * the vector message schedule of SHA-1, apart from sha1.c so that
+ * on 32-bit ARM this file alone is built with -mfpu=neon, nothing in it
+ * runs unless srtp_sha1_vector_available() found NEON at run time
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "sha1.h"
+
+#include <string.h>
+
+/* S1 == Rotate left 1 bit */
+#define S1(X) ((X << 1) | (X >> 31))
+
+#if defined(__GNUC__) && (defined(__ARM_NEON) || defined(__SSE2__))
+
+typedef uint32_t srtp_sha1_vec_t __attribute__((vector_size(16)));
+
+static inline srtp_sha1_vec_t srtp_sha1_vec_load(const uint32_t *w)
+{
+    srtp_sha1_vec_t v;
+
+    memcpy(&v, w, sizeof(v));
+    return v;
+}
+
+static inline void srtp_sha1_vec_store(uint32_t *w, srtp_sha1_vec_t v)
+{
+    memcpy(w, &v, sizeof(v));
+}
+
+int srtp_sha1_vector_built(void)
+{
+    return 1;
+}
+
+/*
+ * the message schedule four words at a time in NEON (or SSE2) registers
+ * while the rounds stay scalar, the approach of Intel's "Improving the
+ * performance of the Secure Hash Algorithm (SHA-1)" (Locktyukhin, 2010):
+ *
+ * W[t+3] needs W[t] of the same vector, it is computed with 0 there and
+ * fixed up, from t = 32 on W[t] = S2(W[t-6] ^ W[t-16] ^ W[t-28] ^ W[t-32])
+ * has no such dependency
+ */
+void srtp_sha1_vector_blocks(uint32_t hash_value[5],
+                             const uint8_t *msg,
+                             int num_blocks)
+{
+    static const uint32_t K[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC,
+                                   0xCA62C1D6 };
+    const uint32_t zero[4] = { 0, 0, 0, 0 };
+    uint32_t W[80], WK[80];
+    srtp_sha1_vec_t x, k;
+    int t;
+
+    for (; num_blocks > 0; num_blocks--, msg += 64) {
+        memcpy(W, msg, 64);
+        for (t = 0; t < 16; t++) {
+            W[t] = be32_to_cpu(W[t]);
+        }
+
+        for (t = 16; t < 32; t += 4) {
+            x = srtp_sha1_vec_load(&W[t - 16]) ^ srtp_sha1_vec_load(&W[t - 14]) ^
+                srtp_sha1_vec_load(&W[t - 8]);
+            x ^= (srtp_sha1_vec_t){ W[t - 3], W[t - 2], W[t - 1], 0 };
+            x = (x << 1) | (x >> 31);
+            x[3] ^= S1(x[0]);
+            srtp_sha1_vec_store(&W[t], x);
+        }
+        for (; t < 80; t += 4) {
+            x = srtp_sha1_vec_load(&W[t - 6]) ^ srtp_sha1_vec_load(&W[t - 16]) ^
+                srtp_sha1_vec_load(&W[t - 28]) ^ srtp_sha1_vec_load(&W[t - 32]);
+            x = (x << 2) | (x >> 30);
+            srtp_sha1_vec_store(&W[t], x);
+        }
+
+        for (t = 0; t < 80; t += 4) {
+            k = (srtp_sha1_vec_t){ 0, 0, 0, 0 } + K[t / 20];
+            srtp_sha1_vec_store(&WK[t], srtp_sha1_vec_load(&W[t]) + k);
+        }
+
+        srtp_sha1_rounds(WK, zero, hash_value);
+    }
+}
+
+#else
+
+int srtp_sha1_vector_built(void)
+{
+    return 0;
+}
+
+void srtp_sha1_vector_blocks(uint32_t hash_value[5],
+                             const uint8_t *msg,
+                             int num_blocks)
+{
+    srtp_sha1_scalar_blocks(hash_value, msg, num_blocks);
+}
+
+#endif
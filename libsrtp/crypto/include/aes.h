@@ -73,6 +73,14 @@ srtp_err_status_t srtp_aes_expand_decryption_key(
 void srtp_aes_encrypt(v128_t *plaintext,
                       const srtp_aes_expanded_key_t *exp_key);
 
+/*
+ * srtp_aes_encrypt_blocks() encrypts num_blocks blocks in place, faster
+ * than one srtp_aes_encrypt() after the other
+ */
+void srtp_aes_encrypt_blocks(v128_t *blocks,
+                             int num_blocks,
+                             const srtp_aes_expanded_key_t *exp_key);
+
 void srtp_aes_decrypt(v128_t *plaintext,
                       const srtp_aes_expanded_key_t *exp_key);
 
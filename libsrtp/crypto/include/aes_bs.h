@@ -0,0 +1,67 @@
+/*
+ * aes_bs.h
+ *
+ * bitsliced constant time AES for CPUs without AES instructions
+ *
+ * the S-box is a boolean circuit instead of a table, nothing depends on
+ * secret data for its address or its running time
+ */
+
+#ifndef AES_BS_H
+#define AES_BS_H
+
+#include "aes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * srtp_aes_bs_expand_encryption_key() writes the round keys in the
+ * bitsliced layout srtp_aes_bs_encrypt_blocks() uses, they can't be used
+ * with srtp_aes_encrypt()
+ */
+srtp_err_status_t srtp_aes_bs_expand_encryption_key(
+    const uint8_t *key,
+    int key_len,
+    srtp_aes_expanded_key_t *expanded_key);
+
+/*
+ * srtp_aes_bs_encrypt_blocks() encrypts num_blocks blocks in place, with
+ * srtp_aes_bs_vector_blocks() if srtp_aes_bs_vector_available() is 1 and
+ * srtp_aes_bs_scalar_blocks() otherwise, the cost is that of a multiple of
+ * eight or four blocks
+ */
+void srtp_aes_bs_encrypt_blocks(v128_t *blocks,
+                                int num_blocks,
+                                const srtp_aes_expanded_key_t *exp_key);
+
+void srtp_aes_bs_scalar_blocks(v128_t *blocks,
+                               int num_blocks,
+                               const srtp_aes_expanded_key_t *exp_key);
+
+/*
+ * srtp_aes_bs_vector_blocks() is srtp_aes_bs_scalar_blocks() unless
+ * srtp_aes_bs_vector_built() is 1, it must only be called when
+ * srtp_aes_bs_vector_available() is 1, i.e. the CPU can run it too, NEON
+ * is checked at run time on 32-bit ARM
+ */
+void srtp_aes_bs_vector_blocks(v128_t *blocks,
+                               int num_blocks,
+                               const srtp_aes_expanded_key_t *exp_key);
+
+int srtp_aes_bs_vector_built(void);
+
+int srtp_aes_bs_vector_available(void);
+
+/*
+ * srtp_aes_bs_name() tells how the bits are sliced on this CPU, e.g.
+ * "64 bit" or "128 bit vector"
+ */
+const char *srtp_aes_bs_name(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AES_BS_H */
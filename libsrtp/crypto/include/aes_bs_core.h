@@ -0,0 +1,407 @@
+/*
+ * aes_bs_core.h
+ *
+ * the bitsliced AES rounds of aes_bs.c, included by aes_bs.c with 64-bit
+ * words and by aes_bs_vector.c with 128-bit vector words, each defines
+ * srtp_aes_bs_word_t and SRTP_AES_BS_LANES (64-bit lanes in a word) first
+ *
+ * only for those two files, everything in here is static
+ */
+
+#ifndef AES_BS_CORE_H
+#define AES_BS_CORE_H
+
+#include "aes_bs.h"
+
+/* blocks per pass */
+#define SRTP_AES_BS_BLOCKS (4 * SRTP_AES_BS_LANES)
+
+#define SRTP_AES_BS_SWAPN(cl, ch, s, x, y)                                     \
+    do {                                                                       \
+        srtp_aes_bs_word_t a_, b_;                                             \
+        a_ = (x);                                                              \
+        b_ = (y);                                                              \
+        (x) = (a_ & (uint64_t)(cl)) | ((b_ & (uint64_t)(cl)) << (s));          \
+        (y) = ((a_ & (uint64_t)(ch)) >> (s)) | (b_ & (uint64_t)(ch));          \
+    } while (0)
+
+#define SRTP_AES_BS_SWAP2(x, y)                                                \
+    SRTP_AES_BS_SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define SRTP_AES_BS_SWAP4(x, y)                                                \
+    SRTP_AES_BS_SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define SRTP_AES_BS_SWAP8(x, y)                                                \
+    SRTP_AES_BS_SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+/*
+ * transposes between the interleaved bytes and the bit planes, its own
+ * inverse
+ */
+static inline void srtp_aes_bs_ortho(srtp_aes_bs_word_t *q)
+{
+    SRTP_AES_BS_SWAP2(q[0], q[1]);
+    SRTP_AES_BS_SWAP2(q[2], q[3]);
+    SRTP_AES_BS_SWAP2(q[4], q[5]);
+    SRTP_AES_BS_SWAP2(q[6], q[7]);
+
+    SRTP_AES_BS_SWAP4(q[0], q[2]);
+    SRTP_AES_BS_SWAP4(q[1], q[3]);
+    SRTP_AES_BS_SWAP4(q[4], q[6]);
+    SRTP_AES_BS_SWAP4(q[5], q[7]);
+
+    SRTP_AES_BS_SWAP8(q[0], q[4]);
+    SRTP_AES_BS_SWAP8(q[1], q[5]);
+    SRTP_AES_BS_SWAP8(q[2], q[6]);
+    SRTP_AES_BS_SWAP8(q[3], q[7]);
+}
+
+/*
+ * the S-box applied to all 16 bytes of every block at once, the x and s
+ * variables are numbered from the high bit down
+ */
+static inline void srtp_aes_bs_sbox(srtp_aes_bs_word_t *q)
+{
+    srtp_aes_bs_word_t x0, x1, x2, x3, x4, x5, x6, x7;
+    srtp_aes_bs_word_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+    srtp_aes_bs_word_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+    srtp_aes_bs_word_t y20, y21;
+    srtp_aes_bs_word_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+    srtp_aes_bs_word_t z10, z11, z12, z13, z14, z15, z16, z17;
+    srtp_aes_bs_word_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    srtp_aes_bs_word_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    srtp_aes_bs_word_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+    srtp_aes_bs_word_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    srtp_aes_bs_word_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+    srtp_aes_bs_word_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    srtp_aes_bs_word_t t60, t61, t62, t63, t64, t65, t66, t67;
+    srtp_aes_bs_word_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+    x0 = q[7];
+    x1 = q[6];
+    x2 = q[5];
+    x3 = q[4];
+    x4 = q[3];
+    x5 = q[2];
+    x6 = q[1];
+    x7 = q[0];
+
+    /* top linear transformation */
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    /* non-linear section */
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    /* bottom linear transformation */
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    s0 = t59 ^ t63;
+    s6 = t56 ^ ~t62;
+    s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    s3 = t53 ^ t66;
+    s4 = t51 ^ t66;
+    s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;
+    s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+static inline void srtp_aes_bs_shift_rows(srtp_aes_bs_word_t *q)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        srtp_aes_bs_word_t x = q[i];
+
+        q[i] = (x & (uint64_t)0x000000000000FFFFULL) |
+               ((x & (uint64_t)0x00000000FFF00000ULL) >> 4) |
+               ((x & (uint64_t)0x00000000000F0000ULL) << 12) |
+               ((x & (uint64_t)0x0000FF0000000000ULL) >> 8) |
+               ((x & (uint64_t)0x000000FF00000000ULL) << 8) |
+               ((x & (uint64_t)0xF000000000000000ULL) >> 12) |
+               ((x & (uint64_t)0x0FFF000000000000ULL) << 4);
+    }
+}
+
+static inline srtp_aes_bs_word_t srtp_aes_bs_rotr32(srtp_aes_bs_word_t x)
+{
+    return (x << 32) | (x >> 32);
+}
+
+static inline void srtp_aes_bs_mix_columns(srtp_aes_bs_word_t *q)
+{
+    srtp_aes_bs_word_t q0, q1, q2, q3, q4, q5, q6, q7;
+    srtp_aes_bs_word_t r0, r1, r2, r3, r4, r5, r6, r7;
+
+    q0 = q[0];
+    q1 = q[1];
+    q2 = q[2];
+    q3 = q[3];
+    q4 = q[4];
+    q5 = q[5];
+    q6 = q[6];
+    q7 = q[7];
+    r0 = (q0 >> 16) | (q0 << 48);
+    r1 = (q1 >> 16) | (q1 << 48);
+    r2 = (q2 >> 16) | (q2 << 48);
+    r3 = (q3 >> 16) | (q3 << 48);
+    r4 = (q4 >> 16) | (q4 << 48);
+    r5 = (q5 >> 16) | (q5 << 48);
+    r6 = (q6 >> 16) | (q6 << 48);
+    r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q7 ^ r7 ^ r0 ^ srtp_aes_bs_rotr32(q0 ^ r0);
+    q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ srtp_aes_bs_rotr32(q1 ^ r1);
+    q[2] = q1 ^ r1 ^ r2 ^ srtp_aes_bs_rotr32(q2 ^ r2);
+    q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ srtp_aes_bs_rotr32(q3 ^ r3);
+    q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ srtp_aes_bs_rotr32(q4 ^ r4);
+    q[5] = q4 ^ r4 ^ r5 ^ srtp_aes_bs_rotr32(q5 ^ r5);
+    q[6] = q5 ^ r5 ^ r6 ^ srtp_aes_bs_rotr32(q6 ^ r6);
+    q[7] = q6 ^ r6 ^ r7 ^ srtp_aes_bs_rotr32(q7 ^ r7);
+}
+
+static inline void srtp_aes_bs_add_round_key(srtp_aes_bs_word_t *q,
+                                             const uint64_t *sk)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        q[i] ^= sk[i];
+    }
+}
+
+/*
+ * spreads the 16 bytes of a block, as four little endian words, over two
+ * 64-bit words, q0 gets the even and q1 the odd bytes of each column
+ */
+static void srtp_aes_bs_interleave_in(uint64_t *q0,
+                                      uint64_t *q1,
+                                      const uint8_t *b)
+{
+    uint64_t x[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        x[i] = (uint64_t)b[4 * i] | ((uint64_t)b[4 * i + 1] << 8) |
+               ((uint64_t)b[4 * i + 2] << 16) | ((uint64_t)b[4 * i + 3] << 24);
+        x[i] |= (x[i] << 16);
+        x[i] &= 0x0000FFFF0000FFFFULL;
+        x[i] |= (x[i] << 8);
+        x[i] &= 0x00FF00FF00FF00FFULL;
+    }
+    *q0 = x[0] | (x[2] << 8);
+    *q1 = x[1] | (x[3] << 8);
+}
+
+static void srtp_aes_bs_interleave_out(uint8_t *b, uint64_t q0, uint64_t q1)
+{
+    uint64_t x[4];
+    int i;
+
+    x[0] = q0 & 0x00FF00FF00FF00FFULL;
+    x[1] = q1 & 0x00FF00FF00FF00FFULL;
+    x[2] = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+    x[3] = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+    for (i = 0; i < 4; i++) {
+        uint32_t w;
+
+        x[i] |= (x[i] >> 8);
+        x[i] &= 0x0000FFFF0000FFFFULL;
+        w = (uint32_t)x[i] | (uint32_t)(x[i] >> 16);
+        b[4 * i] = (uint8_t)w;
+        b[4 * i + 1] = (uint8_t)(w >> 8);
+        b[4 * i + 2] = (uint8_t)(w >> 16);
+        b[4 * i + 3] = (uint8_t)(w >> 24);
+    }
+}
+
+
+/*
+ * the compressed round keys back to 8 words per round
+ */
+static void srtp_aes_bs_skey_expand(uint64_t *skey,
+                                    const srtp_aes_expanded_key_t *exp_key)
+{
+    int i, j;
+
+    for (i = 0; i <= exp_key->num_rounds; i++) {
+        for (j = 0; j < 2; j++) {
+            uint64_t x = exp_key->round[i].v64[j];
+            uint64_t x0 = x & 0x1111111111111111ULL;
+            uint64_t x1 = (x & 0x2222222222222222ULL) >> 1;
+            uint64_t x2 = (x & 0x4444444444444444ULL) >> 2;
+            uint64_t x3 = (x & 0x8888888888888888ULL) >> 3;
+            uint64_t *sk = skey + 8 * i + 4 * j;
+
+            sk[0] = (x0 << 4) - x0;
+            sk[1] = (x1 << 4) - x1;
+            sk[2] = (x2 << 4) - x2;
+            sk[3] = (x3 << 4) - x3;
+        }
+    }
+}
+
+/*
+ * encrypts num_blocks blocks in place, SRTP_AES_BS_BLOCKS at a time
+ */
+static void srtp_aes_bs_encrypt_passes(v128_t *blocks,
+                                       int num_blocks,
+                                       const srtp_aes_expanded_key_t *exp_key)
+{
+    uint64_t skey[8 * 15];
+    srtp_aes_bs_word_t q[8];
+    uint64_t lanes[8][SRTP_AES_BS_LANES];
+    int i, n, r;
+
+    srtp_aes_bs_skey_expand(skey, exp_key);
+
+    for (; num_blocks > 0;
+         num_blocks -= SRTP_AES_BS_BLOCKS, blocks += SRTP_AES_BS_BLOCKS) {
+        n = num_blocks < SRTP_AES_BS_BLOCKS ? num_blocks : SRTP_AES_BS_BLOCKS;
+
+        /* lane l holds blocks 4l..4l+3, missing ones are zero */
+        memset(lanes, 0, sizeof(lanes));
+        for (i = 0; i < n; i++) {
+            srtp_aes_bs_interleave_in(&lanes[i & 3][i >> 2],
+                                      &lanes[(i & 3) + 4][i >> 2],
+                                      blocks[i].v8);
+        }
+        for (i = 0; i < 8; i++) {
+            memcpy(&q[i], lanes[i], sizeof(q[i]));
+        }
+        srtp_aes_bs_ortho(q);
+
+        srtp_aes_bs_add_round_key(q, skey);
+        for (r = 1; r < exp_key->num_rounds; r++) {
+            srtp_aes_bs_sbox(q);
+            srtp_aes_bs_shift_rows(q);
+            srtp_aes_bs_mix_columns(q);
+            srtp_aes_bs_add_round_key(q, skey + 8 * r);
+        }
+        srtp_aes_bs_sbox(q);
+        srtp_aes_bs_shift_rows(q);
+        srtp_aes_bs_add_round_key(q, skey + 8 * r);
+
+        srtp_aes_bs_ortho(q);
+        for (i = 0; i < 8; i++) {
+            memcpy(lanes[i], &q[i], sizeof(q[i]));
+        }
+        for (i = 0; i < n; i++) {
+            srtp_aes_bs_interleave_out(blocks[i].v8, lanes[i & 3][i >> 2],
+                                       lanes[(i & 3) + 4][i >> 2]);
+        }
+    }
+}
+
+#endif /* AES_BS_CORE_H */
@@ -0,0 +1,51 @@
+/*
+ * aes_hw.h
+ *
+ * AES block encryption with the instructions of the CPU, AES-NI on x86
+ * and the ARMv8 Crypto Extensions on aarch64
+ *
+ * the round keys are the ones srtp_aes_expand_encryption_key() computes,
+ * so a context expanded for the table implementation works with both
+ */
+
+#ifndef AES_HW_H
+#define AES_HW_H
+
+#include "aes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * srtp_aes_hw_available() returns 1 if this CPU has the AES instructions
+ * srtp_aes_hw_encrypt() needs, 0 otherwise, the result is probed once
+ */
+int srtp_aes_hw_available(void);
+
+/*
+ * srtp_aes_hw_name() is the printable name of the instructions, e.g.
+ * "AES-NI"
+ */
+const char *srtp_aes_hw_name(void);
+
+/*
+ * srtp_aes_hw_encrypt() is srtp_aes_encrypt() in hardware, it must only
+ * be called when srtp_aes_hw_available() is 1
+ */
+void srtp_aes_hw_encrypt(v128_t *plaintext,
+                         const srtp_aes_expanded_key_t *exp_key);
+
+/*
+ * srtp_aes_hw_encrypt_blocks() is srtp_aes_encrypt_blocks() in hardware,
+ * with the same restriction
+ */
+void srtp_aes_hw_encrypt_blocks(v128_t *blocks,
+                                int num_blocks,
+                                const srtp_aes_expanded_key_t *exp_key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AES_HW_H */
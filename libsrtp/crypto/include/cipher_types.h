@@ -47,6 +47,12 @@
 extern const srtp_cipher_type_t srtp_null_cipher;
 extern const srtp_cipher_type_t srtp_aes_icm_128;
 extern const srtp_cipher_type_t srtp_aes_icm_256;
+#ifndef OPENSSL
+extern const srtp_cipher_type_t srtp_aes_icm_128_hw;
+extern const srtp_cipher_type_t srtp_aes_icm_256_hw;
+extern const srtp_cipher_type_t srtp_aes_icm_128_bs;
+extern const srtp_cipher_type_t srtp_aes_icm_256_bs;
+#endif
 #ifdef GCM
 extern const srtp_cipher_type_t srtp_aes_icm_192;
 extern const srtp_cipher_type_t srtp_aes_gcm_128;
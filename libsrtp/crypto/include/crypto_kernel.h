@@ -181,6 +181,13 @@ srtp_err_status_t srtp_crypto_kernel_alloc_cipher(srtp_cipher_type_id_t id,
                                                   int key_len,
                                                   int tag_len);
 
+/*
+ * srtp_crypto_kernel_get_cipher_type(id) returns the cipher type loaded
+ * for identifier 'id', or NULL if there is none
+ */
+const srtp_cipher_type_t *srtp_crypto_kernel_get_cipher_type(
+    srtp_cipher_type_id_t id);
+
 /*
  * srtp_crypto_kernel_alloc_auth(id, ap, key_len, tag_len);
  *
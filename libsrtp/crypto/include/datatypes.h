@@ -249,6 +249,12 @@ void v128_set_bit_to(v128_t *x, int i, int y);
 
 int srtp_octet_string_is_eq(uint8_t *a, uint8_t *b, int len);
 
+/*
+ * srtp_octet_string_xor(a, b, len) sets a to a xor b, a word at a time
+ * where the alignment allows it
+ */
+void srtp_octet_string_xor(uint8_t *a, const uint8_t *b, size_t len);
+
 /*
  * A portable way to zero out memory as recommended by
  * https://cryptocoding.net/index.php/Coding_rules#Clean_memory_of_secret_data
@@ -50,7 +50,7 @@
 #include "sha1.h"
 
 typedef struct {
-    uint8_t opad[64];
+    srtp_sha1_ctx_t opad_ctx; /* state after hashing opad ^ key */
     srtp_sha1_ctx_t ctx;
     srtp_sha1_ctx_t init_ctx;
 } srtp_hmac_ctx_t;
@@ -175,6 +175,59 @@ void srtp_sha1_final(srtp_sha1_ctx_t *ctx, uint32_t output[5]);
  */
 void srtp_sha1_core(const uint32_t M[16], uint32_t hash_value[5]);
 
+/*
+ * srtp_sha1_blocks(H, msg, num_blocks) runs the compression function over
+ * num_blocks 64 octet blocks at msg, with the implementation chosen for
+ * this CPU: the SHA instructions (sha1_hw.h) if it has them, otherwise
+ * the vector message schedule if it has NEON or SSE2, otherwise the
+ * scalar code
+ */
+typedef void (*srtp_sha1_blocks_func_t)(uint32_t hash_value[5],
+                                        const uint8_t *msg,
+                                        int num_blocks);
+
+void srtp_sha1_blocks(uint32_t hash_value[5],
+                      const uint8_t *msg,
+                      int num_blocks);
+
+void srtp_sha1_scalar_blocks(uint32_t hash_value[5],
+                             const uint8_t *msg,
+                             int num_blocks);
+
+/*
+ * srtp_sha1_vector_blocks() is the scalar code unless
+ * srtp_sha1_vector_built() is 1, it must only be called when
+ * srtp_sha1_vector_available() is 1, i.e. the CPU can run it too, NEON is
+ * checked at run time on 32-bit ARM
+ */
+void srtp_sha1_vector_blocks(uint32_t hash_value[5],
+                             const uint8_t *msg,
+                             int num_blocks);
+
+int srtp_sha1_vector_built(void);
+
+int srtp_sha1_vector_available(void);
+
+/*
+ * srtp_sha1_rounds(W, K, H) runs the 80 rounds of one block over its
+ * schedule W, the constant of round t is W[t] + K[t / 20]
+ */
+void srtp_sha1_rounds(const uint32_t W[80],
+                      const uint32_t K[4],
+                      uint32_t hash_value[5]);
+
+/*
+ * srtp_sha1_set_blocks_func(func, name) makes srtp_sha1_blocks() use func
+ * if it agrees with the scalar code, srtp_err_status_algo_fail otherwise,
+ * it must not run while anything hashes
+ *
+ * srtp_sha1_get_blocks_name() is the printable name of the one in use
+ */
+srtp_err_status_t srtp_sha1_set_blocks_func(srtp_sha1_blocks_func_t func,
+                                            const char *name);
+
+const char *srtp_sha1_get_blocks_name(void);
+
 #endif /* else OPENSSL */
 
 #ifdef __cplusplus
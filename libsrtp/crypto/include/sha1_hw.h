@@ -0,0 +1,43 @@
+/*
+ * sha1_hw.h
+ *
+ * the SHA-1 compression function with the instructions of the CPU, the
+ * SHA extensions on x86 and the ARMv8 SHA1 instructions on aarch64
+ */
+
+#ifndef SHA1_HW_H
+#define SHA1_HW_H
+
+#include "sha1.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * srtp_sha1_hw_available() returns 1 if this CPU has the SHA-1
+ * instructions srtp_sha1_hw_blocks() needs, 0 otherwise, the result is
+ * probed once
+ */
+int srtp_sha1_hw_available(void);
+
+/*
+ * srtp_sha1_hw_name() is the printable name of the instructions, e.g.
+ * "SHA-NI"
+ */
+const char *srtp_sha1_hw_name(void);
+
+/*
+ * srtp_sha1_hw_blocks(H, msg, num_blocks) runs the compression function
+ * over num_blocks 64 octet blocks at msg, H is in host byte order, it
+ * must only be called when srtp_sha1_hw_available() is 1
+ */
+void srtp_sha1_hw_blocks(uint32_t hash_value[5],
+                         const uint8_t *msg,
+                         int num_blocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHA1_HW_H */
@@ -51,6 +51,15 @@
 #include "crypto_kernel.h"
 #include "cipher_types.h"
 
+#ifndef OPENSSL
+#include "aes_hw.h"
+#define SRTP_AES_ICM_128_HW (&srtp_aes_icm_128_hw)
+#define SRTP_AES_ICM_256_HW (&srtp_aes_icm_256_hw)
+#else
+#define SRTP_AES_ICM_128_HW NULL
+#define SRTP_AES_ICM_256_HW NULL
+#endif
+
 /* the debug module for the crypto_kernel */
 
 srtp_debug_module_t srtp_mod_crypto_kernel = {
@@ -69,6 +78,27 @@ srtp_crypto_kernel_t crypto_kernel = {
 
 #define MAX_RNG_TRIALS 25
 
+/*
+ * load the AES-ICM cipher type that uses the AES instructions of the CPU
+ * if there are any and it passes its self-test, the table version
+ * otherwise
+ */
+static srtp_err_status_t srtp_crypto_kernel_load_aes_icm(
+    const srtp_cipher_type_t *table,
+    const srtp_cipher_type_t *hw,
+    srtp_cipher_type_id_t id)
+{
+#ifndef OPENSSL
+    if (srtp_aes_hw_available() &&
+        srtp_crypto_kernel_load_cipher_type(hw, id) == srtp_err_status_ok) {
+        return srtp_err_status_ok;
+    }
+#else
+    (void)hw;
+#endif
+    return srtp_crypto_kernel_load_cipher_type(table, id);
+}
+
 srtp_err_status_t srtp_crypto_kernel_init()
 {
     srtp_err_status_t status;
@@ -116,13 +146,13 @@ srtp_err_status_t srtp_crypto_kernel_init()
     if (status) {
         return status;
     }
-    status = srtp_crypto_kernel_load_cipher_type(&srtp_aes_icm_128,
-                                                 SRTP_AES_ICM_128);
+    status = srtp_crypto_kernel_load_aes_icm(
+        &srtp_aes_icm_128, SRTP_AES_ICM_128_HW, SRTP_AES_ICM_128);
     if (status) {
         return status;
     }
-    status = srtp_crypto_kernel_load_cipher_type(&srtp_aes_icm_256,
-                                                 SRTP_AES_ICM_256);
+    status = srtp_crypto_kernel_load_aes_icm(
+        &srtp_aes_icm_256, SRTP_AES_ICM_256_HW, SRTP_AES_ICM_256);
     if (status) {
         return status;
     }
@@ -434,6 +434,34 @@ void srtp_cleanse(void *s, size_t len)
         *p++ = 0;
 }
 
+void srtp_octet_string_xor(uint8_t *a, const uint8_t *b, size_t len)
+{
+    if ((((uintptr_t)a | (uintptr_t)b) & 0x07) == 0) {
+        uint64_t *a64 = (uint64_t *)a;
+        const uint64_t *b64 = (const uint64_t *)b;
+
+        for (; len >= 16; len -= 16, a64 += 2, b64 += 2) {
+            a64[0] ^= b64[0];
+            a64[1] ^= b64[1];
+        }
+        a = (uint8_t *)a64;
+        b = (const uint8_t *)b64;
+    } else {
+        /* compilers turn these into plain unaligned loads and stores */
+        for (; len >= 8; len -= 8, a += 8, b += 8) {
+            uint64_t x, y;
+
+            memcpy(&x, a, 8);
+            memcpy(&y, b, 8);
+            x ^= y;
+            memcpy(a, &x, 8);
+        }
+    }
+    for (; len > 0; len--) {
+        *a++ ^= *b++;
+    }
+}
+
 void octet_string_set_to_zero(void *s, size_t len)
 {
 #if defined(OPENSSL) && !defined(OPENSSL_CLEANSE_BROKEN)
@@ -1621,6 +1621,68 @@ const char *srtp_get_version_string(void);
  */
 unsigned int srtp_get_version(void);
 
+/**
+ * @brief Returns the description of the cipher type the crypto kernel
+ * uses for the RTP cipher of profile, e.g. which AES implementation, NULL
+ * if it has none.
+ *
+ */
+const char *srtp_get_profile_cipher_description(srtp_profile_t profile);
+
+/**
+ * @brief srtp_aes_icm_impl_t selects how the AES-ICM ciphers compute AES.
+ */
+typedef enum {
+    srtp_aes_icm_impl_auto = 0,      /**< AES instructions if the CPU has */
+                                     /**< them, tables otherwise          */
+    srtp_aes_icm_impl_table = 1,     /**< T-tables                        */
+    srtp_aes_icm_impl_bitsliced = 2, /**< bitsliced, constant time        */
+    srtp_aes_icm_impl_hw = 3         /**< AES-NI or ARMv8 Crypto Ext.     */
+} srtp_aes_icm_impl_t;
+
+/**
+ * @brief srtp_set_aes_icm_impl(impl) replaces the AES-ICM cipher types
+ * of the crypto kernel with the ones of implementation impl.
+ *
+ * Streams created afterwards use it, existing streams keep their
+ * ciphers. Must not run concurrently with srtp_create() or
+ * srtp_add_stream().
+ *
+ * returns srtp_err_status_bad_param if impl is not available on this CPU
+ * or in this build, only srtp_aes_icm_impl_auto is with OpenSSL
+ *
+ */
+srtp_err_status_t srtp_set_aes_icm_impl(srtp_aes_icm_impl_t impl);
+
+/**
+ * @brief srtp_sha1_impl_t selects how HMAC-SHA1 computes SHA-1.
+ */
+typedef enum {
+    srtp_sha1_impl_auto = 0,   /**< the fastest one this CPU can run   */
+    srtp_sha1_impl_scalar = 1, /**< plain C                            */
+    srtp_sha1_impl_vector = 2, /**< NEON or SSE2 message schedule      */
+    srtp_sha1_impl_hw = 3      /**< SHA extensions or ARMv8 SHA1       */
+} srtp_sha1_impl_t;
+
+/**
+ * @brief srtp_set_sha1_impl(impl) makes HMAC-SHA1 use implementation
+ * impl, for existing streams too.
+ *
+ * Must not run concurrently with srtp_protect(), srtp_unprotect() or
+ * their RTCP versions.
+ *
+ * returns srtp_err_status_bad_param if impl is not available on this CPU
+ * or in this build, only srtp_sha1_impl_auto is with OpenSSL
+ *
+ */
+srtp_err_status_t srtp_set_sha1_impl(srtp_sha1_impl_t impl);
+
+/**
+ * @brief srtp_get_sha1_impl_description() returns the printable name of
+ * the SHA-1 implementation HMAC-SHA1 uses, e.g. "SHA-NI".
+ */
+const char *srtp_get_sha1_impl_description(void);
+
 /**
  * @brief srtp_set_debug_module(mod_name, v)
  *
@@ -1741,6 +1803,107 @@ srtp_err_status_t srtp_get_stream_roc(srtp_t session,
                                       uint32_t ssrc,
                                       uint32_t *roc);
 
+/**
+ * @brief srtp_set_keystream_cache(session, ssrc, packets, len)
+ *
+ * Reserve room for the keystream of the next packets packets, len octets
+ * each, of the outbound stream with the given SSRC (host order).
+ * srtp_precompute_keystream() fills it, srtp_protect() of a packet whose
+ * keystream is there only XORs it into the payload.  Only AES-ICM streams
+ * without MKI or header extension encryption use the cache.  A packets
+ * value of 0 frees it.
+ *
+ * returns err_status_ok on success, srtp_err_status_bad_param if there is no
+ * stream found, srtp_err_status_alloc_fail if out of memory
+ *
+ */
+srtp_err_status_t srtp_set_keystream_cache(srtp_t session,
+                                           uint32_t ssrc,
+                                           unsigned int packets,
+                                           unsigned int len);
+
+/**
+ * @brief srtp_precompute_keystream(session, ssrc, max_packets, generated)
+ *
+ * Generate keystream for up to max_packets of the packet indices following
+ * the last protected one that are not in the cache yet, meant to be called
+ * while the sender is idle.  The number generated is put into *generated,
+ * 0 means the cache is full.
+ *
+ * returns err_status_ok on success, srtp_err_status_bad_param if there is no
+ * stream or cache, or the stream does not use AES-ICM
+ *
+ */
+srtp_err_status_t srtp_precompute_keystream(srtp_t session,
+                                            uint32_t ssrc,
+                                            unsigned int max_packets,
+                                            unsigned int *generated);
+
+/**
+ * @brief srtp_set_keystream_parallel(session, ssrc, parts)
+ *
+ * Split filling the keystream cache of the stream with the given SSRC
+ * (host order) into parts parts, see srtp_precompute_keystream_part().
+ * Every part but the first gets its own copy of the cipher.  Not available
+ * with the OpenSSL crypto engine.
+ *
+ * returns err_status_ok on success, srtp_err_status_bad_param if there is no
+ * stream or cache, or the cipher can't be copied
+ *
+ */
+srtp_err_status_t srtp_set_keystream_parallel(srtp_t session,
+                                              uint32_t ssrc,
+                                              unsigned int parts);
+
+/**
+ * @brief srtp_precompute_keystream_part(session, ssrc, count, part,
+ * generated)
+ *
+ * Generate the keystream of part part of the next count packets: packets
+ * part, part + parts, ... that are not in the cache yet.  Different parts
+ * may run on different threads at the same time, as long as nothing else
+ * uses the session meanwhile.  The number generated is put into
+ * *generated.
+ *
+ * returns err_status_ok on success, srtp_err_status_bad_param if there is no
+ * stream or cache, or no such part
+ *
+ */
+srtp_err_status_t srtp_precompute_keystream_part(srtp_t session,
+                                                 uint32_t ssrc,
+                                                 unsigned int count,
+                                                 unsigned int part,
+                                                 unsigned int *generated);
+
+/**
+ * @brief srtp_get_keystream_missing(session, ssrc, count, missing)
+ *
+ * Number of the next count packets whose keystream is not in the cache.
+ *
+ * returns err_status_ok on success, srtp_err_status_bad_param if there is no
+ * stream or cache
+ *
+ */
+srtp_err_status_t srtp_get_keystream_missing(srtp_t session,
+                                             uint32_t ssrc,
+                                             unsigned int count,
+                                             unsigned int *missing);
+
+/**
+ * @brief srtp_get_keystream_stats(session, ssrc, hits, misses)
+ *
+ * Number of packets protected with precomputed keystream and number of
+ * packets that had to generate it on the spot.
+ *
+ * returns err_status_ok on success, srtp_err_status_bad_param if there is no
+ * stream or cache
+ *
+ */
+srtp_err_status_t srtp_get_keystream_stats(srtp_t session,
+                                           uint32_t ssrc,
+                                           uint64_t *hits,
+                                           uint64_t *misses);
+
 /**
  * @}
  */
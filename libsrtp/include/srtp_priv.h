@@ -137,6 +137,25 @@ typedef struct srtp_session_keys_t {
  * note that the keys might not actually be unique, in which case the
  * srtp_cipher_t and srtp_auth_t pointers will point to the same structures
  */
+/*
+ * keystream of the next outbound packets, generated ahead of time by
+ * srtp_precompute_keystream() so that srtp_protect() only has to XOR
+ * slot is the packet index modulo slots, index holds packet index + 1
+ * of the keystream in the slot, 0 if empty
+ * with parts > 1 srtp_precompute_keystream_part() fills it from several
+ * threads at once, each with its own copy of the cipher
+ */
+typedef struct srtp_keystream_cache_t {
+    unsigned int slots;
+    unsigned int len;
+    srtp_xtd_seq_num_t *index;
+    uint8_t *buffer;
+    unsigned int parts;
+    srtp_cipher_t **ciphers; /* one per part, 0 is the stream's */
+    uint64_t hits;
+    uint64_t misses;
+} srtp_keystream_cache_t;
+
 typedef struct srtp_stream_ctx_t_ {
     uint32_t ssrc;
     srtp_session_keys_t *session_keys;
@@ -151,6 +170,7 @@ typedef struct srtp_stream_ctx_t_ {
     int *enc_xtn_hdr;
     int enc_xtn_hdr_count;
     uint32_t pending_roc;
+    srtp_keystream_cache_t *keystream;
     struct srtp_stream_ctx_t_ *next; /* linked list of streams */
 } strp_stream_ctx_t_;
 
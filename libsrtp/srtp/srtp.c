@@ -60,6 +60,13 @@
 #include "aes_icm_ext.h"
 #endif
 
+#ifndef OPENSSL
+#include "aes_icm.h" /* for copying the cipher context */
+#include "aes_hw.h"
+#include "cipher_types.h"
+#include "sha1_hw.h"
+#endif
+
 #include <limits.h>
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -118,6 +125,121 @@ const char *srtp_get_version_string()
     return SRTP_VER_STRING;
 }
 
+const char *srtp_get_profile_cipher_description(srtp_profile_t profile)
+{
+    srtp_crypto_policy_t policy;
+    const srtp_cipher_type_t *ct;
+
+    if (srtp_crypto_policy_set_from_profile_for_rtp(&policy, profile)) {
+        return NULL;
+    }
+    ct = srtp_crypto_kernel_get_cipher_type(policy.cipher_type);
+    if (ct == NULL) {
+        return NULL;
+    }
+    return ct->description;
+}
+
+srtp_err_status_t srtp_set_aes_icm_impl(srtp_aes_icm_impl_t impl)
+{
+#ifdef OPENSSL
+    if (impl != srtp_aes_icm_impl_auto) {
+        return srtp_err_status_bad_param;
+    }
+    return srtp_err_status_ok;
+#else
+    const srtp_cipher_type_t *ct_128, *ct_256;
+    srtp_err_status_t status;
+
+    switch (impl) {
+    case srtp_aes_icm_impl_auto:
+        /* like srtp_crypto_kernel_init(), tables if the hardware fails */
+        if (srtp_aes_hw_available() &&
+            srtp_set_aes_icm_impl(srtp_aes_icm_impl_hw) ==
+                srtp_err_status_ok) {
+            return srtp_err_status_ok;
+        }
+        return srtp_set_aes_icm_impl(srtp_aes_icm_impl_table);
+    case srtp_aes_icm_impl_table:
+        ct_128 = &srtp_aes_icm_128;
+        ct_256 = &srtp_aes_icm_256;
+        break;
+    case srtp_aes_icm_impl_bitsliced:
+        ct_128 = &srtp_aes_icm_128_bs;
+        ct_256 = &srtp_aes_icm_256_bs;
+        break;
+    case srtp_aes_icm_impl_hw:
+        if (!srtp_aes_hw_available()) {
+            return srtp_err_status_bad_param;
+        }
+        ct_128 = &srtp_aes_icm_128_hw;
+        ct_256 = &srtp_aes_icm_256_hw;
+        break;
+    default:
+        return srtp_err_status_bad_param;
+    }
+
+    /* both run their self-tests before they replace anything */
+    status = srtp_cipher_type_self_test(ct_128);
+    if (status) {
+        return status;
+    }
+    status = srtp_cipher_type_self_test(ct_256);
+    if (status) {
+        return status;
+    }
+    status = srtp_replace_cipher_type(ct_128, SRTP_AES_ICM_128);
+    if (status) {
+        return status;
+    }
+    return srtp_replace_cipher_type(ct_256, SRTP_AES_ICM_256);
+#endif
+}
+
+srtp_err_status_t srtp_set_sha1_impl(srtp_sha1_impl_t impl)
+{
+#ifdef OPENSSL
+    if (impl != srtp_sha1_impl_auto) {
+        return srtp_err_status_bad_param;
+    }
+    return srtp_err_status_ok;
+#else
+    switch (impl) {
+    case srtp_sha1_impl_auto:
+        if (srtp_set_sha1_impl(srtp_sha1_impl_hw) == srtp_err_status_ok ||
+            srtp_set_sha1_impl(srtp_sha1_impl_vector) == srtp_err_status_ok) {
+            return srtp_err_status_ok;
+        }
+        return srtp_set_sha1_impl(srtp_sha1_impl_scalar);
+    case srtp_sha1_impl_scalar:
+        return srtp_sha1_set_blocks_func(srtp_sha1_scalar_blocks, "scalar");
+    case srtp_sha1_impl_vector:
+        if (!srtp_sha1_vector_available()) {
+            return srtp_err_status_bad_param;
+        }
+        return srtp_sha1_set_blocks_func(srtp_sha1_vector_blocks,
+                                         "vector schedule");
+    case srtp_sha1_impl_hw:
+        if (!srtp_sha1_hw_available()) {
+            return srtp_err_status_bad_param;
+        }
+        return srtp_sha1_set_blocks_func(srtp_sha1_hw_blocks,
+                                         srtp_sha1_hw_name());
+    default:
+        return srtp_err_status_bad_param;
+    }
+#endif
+}
+
+const char *srtp_get_sha1_impl_description(void)
+{
+#ifdef OPENSSL
+    return "OpenSSL";
+#else
+    return srtp_sha1_get_blocks_name();
+#endif
+}
+
 unsigned int srtp_get_version()
 {
     unsigned int major = 0, minor = 0, micro = 0;
@@ -149,6 +271,68 @@ unsigned int srtp_get_version()
     return rv;
 }
 
+/*
+ * keystream cache is never shared with the template, the keystream is
+ * key material and is zeroized
+ */
+static void srtp_keystream_ciphers_free(srtp_keystream_cache_t *ks)
+{
+    unsigned int i;
+
+    if (ks->ciphers == NULL)
+        return;
+    for (i = 1; i < ks->parts; i++)
+        if (ks->ciphers[i])
+            srtp_cipher_dealloc(ks->ciphers[i]);
+    srtp_crypto_free(ks->ciphers);
+    ks->ciphers = NULL;
+    ks->parts = 0;
+}
+
+static void srtp_keystream_cache_free(srtp_stream_ctx_t *stream)
+{
+    srtp_keystream_cache_t *ks = stream->keystream;
+
+    if (ks == NULL)
+        return;
+    srtp_keystream_ciphers_free(ks);
+    if (ks->buffer) {
+        octet_string_set_to_zero(ks->buffer, (size_t)ks->slots * ks->len);
+        srtp_crypto_free(ks->buffer);
+    }
+    if (ks->index)
+        srtp_crypto_free(ks->index);
+    srtp_crypto_free(ks);
+    stream->keystream = NULL;
+}
+
+/*
+ * srtp_keystream_take(stream, session_keys, est, len) returns the
+ * precomputed keystream for packet index est, or NULL if there is not
+ * enough of it, the slot can't be used twice
+ */
+static uint8_t *srtp_keystream_take(srtp_stream_ctx_t *stream,
+                                    srtp_session_keys_t *session_keys,
+                                    srtp_xtd_seq_num_t est,
+                                    int len)
+{
+    srtp_keystream_cache_t *ks = stream->keystream;
+    unsigned int slot;
+
+    if (ks == NULL)
+        return NULL;
+    slot = (unsigned int)(est % ks->slots);
+    if (session_keys != &stream->session_keys[0] ||
+        session_keys->rtp_xtn_hdr_cipher || ks->index[slot] != est + 1 ||
+        (unsigned int)len > ks->len) {
+        ks->misses++;
+        return NULL;
+    }
+    ks->index[slot] = 0;
+    ks->hits++;
+    return ks->buffer + (size_t)slot * ks->len;
+}
+
 srtp_err_status_t srtp_stream_dealloc(srtp_stream_ctx_t *stream,
                                       const srtp_stream_ctx_t *stream_template)
 {
@@ -268,6 +452,8 @@ srtp_err_status_t srtp_stream_dealloc(srtp_stream_ctx_t *stream,
 
     /* DAM - need to deallocate EKT here */
 
+    srtp_keystream_cache_free(stream);
+
     if (stream_template &&
         stream->enc_xtn_hdr == stream_template->enc_xtn_hdr) {
         /* do nothing */
@@ -2033,6 +2219,75 @@ static srtp_err_status_t srtp_unprotect_aead(srtp_ctx_t *ctx,
     return srtp_err_status_ok;
 }
 
+/*
+ * octets encrypted per step of srtp_protect_stitched(), sixteen AES blocks
+ * and four SHA-1 blocks
+ */
+#define SRTP_STITCH_OCTETS 256
+
+/*
+ * srtp_protect_stitched() encrypts the octets from enc_start to the end
+ * of the packet and runs the started auth function over the whole packet
+ * in one sweep: every step encrypts (or xors the precomputed keystream
+ * into) SRTP_STITCH_OCTETS octets and hashes the SHA-1 blocks that are
+ * complete by then, so the ciphertext is hashed while it is still in L1
+ * instead of in a second pass over the packet
+ *
+ * the steps are aligned to the cipher blocks from enc_start and the
+ * hashing to the SHA-1 blocks from the header, neither needs a partial
+ * block buffered in between
+ */
+static srtp_err_status_t srtp_protect_stitched(srtp_cipher_t *cipher,
+                                               srtp_auth_t *auth,
+                                               uint8_t *pkt,
+                                               uint8_t *enc_start,
+                                               int pkt_octet_len,
+                                               const uint8_t *keystream)
+{
+    srtp_err_status_t status;
+    int enc_done = (int)(enc_start - pkt);
+    int auth_done = 0;
+    unsigned int n;
+    int a;
+
+    while (enc_done < pkt_octet_len) {
+        n = (unsigned int)(pkt_octet_len - enc_done);
+        if (n > SRTP_STITCH_OCTETS) {
+            n = SRTP_STITCH_OCTETS;
+        }
+        if (keystream) {
+            srtp_octet_string_xor(pkt + enc_done, keystream, n);
+            keystream += n;
+        } else {
+            status = srtp_cipher_encrypt(cipher, pkt + enc_done, &n);
+            if (status) {
+                return srtp_err_status_cipher_fail;
+            }
+        }
+        enc_done += n;
+
+        /* the rest of the packet goes in with the last step */
+        a = enc_done - auth_done;
+        if (enc_done < pkt_octet_len) {
+            a &= ~63;
+        }
+        if (a > 0) {
+            status = srtp_auth_update(auth, pkt + auth_done, a);
+            if (status) {
+                return status;
+            }
+            auth_done += a;
+        }
+    }
+
+    /* nothing to encrypt, only the header is authenticated */
+    if (auth_done < pkt_octet_len) {
+        return srtp_auth_update(auth, pkt + auth_done,
+                                pkt_octet_len - auth_done);
+    }
+    return srtp_err_status_ok;
+}
+
 srtp_err_status_t srtp_protect(srtp_ctx_t *ctx,
                                void *rtp_hdr,
                                int *pkt_octet_len)
@@ -2056,12 +2311,14 @@ srtp_err_status_t srtp_protect_mki(srtp_ctx_t *ctx,
     srtp_err_status_t status;
     int tag_len;
     srtp_stream_ctx_t *stream;
-    uint32_t prefix_len;
+    uint32_t prefix_len = 0;
     srtp_hdr_xtnd_t *xtn_hdr = NULL;
     unsigned int mki_size = 0;
     srtp_session_keys_t *session_keys = NULL;
     uint8_t *mki_location = NULL;
     int advance_packet_index = 0;
+    uint8_t *keystream = NULL;
+    int stitched;
 
     debug_print(mod_srtp, "function srtp_protect", NULL);
 
@@ -2237,12 +2494,29 @@ srtp_err_status_t srtp_protect_mki(srtp_ctx_t *ctx,
     debug_print(mod_srtp, "estimated packet index: %016llx", est);
 #endif
 
+#ifndef NO_64BIT_MATH
+    /*
+     * keystream generated ahead of time makes the cipher setup unnecessary,
+     * unless a universal hash needs a keystream prefix
+     */
+    if (enc_start &&
+        !(auth_start && srtp_auth_get_prefix_length(session_keys->rtp_auth)) &&
+        (session_keys->rtp_cipher->type->id == SRTP_AES_ICM_128 ||
+         session_keys->rtp_cipher->type->id == SRTP_AES_ICM_192 ||
+         session_keys->rtp_cipher->type->id == SRTP_AES_ICM_256)) {
+        keystream =
+            srtp_keystream_take(stream, session_keys, est, enc_octet_len);
+    }
+#endif
+
     /*
      * if we're using rindael counter mode, set nonce and seq
      */
-    if (session_keys->rtp_cipher->type->id == SRTP_AES_ICM_128 ||
-        session_keys->rtp_cipher->type->id == SRTP_AES_ICM_192 ||
-        session_keys->rtp_cipher->type->id == SRTP_AES_ICM_256) {
+    if (keystream) {
+        status = srtp_err_status_ok;
+    } else if (session_keys->rtp_cipher->type->id == SRTP_AES_ICM_128 ||
+               session_keys->rtp_cipher->type->id == SRTP_AES_ICM_192 ||
+               session_keys->rtp_cipher->type->id == SRTP_AES_ICM_256) {
         v128_t iv;
 
         iv.v32[0] = 0;
@@ -2314,8 +2588,22 @@ srtp_err_status_t srtp_protect_mki(srtp_ctx_t *ctx,
         }
     }
 
+    /*
+     * counter mode with HMAC-SHA1, the default profiles, encrypts and
+     * authenticates in one pass, see srtp_protect_stitched()
+     */
+    stitched = enc_start && auth_start && prefix_len == 0 &&
+               session_keys->rtp_auth->type->id == SRTP_HMAC_SHA1 &&
+               (session_keys->rtp_cipher->type->id == SRTP_AES_ICM_128 ||
+                session_keys->rtp_cipher->type->id == SRTP_AES_ICM_192 ||
+                session_keys->rtp_cipher->type->id == SRTP_AES_ICM_256);
+
     /* if we're encrypting, exor keystream into the message */
-    if (enc_start) {
+    if (stitched) {
+        /* done together with the authentication below */
+    } else if (enc_start && keystream) {
+        srtp_octet_string_xor((uint8_t *)enc_start, keystream, enc_octet_len);
+    } else if (enc_start) {
         status =
             srtp_cipher_encrypt(session_keys->rtp_cipher, (uint8_t *)enc_start,
                                 (unsigned int *)&enc_octet_len);
@@ -2334,8 +2622,15 @@ srtp_err_status_t srtp_protect_mki(srtp_ctx_t *ctx,
             return status;
 
         /* run auth func over packet */
-        status = srtp_auth_update(session_keys->rtp_auth, (uint8_t *)auth_start,
-                                  *pkt_octet_len);
+        if (stitched) {
+            status = srtp_protect_stitched(
+                session_keys->rtp_cipher, session_keys->rtp_auth,
+                (uint8_t *)auth_start, (uint8_t *)enc_start, *pkt_octet_len,
+                keystream);
+        } else {
+            status = srtp_auth_update(session_keys->rtp_auth,
+                                      (uint8_t *)auth_start, *pkt_octet_len);
+        }
         if (status)
             return status;
 
@@ -4727,3 +5022,260 @@ srtp_err_status_t srtp_get_stream_roc(srtp_t session,
 
     return srtp_err_status_ok;
 }
+
+srtp_err_status_t srtp_set_keystream_cache(srtp_t session,
+                                           uint32_t ssrc,
+                                           unsigned int packets,
+                                           unsigned int len)
+{
+    srtp_stream_t stream;
+    srtp_keystream_cache_t *ks;
+
+    stream = srtp_get_stream(session, htonl(ssrc));
+    if (stream == NULL)
+        return srtp_err_status_bad_param;
+
+    srtp_keystream_cache_free(stream);
+    if (packets == 0 || len == 0)
+        return srtp_err_status_ok;
+
+    ks = (srtp_keystream_cache_t *)srtp_crypto_alloc(
+        sizeof(srtp_keystream_cache_t));
+    if (ks == NULL)
+        return srtp_err_status_alloc_fail;
+    stream->keystream = ks;
+    ks->slots = packets;
+    ks->len = len;
+    ks->index = (srtp_xtd_seq_num_t *)srtp_crypto_alloc(
+        sizeof(srtp_xtd_seq_num_t) * packets);
+    ks->buffer = (uint8_t *)srtp_crypto_alloc((size_t)packets * len);
+    if (ks->index == NULL || ks->buffer == NULL) {
+        srtp_keystream_cache_free(stream);
+        return srtp_err_status_alloc_fail;
+    }
+
+    return srtp_err_status_ok;
+}
+
+/*
+ * srtp_keystream_fill() generates keystream with cipher for the packet
+ * indices first, first + step, ... below first + count that are not in
+ * the cache yet, at most max_packets of them
+ */
+static srtp_err_status_t srtp_keystream_fill(srtp_stream_ctx_t *stream,
+                                             srtp_cipher_t *cipher,
+                                             uint32_t ssrc,
+                                             unsigned int first,
+                                             unsigned int count,
+                                             unsigned int step,
+                                             unsigned int max_packets,
+                                             unsigned int *generated)
+{
+#ifdef NO_64BIT_MATH
+    (void)stream;
+    (void)cipher;
+    (void)ssrc;
+    (void)first;
+    (void)count;
+    (void)step;
+    (void)max_packets;
+    *generated = 0;
+    return srtp_err_status_bad_param;
+#else
+    srtp_keystream_cache_t *ks = stream->keystream;
+    srtp_xtd_seq_num_t next;
+    srtp_err_status_t status;
+    unsigned int i;
+
+    *generated = 0;
+    if (count > ks->slots)
+        count = ks->slots;
+
+    /* the sender protects packets in sequence, the next ones follow */
+    next = srtp_rdbx_get_packet_index(&stream->rtp_rdbx) + 1;
+    for (i = first; i < count && *generated < max_packets; i += step) {
+        srtp_xtd_seq_num_t index = next + i;
+        unsigned int slot = (unsigned int)(index % ks->slots);
+        unsigned int len = ks->len;
+        v128_t iv;
+
+        if (ks->index[slot] == index + 1)
+            continue;
+
+        /* same IV as srtp_protect() */
+        iv.v32[0] = 0;
+        iv.v32[1] = htonl(ssrc);
+        iv.v64[1] = be64_to_cpu(index << 16);
+        status = srtp_cipher_set_iv(cipher, (uint8_t *)&iv,
+                                    srtp_direction_encrypt);
+        if (status)
+            return srtp_err_status_cipher_fail;
+        status = srtp_cipher_output(cipher, ks->buffer + (size_t)slot * len,
+                                    &len);
+        if (status)
+            return srtp_err_status_cipher_fail;
+        ks->index[slot] = index + 1;
+        (*generated)++;
+    }
+
+    return srtp_err_status_ok;
+#endif
+}
+
+/*
+ * stream with a keystream cache whose cipher can fill it
+ */
+static srtp_stream_ctx_t *srtp_keystream_stream(srtp_t session, uint32_t ssrc)
+{
+    srtp_stream_ctx_t *stream;
+    srtp_cipher_t *cipher;
+
+    stream = srtp_get_stream(session, htonl(ssrc));
+    if (stream == NULL || stream->keystream == NULL)
+        return NULL;
+    cipher = stream->session_keys[0].rtp_cipher;
+    if (cipher->type->id != SRTP_AES_ICM_128 &&
+        cipher->type->id != SRTP_AES_ICM_192 &&
+        cipher->type->id != SRTP_AES_ICM_256)
+        return NULL;
+    return stream;
+}
+
+srtp_err_status_t srtp_precompute_keystream(srtp_t session,
+                                            uint32_t ssrc,
+                                            unsigned int max_packets,
+                                            unsigned int *generated)
+{
+    srtp_stream_ctx_t *stream;
+
+    *generated = 0;
+    stream = srtp_keystream_stream(session, ssrc);
+    if (stream == NULL)
+        return srtp_err_status_bad_param;
+
+    return srtp_keystream_fill(stream, stream->session_keys[0].rtp_cipher,
+                               ssrc, 0, stream->keystream->slots, 1,
+                               max_packets, generated);
+}
+
+srtp_err_status_t srtp_set_keystream_parallel(srtp_t session,
+                                              uint32_t ssrc,
+                                              unsigned int parts)
+{
+    srtp_stream_ctx_t *stream;
+    srtp_keystream_cache_t *ks;
+    srtp_cipher_t *cipher;
+    unsigned int i;
+
+    stream = srtp_keystream_stream(session, ssrc);
+    if (stream == NULL || parts == 0)
+        return srtp_err_status_bad_param;
+    ks = stream->keystream;
+    cipher = stream->session_keys[0].rtp_cipher;
+
+    srtp_keystream_ciphers_free(ks);
+    if (parts == 1)
+        return srtp_err_status_ok;
+
+#ifdef OPENSSL
+    /* the OpenSSL context can't be copied, only one part */
+    (void)i;
+    (void)cipher;
+    return srtp_err_status_bad_param;
+#else
+    ks->ciphers =
+        (srtp_cipher_t **)srtp_crypto_alloc(sizeof(srtp_cipher_t *) * parts);
+    if (ks->ciphers == NULL)
+        return srtp_err_status_alloc_fail;
+    ks->parts = parts;
+
+    /*
+     * part 0 uses the stream's own cipher, the others a copy of it, the
+     * native AES-ICM context holds no pointers, whichever implementation
+     */
+    for (i = 1; i < parts; i++) {
+        srtp_err_status_t status;
+
+        /* same type, the kernel may have another one for the id by now */
+        status = cipher->type->alloc(&ks->ciphers[i], cipher->key_len, 0);
+        if (status) {
+            srtp_keystream_ciphers_free(ks);
+            return status;
+        }
+        memcpy(ks->ciphers[i]->state, cipher->state,
+               sizeof(srtp_aes_icm_ctx_t));
+        ks->ciphers[i]->algorithm = cipher->algorithm;
+    }
+
+    return srtp_err_status_ok;
+#endif
+}
+
+srtp_err_status_t srtp_precompute_keystream_part(srtp_t session,
+                                                 uint32_t ssrc,
+                                                 unsigned int count,
+                                                 unsigned int part,
+                                                 unsigned int *generated)
+{
+    srtp_stream_ctx_t *stream;
+    srtp_keystream_cache_t *ks;
+    srtp_cipher_t *cipher;
+
+    *generated = 0;
+    stream = srtp_keystream_stream(session, ssrc);
+    if (stream == NULL)
+        return srtp_err_status_bad_param;
+    ks = stream->keystream;
+    if (part >= (ks->parts ? ks->parts : 1))
+        return srtp_err_status_bad_param;
+    cipher = part ? ks->ciphers[part] : stream->session_keys[0].rtp_cipher;
+
+    return srtp_keystream_fill(stream, cipher, ssrc, part, count,
+                               ks->parts ? ks->parts : 1, count, generated);
+}
+
+srtp_err_status_t srtp_get_keystream_missing(srtp_t session,
+                                             uint32_t ssrc,
+                                             unsigned int count,
+                                             unsigned int *missing)
+{
+    srtp_stream_ctx_t *stream;
+    srtp_keystream_cache_t *ks;
+    srtp_xtd_seq_num_t next;
+    unsigned int i;
+
+    *missing = 0;
+    stream = srtp_keystream_stream(session, ssrc);
+    if (stream == NULL)
+        return srtp_err_status_bad_param;
+    ks = stream->keystream;
+    if (count > ks->slots)
+        count = ks->slots;
+
+    next = srtp_rdbx_get_packet_index(&stream->rtp_rdbx) + 1;
+    for (i = 0; i < count; i++) {
+        srtp_xtd_seq_num_t index = next + i;
+
+        if (ks->index[index % ks->slots] != index + 1)
+            (*missing)++;
+    }
+
+    return srtp_err_status_ok;
+}
+
+srtp_err_status_t srtp_get_keystream_stats(srtp_t session,
+                                           uint32_t ssrc,
+                                           uint64_t *hits,
+                                           uint64_t *misses)
+{
+    srtp_stream_t stream;
+
+    stream = srtp_get_stream(session, htonl(ssrc));
+    if (stream == NULL || stream->keystream == NULL)
+        return srtp_err_status_bad_param;
+
+    *hits = stream->keystream->hits;
+    *misses = stream->keystream->misses;
+
+    return srtp_err_status_ok;
+}
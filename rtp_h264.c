@@ -0,0 +1,400 @@
+/*
+ * RFC 6184 H.264 RTP packetizer
+ *
+ * - NAL units that fit into one packet are sent as single NAL unit packets
+ * - larger NAL units are split into FU-A fragments
+ * - small SPS/PPS/SEI NAL units are aggregated into STAP-A packets
+ *
+ * the encoder may split a large NAL unit over several output buffers,
+ * the unfinished tail (less than one fragment) is carried over to the next call
+ */
+#include "rtp_h264.h"
+
+#include <string.h>
+
+void h264_packetizer_init(struct h264_packetizer* pk, size_t max_payload)
+{
+    memset(pk, 0, sizeof(struct h264_packetizer));
+    if (max_payload > H264_STAP_A_MAX_PAYLOAD)
+        max_payload = H264_STAP_A_MAX_PAYLOAD;
+    pk->max_payload = max_payload;
+}
+
+void h264_packetizer_reset(struct h264_packetizer* pk)
+{
+    pk->in_nal = 0;
+    pk->fu_started = 0;
+    pk->carry_len = 0;
+    pk->held_zeros = 0;
+    pk->nal_pending = 0;
+    pk->stap_len = 0;
+    pk->stap_nals = 0;
+}
+
+/*
+ * return pointer to the next 00 00 01 start code, or end if there is none
+ */
+static const uint8_t* next_start_code(const uint8_t* p, const uint8_t* end)
+{
+    while (p + 2 < end)
+    {
+        if (p[2] > 1)
+            p += 3;
+        else if (p[1])
+            p += 2;
+        else if (p[0] || p[2] != 1)
+            p++;
+        else
+            return p;
+    }
+    return end;
+}
+
+static int aggregatable(uint8_t nal_hdr)
+{
+    switch (nal_hdr & 0x1f)
+    {
+        case H264_NAL_SEI:
+        case H264_NAL_SPS:
+        case H264_NAL_PPS:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int flush_stap(struct h264_packetizer* pk, int marker,
+        h264_emit_fn emit, void* arg)
+{
+    if (pk->stap_nals == 0)
+        return 0;
+    if (pk->stap_nals == 1)
+    {
+        //no point in aggregating a single NAL unit
+        emit(arg, NULL, 0, pk->stap + 3, pk->stap_len - 3, marker);
+        pk->single_pkts++;
+    }else
+    {
+        emit(arg, NULL, 0, pk->stap, pk->stap_len, marker);
+        pk->stap_pkts++;
+    }
+    pk->stap_len = 0;
+    pk->stap_nals = 0;
+    return 1;
+}
+
+/*
+ * append a complete NAL unit to the pending STAP-A,
+ * return 0 if it does not fit
+ */
+static int stap_add(struct h264_packetizer* pk, const uint8_t* nal, size_t len)
+{
+    size_t need = (pk->stap_len ? pk->stap_len : 1) + 2 + len;
+    if (need > pk->max_payload)
+        return 0;
+    if (pk->stap_len==0)
+    {
+        pk->stap[0] = H264_NAL_STAP_A;
+        pk->stap_len = 1;
+    }
+    //F bit is OR-ed, NRI is the maximum of the aggregated units
+    if ((nal[0] & 0x80) || (nal[0] & 0x60) > (pk->stap[0] & 0x60))
+        pk->stap[0] = (pk->stap[0] & 0x80) | (nal[0] & 0xe0) | H264_NAL_STAP_A;
+    pk->stap[pk->stap_len++] = len >> 8;
+    pk->stap[pk->stap_len++] = len & 0xff;
+    memcpy(&pk->stap[pk->stap_len], nal, len);
+    pk->stap_len += len;
+    pk->stap_nals++;
+    return 1;
+}
+
+static void emit_fu(struct h264_packetizer* pk, const uint8_t* body, size_t len,
+        int start, int end, int marker, h264_emit_fn emit, void* arg)
+{
+    uint8_t prefix[H264_FU_HEADER_LEN];
+    prefix[0] = (pk->nal_hdr & 0xe0) | H264_NAL_FU_A;
+    prefix[1] = (start ? 0x80 : 0) | (end ? 0x40 : 0) | (pk->nal_hdr & 0x1f);
+    emit(arg, prefix, H264_FU_HEADER_LEN, body, len, marker);
+    pk->fu_pkts++;
+}
+
+/*
+ * split body of a NAL unit into full size fragments, the last one takes the rest
+ */
+static int fragment(struct h264_packetizer* pk, const uint8_t* body, size_t len,
+        int start, int marker, h264_emit_fn emit, void* arg)
+{
+    size_t frag = pk->max_payload - H264_FU_HEADER_LEN;
+    int n = 0;
+    while (len > frag)
+    {
+        emit_fu(pk, body, frag, start, 0, 0, emit, arg);
+        start = 0;
+        body += frag;
+        len -= frag;
+        n++;
+    }
+    emit_fu(pk, body, len, start, 1, marker, emit, arg);
+    return n + 1;
+}
+
+/*
+ * carry may hold one byte more than a fragment while the NAL unit
+ * could still go out as a single packet, send the excess as first fragment
+ */
+static int drain_carry(struct h264_packetizer* pk, h264_emit_fn emit, void* arg)
+{
+    size_t frag = pk->max_payload - H264_FU_HEADER_LEN;
+    if (pk->carry_len <= frag)
+        return 0;
+    emit_fu(pk, pk->carry, frag, !pk->fu_started, 0, 0, emit, arg);
+    pk->fu_started = 1;
+    pk->carry_len -= frag;
+    memmove(pk->carry, pk->carry + frag, pk->carry_len);
+    return 1;
+}
+
+/*
+ * feed one piece of a NAL unit
+ * complete - the NAL unit ends with this piece
+ * last - this is the last NAL unit of the access unit
+ */
+static int feed_nal(struct h264_packetizer* pk, const uint8_t* d, size_t n,
+        int complete, int last, h264_emit_fn emit, void* arg)
+{
+    size_t frag = pk->max_payload - H264_FU_HEADER_LEN;
+    int cnt = 0;
+
+    if (!pk->in_nal)
+    {
+        if (n==0)
+            return 0;
+        pk->nals++;
+        if (complete)
+        {
+            //fast path, whole NAL unit is in this buffer
+            if (aggregatable(d[0]))
+            {
+                if (stap_add(pk, d, n))
+                    return 0;
+                cnt += flush_stap(pk, 0, emit, arg);
+                if (stap_add(pk, d, n))
+                    return cnt;
+            }
+            cnt += flush_stap(pk, 0, emit, arg);
+            if (n <= pk->max_payload)
+            {
+                emit(arg, NULL, 0, d, n, last);
+                pk->single_pkts++;
+                return cnt + 1;
+            }
+            pk->nal_hdr = d[0];
+            return cnt + fragment(pk, d + 1, n - 1, 1, last, emit, arg);
+        }
+        cnt += flush_stap(pk, 0, emit, arg);
+        pk->in_nal = 1;
+        pk->fu_started = 0;
+        pk->carry_len = 0;
+        pk->nal_hdr = d[0];
+        d++;
+        n--;
+    }
+
+    if (complete)
+    {
+        if (!pk->fu_started && 1 + pk->carry_len + n <= pk->max_payload)
+        {
+            memcpy(&pk->carry[pk->carry_len], d, n);
+            pk->carry_len += n;
+            emit(arg, &pk->nal_hdr, 1, pk->carry, pk->carry_len, last);
+            pk->single_pkts++;
+            cnt++;
+        }else
+        {
+            cnt += drain_carry(pk, emit, arg);
+            if (pk->carry_len)
+            {
+                size_t take = frag - pk->carry_len;
+                if (take > n)
+                    take = n;
+                memcpy(&pk->carry[pk->carry_len], d, take);
+                pk->carry_len += take;
+                d += take;
+                n -= take;
+                emit_fu(pk, pk->carry, pk->carry_len, !pk->fu_started,
+                        n==0, last && n==0, emit, arg);
+                pk->fu_started = 1;
+                cnt++;
+            }
+            if (n)
+                cnt += fragment(pk, d, n, !pk->fu_started, last, emit, arg);
+        }
+        pk->in_nal = 0;
+        pk->fu_started = 0;
+        pk->carry_len = 0;
+        return cnt;
+    }
+
+    //end of this NAL unit is not known yet, keep at most one fragment back
+    if (!pk->fu_started && 1 + pk->carry_len + n <= pk->max_payload)
+    {
+        memcpy(&pk->carry[pk->carry_len], d, n);
+        pk->carry_len += n;
+        return cnt;
+    }
+    cnt += drain_carry(pk, emit, arg);
+    if (pk->carry_len)
+    {
+        size_t take = frag - pk->carry_len;
+        if (take > n)
+            take = n;
+        memcpy(&pk->carry[pk->carry_len], d, take);
+        pk->carry_len += take;
+        d += take;
+        n -= take;
+        if (n==0)
+            return cnt;
+        emit_fu(pk, pk->carry, pk->carry_len, !pk->fu_started, 0, 0, emit, arg);
+        pk->fu_started = 1;
+        pk->carry_len = 0;
+        cnt++;
+    }
+    while (n > frag)
+    {
+        emit_fu(pk, d, frag, !pk->fu_started, 0, 0, emit, arg);
+        pk->fu_started = 1;
+        d += frag;
+        n -= frag;
+        cnt++;
+    }
+    memcpy(pk->carry, d, n);
+    pk->carry_len = n;
+    return cnt;
+}
+
+/*
+ * feed NAL unit bytes [nal, sc), sc is the next start code or end of buffer
+ */
+static int feed_piece(struct h264_packetizer* pk, const uint8_t* nal,
+        const uint8_t* sc, int complete, int last, h264_emit_fn emit, void* arg)
+{
+    const uint8_t* nal_end = sc;
+    size_t zeros = 0;
+    int cnt;
+
+    //a NAL unit never ends with a zero byte, trailing zeros are
+    //trailing_zero_8bits or the start of the next start code, if the NAL
+    //unit continues hold them back until the next buffer tells which
+    while (nal_end > nal && nal_end[-1]==0)
+    {
+        nal_end--;
+        zeros++;
+    }
+    cnt = feed_nal(pk, nal, nal_end - nal, complete, last, emit, arg);
+    if (!complete && pk->in_nal)
+        pk->held_zeros = zeros;
+    return cnt;
+}
+
+/*
+ * the zeros held back were part of the NAL unit after all
+ */
+static int feed_zeros(struct h264_packetizer* pk, size_t n,
+        h264_emit_fn emit, void* arg)
+{
+    static const uint8_t zeros[64];
+    int cnt = 0;
+    while (n)
+    {
+        size_t k = n < sizeof(zeros) ? n : sizeof(zeros);
+        cnt += feed_nal(pk, zeros, k, 0, 0, emit, arg);
+        n -= k;
+    }
+    return cnt;
+}
+
+int h264_packetize(struct h264_packetizer* pk, const uint8_t* data,
+        size_t length, int flags, h264_emit_fn emit, void* arg)
+{
+    const uint8_t* end = data + length;
+    const uint8_t* nal;
+    const uint8_t* sc;
+    const uint8_t* sc_end = NULL;//end of the last start code seen
+    int boundary = flags & (H264_NAL_END | H264_AU_END);
+    int au_end = !!(flags & H264_AU_END);
+    int cnt = 0;
+
+    nal = NULL;
+    if (pk->held_zeros)
+    {
+        size_t lz = 0;
+        while (lz < length && data[lz]==0)
+            lz++;
+        if (lz == length && !boundary)
+        {
+            //still only zeros, keep counting
+            pk->held_zeros += length;
+            return 0;
+        }
+        if (lz < length && data[lz]==1 && pk->held_zeros + lz >= 2)
+        {
+            //start code was split between the buffers
+            if (pk->in_nal)
+                cnt += feed_nal(pk, data, 0, 1, 0, emit, arg);
+            nal = sc_end = data + lz + 1;
+        }else if (lz == length)
+        {
+            //the zeros ended the NAL unit
+            if (pk->in_nal)
+                cnt += feed_nal(pk, data, 0, 1, au_end, emit, arg);
+            nal = end;
+        }else if (pk->in_nal)
+            cnt += feed_zeros(pk, pk->held_zeros, emit, arg);
+        pk->held_zeros = 0;
+    }
+
+    if (nal)
+        ;
+    else if (pk->in_nal)
+    {
+        //continuation of the NAL unit left over from last buffer
+        sc = next_start_code(data, end);
+        cnt += feed_piece(pk, data, sc, (sc!=end) || boundary,
+                (sc==end) && au_end, emit, arg);
+        nal = (sc!=end) ? sc_end = sc + 3 : end;
+    }else if (pk->nal_pending)
+    {
+        //last buffer ended right after a start code
+        nal = data;
+    }else
+    {
+        sc = next_start_code(data, end);
+        nal = (sc!=end) ? sc_end = sc + 3 : end;
+    }
+    pk->nal_pending = 0;
+
+    while (nal < end)
+    {
+        sc = next_start_code(nal, end);
+        cnt += feed_piece(pk, nal, sc, (sc!=end) || boundary,
+                (sc==end) && au_end, emit, arg);
+        nal = (sc!=end) ? sc_end = sc + 3 : end;
+    }
+
+    if (boundary)
+        cnt += flush_stap(pk, au_end, emit, arg);
+    else if (!pk->in_nal)
+    {
+        if (sc_end == end)
+            pk->nal_pending = 1;
+        else
+        {
+            //zeros after the last NAL unit, may start a start code
+            const uint8_t* z = end;
+            while (z > (sc_end ? sc_end : data) && z[-1]==0)
+                z--;
+            pk->held_zeros = end - z;
+        }
+    }
+    return cnt;
+}
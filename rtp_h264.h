@@ -0,0 +1,76 @@
+#ifndef _RTP_H264_
+#define _RTP_H264_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * RFC 6184 H.264 packetizer
+ * takes Annex B byte stream (as produced by the encoder) and emits
+ * single NAL unit packets, FU-A fragments and STAP-A aggregates
+ */
+
+#define H264_NAL_SEI 6
+#define H264_NAL_SPS 7
+#define H264_NAL_PPS 8
+#define H264_NAL_STAP_A 24
+#define H264_NAL_FU_A 28
+
+#define H264_FU_HEADER_LEN 2
+#define H264_STAP_A_MAX_PAYLOAD 1500
+
+/*
+ * flags for h264_packetize()
+ * H264_NAL_END - data ends on a NAL unit boundary
+ * H264_AU_END - data ends the access unit, last packet gets the marker bit
+ */
+#define H264_NAL_END 0x1
+#define H264_AU_END 0x2
+
+/*
+ * called for every RTP payload produced by the packetizer,
+ * the payload is prefix followed by body, both are only valid during the call
+ */
+typedef void (*h264_emit_fn)(void* arg,
+        const uint8_t* prefix, size_t prefix_len,
+        const uint8_t* body, size_t body_len,
+        int marker);
+
+struct h264_packetizer {
+    size_t max_payload;//largest RTP payload we are allowed to emit
+
+    //NAL unit whose end is not seen yet (encoder buffer ended in the middle)
+    int in_nal;
+    int fu_started;
+    uint8_t nal_hdr;
+    uint8_t carry[H264_STAP_A_MAX_PAYLOAD+1];
+    size_t carry_len;
+    size_t held_zeros;//trailing zeros of last buffer, may start a start code
+    int nal_pending;//last buffer ended with a start code
+
+    //pending STAP-A aggregate
+    uint8_t stap[H264_STAP_A_MAX_PAYLOAD];
+    size_t stap_len;
+    int stap_nals;
+
+    //statistics
+    uint64_t nals;
+    uint64_t single_pkts;
+    uint64_t fu_pkts;
+    uint64_t stap_pkts;
+};
+
+void h264_packetizer_init(struct h264_packetizer* pk, size_t max_payload);
+
+/*
+ * packetize one encoder buffer, returns number of packets emitted
+ */
+int h264_packetize(struct h264_packetizer* pk, const uint8_t* data,
+        size_t length, int flags, h264_emit_fn emit, void* arg);
+
+/*
+ * drop any partial NAL/aggregate, used when the stream restarts
+ */
+void h264_packetizer_reset(struct h264_packetizer* pk);
+
+#endif
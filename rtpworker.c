@@ -5,42 +5,395 @@
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-
+#include <linux/net_tstamp.h>
 
 #include "util.h"
 
 #define MAX_KEY_LEN 96
 
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+#endif
+
+#define GSO_CMSG_SPACE CMSG_SPACE(sizeof(uint16_t))
+#define TXTIME_CMSG_SPACE CMSG_SPACE(sizeof(uint64_t))
+
+//seconds from 1900 to 1970
+#define NTP_UNIX_OFFSET 2208988800ULL
+
 static struct srtp_sender_context* srtpctx;
 
-void prepare_srtp_sender(const char* receiver_ip, const int receiver_port,
-        const int ssrc, const uint8_t * input_key)
+static void srtp_uring_complete();
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * wall clock as 64 bit NTP timestamp
+ */
+static uint64_t ntp_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)(ts.tv_sec + NTP_UNIX_OFFSET) << 32)
+        | (((uint64_t)ts.tv_nsec << 32) / 1000000000);
+}
+
+static struct srtp_session* find_session(const struct sockaddr_in* raddr,
+        uint32_t ssrc)
+{
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+    {
+        struct srtp_session* s = &srtpctx->sessions[i];
+        if (s->in_use && s->ssrc==ssrc
+                && s->raddr.sin_addr.s_addr==raddr->sin_addr.s_addr
+                && s->raddr.sin_port==raddr->sin_port)
+            return s;
+    }
+    return NULL;
+}
+
+/*
+ * PLI/FIR or a new receiver, the encoder is asked for an IDR by
+ * srtp_rtcp_timers()
+ */
+static void srtp_keyframe_request(int layer)
+{
+    srtpctx->layers[layer].keyframe_pending = 1;
+    srtpctx->keyframe_requests++;
+}
+
+static void srtp_tcp_free(struct srtp_tcp* t)
+{
+    if (t)
+        free(t->buf);
+    free(t);
+}
+
+static void close_session(struct srtp_session* s)
+{
+    //nothing in flight may point to it
+    srtp_uring_complete();
+    if (s->fixed)
+        uring_set_buffer(&srtpctx->uring->ring, s - srtpctx->sessions, NULL, 0);
+    s->fixed = 0;
+    srtpctx->closed_packets += s->packets;
+    srtpctx->closed_send_calls += s->send_calls;
+    srtp_dealloc(s->srtp_ctx);
+    close(s->sock);
+    free(s->rtx);
+    free(s->fec);
+    free(s->twcc);
+    srtp_tcp_free(s->tcp);
+    free(s->mcast);
+    s->in_use = 0;
+    srtpctx->nsessions--;
+    //the sender thread may be pacing it without the lock
+    if (srtpctx->pacing==s)
+        srtpctx->pacing = NULL;
+}
+
+/*
+ * the session's retransmission ring becomes registered buffer number
+ * session index
+ */
+static void srtp_uring_register(struct srtp_session* s)
+{
+    struct srtp_uring* u = srtpctx->uring;
+    int ret;
+
+    s->fixed = 0;
+    if (!u || !u->fixed || s->tcp || s->mcast)
+        return;
+    ret = uring_set_buffer(&u->ring, s - srtpctx->sessions, s->rtx,
+            SRTP_RTX_RING * sizeof(struct srtp_rtx_slot));
+    if (ret)
+        fprintf(stderr, "can't register retransmission ring: %s\n", strerror(-ret));
+    else
+        s->fixed = 1;
+}
+
+/*
+ * UDP socket sending from the receiver's port, return -1 on failure
+ */
+static int srtp_udp_connect(const struct sockaddr_in* raddr)
+{
+    struct sockaddr_in local;
+    int flag = 1;
+    int sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    //bind local port, several receivers may use the same port
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    memset(&local, 0, sizeof(struct sockaddr_in));
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = raddr->sin_port;
+    if (bind(sock, (struct sockaddr *)&local,
+                sizeof(struct sockaddr_in))<0) {
+        perror("local port bind");
+        close(sock);
+        return -1;
+    }
+    //connected socket, no destination lookup per packet
+    if (connect(sock, (const struct sockaddr*)raddr,
+                sizeof(struct sockaddr_in))<0) {
+        perror("connect to receiver");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * UDP socket sending to a multicast group, not connected so that viewers'
+ * feedback to the group's port gets through, return -1 on failure
+ */
+static int srtp_multicast_socket(const struct sockaddr_in* group,
+        const struct srtp_multicast* mcast)
+{
+    struct sockaddr_in local;
+    int flag = 1;
+    int sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    memset(&local, 0, sizeof(struct sockaddr_in));
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = group->sin_port;
+    if (bind(sock, (struct sockaddr *)&local,
+                sizeof(struct sockaddr_in))<0) {
+        perror("local port bind");
+        close(sock);
+        return -1;
+    }
+    if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL,
+                &mcast->ttl, sizeof(mcast->ttl))<0
+            || setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF,
+                &mcast->iface, sizeof(struct in_addr))<0) {
+        perror("multicast ttl/interface");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * TCP connection to the receiver, non-blocking once it is up
+ * return -1 on failure
+ */
+static int srtp_tcp_connect(const struct sockaddr_in* raddr)
+{
+    struct timeval timeout = {SRTP_TCP_CONNECT_TIMEOUT, 0};
+    int sndbuf = SRTP_TCP_SNDBUF;
+    int flag = 1;
+    int sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if (sock < 0)
+    {
+        perror("tcp socket");
+        return -1;
+    }
+    //connect() gives up after the send timeout
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(sock, (const struct sockaddr*)raddr,
+                sizeof(struct sockaddr_in))<0) {
+        perror("tcp connect to receiver");
+        close(sock);
+        return -1;
+    }
+    //packets are framed and queued by us, send them right away
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    //what the kernel holds is out of reach of the latency budget
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    return sock;
+}
+
+/*
+ * grow the send buffer to the largest keyframe so far with its packet
+ * headers and parity, or set the configured size
+ */
+static void srtp_socket_sndbuf(struct srtp_session* s)
+{
+    int sndbuf = srtpctx->sndbuf;
+    socklen_t len = sizeof(s->sndbuf);
+
+    if (sndbuf==SRTP_SNDBUF_AUTO)
+    {
+        size_t bytes = srtpctx->keyframe_bytes;
+        bytes += (bytes / RTP_PAYLOAD_MAX + 1)
+            * (RTP_HEADER_LEN + RTP_TWCC_EXT_LEN + SRTP_MAX_TAG_LEN);
+        if (srtpctx->fec_row)
+            bytes += bytes / srtpctx->fec_row;
+        if (srtpctx->fec_col)
+            bytes += bytes / srtpctx->fec_col;
+        //the kernel reports twice what was set, the rest is its overhead
+        sndbuf = bytes > INT32_MAX / 2 ? INT32_MAX / 2 : bytes;
+        if (sndbuf * 2 <= s->sndbuf)
+            return;
+    }
+    //past net.core.wmem_max only with CAP_NET_ADMIN
+    if (setsockopt(s->sock, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf))<0
+            && setsockopt(s->sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf))<0)
+        perror("SO_SNDBUF");
+    getsockopt(s->sock, SOL_SOCKET, SO_SNDBUF, &s->sndbuf, &len);
+}
+
+/*
+ * DSCP, priority, send buffer and launch times of a media socket,
+ * whatever the kernel refuses is reported and left as it is
+ */
+static void srtp_socket_options(struct srtp_session* s)
+{
+    int tos = srtpctx->dscp << 2;
+    socklen_t len = sizeof(s->sndbuf);
+
+    if (setsockopt(s->sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos))<0)
+        perror("IP_TOS");
+    if (setsockopt(s->sock, SOL_SOCKET, SO_PRIORITY, &srtpctx->priority,
+                sizeof(srtpctx->priority))<0)
+        perror("SO_PRIORITY");
+    getsockopt(s->sock, SOL_SOCKET, SO_SNDBUF, &s->sndbuf, &len);
+    //TCP keeps what it has queued small, see SRTP_TCP_SNDBUF
+    if (s->tcp)
+        return;
+    srtp_socket_sndbuf(s);
+    //can't be turned off again, packets without a launch time just go
+    if (srtpctx->pacer.txtime && !s->txtime)
+    {
+        struct sock_txtime cfg = {CLOCK_MONOTONIC, 0};
+        if (setsockopt(s->sock, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg))<0)
+            perror("SO_TXTIME not supported, pacing sleeps");
+        else
+            s->txtime = 1;
+    }else if (!srtpctx->pacer.txtime)
+        s->txtime = 0;
+}
+
+/*
+ * size keystream caches of a session's streams, the parity stream only
+ * once FEC is in use
+ */
+static void srtp_keystream_setup(struct srtp_session* s)
+{
+    unsigned n = srtpctx->keystream_packets;
+
+    for (int k=0; k<(s->fec ? 2 : 1); k++)
+    {
+        if (srtp_set_keystream_cache(s->srtp_ctx, s->media_ssrc + k, n,
+                    SRTP_KEYSTREAM_LEN)!=srtp_err_status_ok)
+            fprintf(stderr, "can't allocate srtp keystream cache\n");
+        //without copies of the cipher part 0 does all of it
+        else if (n && srtp_set_keystream_parallel(s->srtp_ctx, s->media_ssrc + k,
+                    srtpctx->pool.threads)!=srtp_err_status_ok)
+            fprintf(stderr, "can't split srtp keystream generation\n");
+    }
+}
+
+/*
+ * layer whose media SSRC is ssrc, -1 if it is none of the session's
+ */
+static int srtp_layer_of(const struct srtp_session* s, uint32_t ssrc)
+{
+    for (int l=0; l<SRTP_LAYERS; l++)
+        if (ssrc==s->ssrc + l * SRTP_LAYER_SSRC_STEP)
+            return l;
+    return -1;
+}
+
+/*
+ * send the receiver another layer from its next keyframe (or cached GOP)
+ * on, the streams left behind keep their sequence numbers for later
+ */
+static void srtp_switch_layer(struct srtp_session* s, int layer)
+{
+    if (layer==s->layer)
+        return;
+    //no keystream for streams nobody is sent
+    for (int k=0; k<2; k++)
+        srtp_set_keystream_cache(s->srtp_ctx, s->media_ssrc + k, 0, 0);
+    s->layer_header[s->layer] = s->header;
+    s->header = s->layer_header[layer];
+    s->layer = layer;
+    s->media_ssrc = s->ssrc + layer * SRTP_LAYER_SSRC_STEP;
+    s->need_keyframe = 1;
+    if (srtpctx->pacing==s)
+        srtpctx->pacing = NULL;
+    //the ring is indexed by sequence numbers of the old SSRC
+    for (int i=0; i<SRTP_RTX_RING; i++)
+        s->rtx[i].len = 0;
+    //parity groups start over
+    if (s->fec)
+        s->fec->gen = srtpctx->fec_gen - 1;
+    srtp_keystream_setup(s);
+    if (!srtpctx->layers[layer].gop.valid)
+        srtp_keyframe_request(layer);
+}
+
+/*
+ * new session, to a multicast group if mcast is given
+ */
+static int srtp_prepare(const char* receiver_ip, const int receiver_port,
+        const int ssrc, const uint8_t * input_key, int send_mode, int twcc_id,
+        const struct srtp_multicast* mcast)
 {
     //rtp_sender_t snd;
     srtp_policy_t policy;
+    srtp_policy_t streams[2 * SRTP_LAYERS];//media and parity of every layer
+    srtp_policy_t inbound;
     srtp_err_status_t status;
     uint8_t key[MAX_KEY_LEN];
     struct in_addr rcvr_addr;
-
-    struct sockaddr_in local;
+    struct srtp_session session;
+    struct srtp_session* slot;
 
     printf("prepare srtp stream: %s:%d ssrc=%d, key=%s\n",
             receiver_ip, receiver_port, ssrc, input_key);
 
-    srtpctx->message.header.ssrc = htonl(ssrc);
-    srtpctx->message.header.ts = 0;
-    srtpctx->message.header.seq = 0;
-    srtpctx->message.header.m = 0;
-    srtpctx->message.header.pt = 99;//magic number
-    srtpctx->message.header.version = 2;
-    srtpctx->message.header.p = 0;
-    srtpctx->message.header.x = 0;
-    srtpctx->message.header.cc = 0;
+    //one-byte header ids, 15 is reserved
+    if (twcc_id < 0 || twcc_id > 14) {
+        fprintf(stderr, "error: bad transport-cc extension id %d\n", twcc_id);
+        return -1;
+    }
 
+    memset(&session, 0, sizeof(struct srtp_session));
+    session.ssrc = ssrc;
+    session.need_keyframe = 1;
+    session.send_mode = send_mode;
+    session.twcc_id = twcc_id;
+    session.header.ssrc = htonl(ssrc);
+    session.ts_offset = random();
+    session.header.ts = htonl(session.ts_offset);
+    session.header.seq = 0;
+    session.header.m = 0;
+    session.header.pt = 99;//magic number
+    session.header.version = 2;
+    session.header.p = 0;
+    session.header.x = twcc_id ? 1 : 0;
+    session.header.cc = 0;
+    session.media_ssrc = ssrc;
+    for (int l=0; l<SRTP_LAYERS; l++)
+    {
+        session.layer_header[l] = session.header;
+        session.layer_header[l].ssrc = htonl(ssrc + l * SRTP_LAYER_SSRC_STEP);
+    }
 
     /* set up the srtp policy and master key */
 
@@ -70,7 +423,7 @@ void prepare_srtp_sender(const char* receiver_ip, const int receiver_port,
             expected_len);
     if (pad != 0) {
         fprintf(stderr, "error: padding in base64 unexpected\n");
-        exit(1);
+        return -1;
     }
 
     /* check that hex string is the right length */
@@ -78,13 +431,13 @@ void prepare_srtp_sender(const char* receiver_ip, const int receiver_port,
         fprintf(stderr, "error: too few digits in key/salt "
                 "(should be %d digits, found %d)\n",
                 expected_len, len);
-        exit(1);
+        return -1;
     }
     if ((int)strlen(input_key) > policy.rtp.cipher_key_len * 2) {
         fprintf(stderr, "error: too many digits in key/salt "
                 "(should be %d hexadecimal digits, found %u)\n",
                 policy.rtp.cipher_key_len * 2, (unsigned)strlen(input_key));
-        exit(1);
+        return -1;
     }
 
     //printf("set master key/salt to %s/", octet_string_hex_string(key, 16));
@@ -92,94 +445,2600 @@ void prepare_srtp_sender(const char* receiver_ip, const int receiver_port,
 
 
     inet_aton(receiver_ip, &rcvr_addr);
-    srtpctx->sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    srtpctx->raddr.sin_addr = rcvr_addr;
-    srtpctx->raddr.sin_family = PF_INET;
-    srtpctx->raddr.sin_port = htons(receiver_port);
+    session.raddr.sin_addr = rcvr_addr;
+    session.raddr.sin_family = PF_INET;
+    session.raddr.sin_port = htons(receiver_port);
 
-    //bind local port
-    memset(&local, 0, sizeof(struct sockaddr_in));
-    local.sin_addr.s_addr = htonl(INADDR_ANY);
-    local.sin_port = htons(receiver_port);
-    if (bind(srtpctx->sock, (struct sockaddr *)&local,
-                sizeof(struct sockaddr_in))<0) {
-        perror("local port bind");
-        exit(1);
+    if (mcast)
+    {
+        session.sock = srtp_multicast_socket(&session.raddr, mcast);
+        session.mcast = malloc(sizeof(struct srtp_multicast));
+        if (session.sock < 0 || !session.mcast)
+        {
+            fprintf(stderr, "can't set up srtp multicast\n");
+            if (session.sock >= 0)
+                close(session.sock);
+            free(session.mcast);
+            return -1;
+        }
+        *session.mcast = *mcast;
+    }else if (session.send_mode==SRTP_SEND_TCP)
+    {
+        session.sock = srtp_tcp_connect(&session.raddr);
+        session.tcp = calloc(1, sizeof(struct srtp_tcp));
+        if (session.tcp)
+            session.tcp->buf = malloc(SRTP_TCP_QUEUE_BYTES);
+        if (session.sock < 0 || !session.tcp || !session.tcp->buf)
+        {
+            fprintf(stderr, "can't set up srtp over tcp\n");
+            if (session.sock >= 0)
+                close(session.sock);
+            srtp_tcp_free(session.tcp);
+            return -1;
+        }
+    }else
+    {
+        session.sock = srtp_udp_connect(&session.raddr);
+        if (session.sock < 0)
+            return -1;
+    }
+
+    if (session.send_mode==SRTP_SEND_GSO)
+    {
+        //probe kernel support, 0 keeps segmentation off for plain sends
+        int seg = 0;
+        if (setsockopt(session.sock, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg))<0)
+        {
+            perror("UDP_SEGMENT not supported, use sendmmsg");
+            session.send_mode = SRTP_SEND_MMSG;
+        }
     }
+    srtp_socket_options(&session);
 
+    //receiver's RTCP feedback, same master key
+    inbound = policy;
+    inbound.ssrc.type = ssrc_any_inbound;
+    inbound.ssrc.value = 0;
+    //every layer and its parity stream
+    for (int i=0; i<2 * SRTP_LAYERS; i++)
+    {
+        streams[i] = policy;
+        streams[i].ssrc.value = ssrc + i;
+        streams[i].next = i + 1 < 2 * SRTP_LAYERS ? &streams[i + 1] : &inbound;
+    }
 
-    srtp_err_status_t ret = srtp_create(&srtpctx->srtp_ctx, &policy);
+    srtp_err_status_t ret = srtp_create(&session.srtp_ctx, streams);
 
     if (ret!=srtp_err_status_ok)
     {
         fprintf(stderr,"can't create srtp session: %s\n",
                 (ret==srtp_err_status_alloc_fail)?
                 "srtp_err_status_alloc_fail":"srtp_err_status_init_fail");
-        exit(-1);
+        close(session.sock);
+        srtp_tcp_free(session.tcp);
+        free(session.mcast);
+        return -1;
+    }
+
+    session.rtx = calloc(SRTP_RTX_RING, sizeof(struct srtp_rtx_slot));
+    if (twcc_id)
+        session.twcc = calloc(1, sizeof(struct srtp_twcc));
+    if (!session.rtx || (twcc_id && !session.twcc))
+    {
+        fprintf(stderr, "can't allocate retransmission ring\n");
+        srtp_dealloc(session.srtp_ctx);
+        close(session.sock);
+        free(session.rtx);
+        free(session.twcc);
+        srtp_tcp_free(session.tcp);
+        free(session.mcast);
+        return -1;
+    }
+    session.rtx_tokens = SRTP_RTX_BURST;
+    session.rtx_refill = now_ns();
+    session.next_sr = session.rtx_refill;
+    session.last_fir_seq = -1;
+    session.rtt = -1;
+
+    pthread_mutex_lock(&srtpctx->lock);
+    slot = find_session(&session.raddr, session.ssrc);
+    if (slot)
+    {
+        printf("replace srtp stream %s:%d ssrc=%d\n",
+                receiver_ip, receiver_port, ssrc);
+        close_session(slot);
+    }else
+    {
+        for (int i=0; i<SRTP_MAX_SESSIONS && !slot; i++)
+            if (!srtpctx->sessions[i].in_use)
+                slot = &srtpctx->sessions[i];
+    }
+    if (!slot)
+    {
+        pthread_mutex_unlock(&srtpctx->lock);
+        fprintf(stderr, "too many srtp receivers\n");
+        srtp_dealloc(session.srtp_ctx);
+        close(session.sock);
+        free(session.rtx);
+        free(session.twcc);
+        srtp_tcp_free(session.tcp);
+        free(session.mcast);
+        return -1;
+    }
+    *slot = session;
+    slot->in_use = 1;
+    srtp_keystream_setup(slot);
+    srtp_uring_register(slot);
+    if (slot->twcc)
+        bwe_init(&slot->twcc->bwe, srtpctx->pacer.bitrate, srtpctx->bitrate_min,
+                srtpctx->bitrate_max ? srtpctx->bitrate_max : srtpctx->pacer.bitrate);
+    srtpctx->nsessions++;
+    //don't make the new receiver wait for the next GOP,
+    //no need for an IDR if the cached one can be replayed
+    if (!srtpctx->layers[SRTP_LAYER_MAIN].gop.valid)
+        srtp_keyframe_request(SRTP_LAYER_MAIN);
+    pthread_mutex_unlock(&srtpctx->lock);
+    return 0;
+}
+
+int prepare_srtp_sender(const char* receiver_ip, const int receiver_port,
+        const int ssrc, const uint8_t * input_key, int send_mode, int twcc_id)
+{
+    return srtp_prepare(receiver_ip, receiver_port, ssrc, input_key,
+            send_mode, twcc_id, NULL);
+}
+
+int srtp_sender_join_multicast(const char* group, const int port,
+        const int ssrc, const uint8_t* input_key, int send_mode, int ttl,
+        const char* iface, struct srtp_multicast* info)
+{
+    struct sockaddr_in gaddr;
+    struct srtp_multicast mcast;
+    struct srtp_session* s;
+
+    memset(&gaddr, 0, sizeof(struct sockaddr_in));
+    if (!inet_aton(group, &gaddr.sin_addr)
+            || !IN_MULTICAST(ntohl(gaddr.sin_addr.s_addr)))
+    {
+        fprintf(stderr, "error: %s is not a multicast group\n", group);
+        return -1;
+    }
+    gaddr.sin_port = htons(port);
+
+    //another viewer, same packets
+    pthread_mutex_lock(&srtpctx->lock);
+    s = find_session(&gaddr, ssrc);
+    if (s && s->mcast)
+    {
+        s->mcast->viewers++;
+        *info = *s->mcast;
+        srtp_keyframe_request(s->layer);
+        pthread_mutex_unlock(&srtpctx->lock);
+        printf("srtp multicast %s:%d ssrc=%d, %d viewers\n",
+                group, port, ssrc, info->viewers);
+        return 0;
+    }
+    pthread_mutex_unlock(&srtpctx->lock);
+
+    memset(&mcast, 0, sizeof(struct srtp_multicast));
+    if (iface && !inet_aton(iface, &mcast.iface))
+    {
+        fprintf(stderr, "error: bad multicast interface %s\n", iface);
+        return -1;
+    }
+    if (ttl < 0 || ttl > 255)
+    {
+        fprintf(stderr, "error: bad multicast ttl %d\n", ttl);
+        return -1;
+    }
+    if (strlen((const char*)input_key) >= SRTP_MULTICAST_KEY_MAX)
+    {
+        fprintf(stderr, "error: multicast key too long\n");
+        return -1;
     }
+    mcast.ttl = ttl;
+    mcast.viewers = 1;
+    strcpy(mcast.key, (const char*)input_key);
+    if (send_mode==SRTP_SEND_TCP)
+        send_mode = SRTP_SEND_MMSG;
+    if (srtp_prepare(group, port, ssrc, input_key, send_mode, 0, &mcast))
+        return -1;
+    *info = mcast;
+    return 0;
+}
+
+int remove_srtp_receiver(const char* receiver_ip, const int receiver_port,
+        const int ssrc)
+{
+    struct sockaddr_in raddr;
+    struct srtp_session* s;
+
+    memset(&raddr, 0, sizeof(struct sockaddr_in));
+    inet_aton(receiver_ip, &raddr.sin_addr);
+    raddr.sin_port = htons(receiver_port);
+
+    pthread_mutex_lock(&srtpctx->lock);
+    s = find_session(&raddr, ssrc);
+    //the group stays up for the other viewers
+    if (s && (!s->mcast || --s->mcast->viewers <= 0))
+        close_session(s);
+    pthread_mutex_unlock(&srtpctx->lock);
+    return s ? 0 : -1;
 }
+
+int srtp_sender_select_layer(const char* receiver_ip, const int receiver_port,
+        const int ssrc, int layer)
+{
+    struct sockaddr_in raddr;
+    struct srtp_session* s;
+
+    if (layer < 0 || layer >= SRTP_LAYERS)
+        return -1;
+    memset(&raddr, 0, sizeof(struct sockaddr_in));
+    inet_aton(receiver_ip, &raddr.sin_addr);
+    raddr.sin_port = htons(receiver_port);
+
+    pthread_mutex_lock(&srtpctx->lock);
+    s = find_session(&raddr, ssrc);
+    if (s)
+        srtp_switch_layer(s, layer);
+    pthread_mutex_unlock(&srtpctx->lock);
+    return s ? 0 : -1;
+}
+
 void destroy_srtp_sender()
 {
-    srtp_dealloc(srtpctx->srtp_ctx);
+    pthread_mutex_lock(&srtpctx->lock);
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        if (srtpctx->sessions[i].in_use)
+            close_session(&srtpctx->sessions[i]);
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+int srtp_sender_receivers()
+{
+    return srtpctx->nsessions;
+}
+
+void srtp_sender_set_batch_size(int n)
+{
+    struct srtp_send_batch* b = &srtpctx->batch;
+    if (n < 1)
+        n = 1;
+    if (n > SRTP_BATCH_MAX)
+        n = SRTP_BATCH_MAX;
+
+    pthread_mutex_lock(&srtpctx->lock);
+    if (n==b->capacity)
+    {
+        pthread_mutex_unlock(&srtpctx->lock);
+        return;
+    }
+    free(b->iov);
+    free(b->msgs);
+    free(b->runs);
+    free(b->cmsgs);
+    free(b->txtime);
+    b->iov = calloc(n, sizeof(struct iovec));
+    b->msgs = calloc(n, sizeof(struct mmsghdr));
+    b->runs = calloc(n, sizeof(struct mmsghdr));
+    b->cmsgs = calloc(n, SRTP_CMSG_SPACE);
+    b->txtime = calloc(n, sizeof(int64_t));
+    if (!b->iov || !b->msgs || !b->runs || !b->cmsgs || !b->txtime)
+    {
+        fprintf(stderr, "can't allocate srtp send batch\n");
+        exit(-1);
+    }
+    for (int i=0; i<n; i++)
+    {
+        b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    b->capacity = n;
+    b->count = 0;
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+/*
+ * control messages of a datagram, segment size of a GSO run if seg is not
+ * 0 and launch time if txtime is not 0
+ */
+static void srtp_set_cmsgs(struct msghdr* mh, uint8_t* buf, uint16_t seg,
+        int64_t txtime)
+{
+    struct cmsghdr* cm;
+    size_t len = 0;
+
+    mh->msg_control = buf;
+    mh->msg_controllen = SRTP_CMSG_SPACE;
+    cm = CMSG_FIRSTHDR(mh);
+    if (seg)
+    {
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t*)CMSG_DATA(cm) = seg;
+        len += GSO_CMSG_SPACE;
+        cm = CMSG_NXTHDR(mh, cm);
+    }
+    if (txtime)
+    {
+        uint64_t t = txtime;
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_TXTIME;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(cm), &t, sizeof(uint64_t));
+        len += TXTIME_CMSG_SPACE;
+    }
+    mh->msg_control = len ? buf : NULL;
+    mh->msg_controllen = len;
+}
+
+/*
+ * one message per queued packet starting from first
+ */
+static void srtp_set_msgs(struct srtp_session* s, struct srtp_send_batch* b,
+        int first)
+{
+    //only a multicast socket is not connected
+    for (int i=first; i<b->count; i++)
+    {
+        b->msgs[i].msg_hdr.msg_name = s->mcast ? &s->raddr : NULL;
+        b->msgs[i].msg_hdr.msg_namelen = s->mcast ? sizeof(s->raddr) : 0;
+        srtp_set_cmsgs(&b->msgs[i].msg_hdr, &b->cmsgs[i * SRTP_CMSG_SPACE],
+                0, b->txtime[i]);
+    }
+}
+
+/*
+ * send queued packets starting from first, one datagram each
+ */
+static void srtp_send_mmsg(struct srtp_session* s,
+        struct srtp_send_batch* b, int first)
+{
+    int sent = first;
+
+    srtp_set_msgs(s, b, first);
+    while (sent < b->count)
+    {
+        int ret = sendmmsg(s->sock, &b->msgs[sent], b->count - sent, 0);
+        s->send_calls++;
+        //connected socket reports ICMP port unreachable once, keep sending
+        if (ret<0 && (errno==EINTR || errno==ECONNREFUSED))
+            continue;
+        if (ret<=0)
+            break;//drop the rest, video will recover on next keyframe
+        sent += ret;
+    }
+    s->packets += sent - first;
 }
 
 /*
- * call this in camera encoder output callback
- * breakdown data into multiple segments of size RTP_PKT_BODY_SIZE
+ * group queued packets into runs of equal size (the last one may be shorter),
+ * a packet with a launch time starts a new run
+ * return number of runs in b->runs
  */
-#if 1
-int srtp_sender_callback(uint8_t* data, size_t length)
+static int srtp_gso_runs(struct srtp_session* s, struct srtp_send_batch* b)
 {
-    int offset = 0;
-    while (offset<length)
+    int nruns = 0;
+    int i = 0;
+
+    while (i < b->count)
     {
-        int body_len;
-        int pkt_len;
-        if ((offset+RTP_PKT_BODY_SIZE)<length)
+        size_t seg = b->iov[i].iov_len;
+        size_t total = seg;
+        int j = i + 1;
+        while (j < b->count && j - i < SRTP_GSO_MAX_SEGMENTS)
         {
-            body_len = RTP_PKT_BODY_SIZE;
-            offset += RTP_PKT_BODY_SIZE;
+            size_t len = b->iov[j].iov_len;
+            if (len > seg || total + len > SRTP_GSO_MAX_BYTES || b->txtime[j])
+                break;
+            total += len;
+            j++;
+            if (len < seg)
+                break;
         }
-        else
+
+        struct msghdr* mh = &b->runs[nruns].msg_hdr;
+        mh->msg_name = s->mcast ? &s->raddr : NULL;
+        mh->msg_namelen = s->mcast ? sizeof(s->raddr) : 0;
+        mh->msg_iov = &b->iov[i];
+        mh->msg_iovlen = j - i;
+        srtp_set_cmsgs(mh, &b->cmsgs[nruns * SRTP_CMSG_SPACE],
+                j - i > 1 ? seg : 0, b->txtime[i]);
+        nruns++;
+        i = j;
+    }
+    return nruns;
+}
+
+/*
+ * hand every run to the kernel as one UDP_SEGMENT super-datagram
+ * return number of packets done with, anything after that needs a plain send
+ */
+static int srtp_send_gso(struct srtp_session* s, struct srtp_send_batch* b)
+{
+    int nruns = srtp_gso_runs(s, b);
+    int done = 0;
+    int sent = 0;
+    while (sent < nruns)
+    {
+        int ret = sendmmsg(s->sock, &b->runs[sent], nruns - sent, 0);
+        s->send_calls++;
+        if (ret<0 && (errno==EINTR || errno==ECONNREFUSED))
+            continue;
+        if (ret<0 && (errno==EIO || errno==EINVAL
+                    || errno==ENOPROTOOPT || errno==EOPNOTSUPP))
+        {
+            perror("UDP GSO send rejected, fall back to sendmmsg");
+            s->send_mode = SRTP_SEND_MMSG;
+            s->packets += done;
+            return done;
+        }
+        if (ret<=0)
+            break;
+        for (int r=sent; r<sent+ret; r++)
         {
-            body_len = length - offset;
-            offset = length;
+            int segs = b->runs[r].msg_hdr.msg_iovlen;
+            if (segs > 1)
+            {
+                s->gso_sends++;
+                s->gso_segments += segs;
+            }
+            done += segs;
         }
-        pkt_len = body_len + RTP_HEADER_LEN;
-        memcpy(srtpctx->message.body, &data[offset], body_len);
+        sent += ret;
+    }
+    s->packets += done;
+    return b->count;
+}
 
-        //update header
-        struct srtp_hdr_t* hdr = &srtpctx->message.header;
-        hdr->seq = ntohs(hdr->seq) + 1;
-        hdr->seq = htons(hdr->seq);
-        hdr->ts = ntohs(hdr->ts) + 1;
-        hdr->ts = htons(hdr->ts);
+/*
+ * write as much of the TCP queue as the socket takes without blocking
+ * return -1 if the connection is broken
+ */
+static int srtp_tcp_flush(struct srtp_session* s)
+{
+    struct srtp_tcp* t = s->tcp;
 
-        srtp_protect(srtpctx->srtp_ctx, &srtpctx->message.header, &pkt_len);
-        sendto(srtpctx->sock, (void*)&srtpctx->message, pkt_len, 0,
-                &srtpctx->raddr, sizeof(struct sockaddr_in));
+    while (t->start < t->end)
+    {
+        ssize_t ret = send(s->sock, t->buf + t->start, t->end - t->start,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+        s->send_calls++;
+        if (ret<0 && errno==EINTR)
+            continue;
+        if (ret<0)
+            return (errno==EAGAIN || errno==EWOULDBLOCK) ? 0 : -1;
+        t->start += ret;
+        while (t->tail!=t->head
+                && t->pkt_end[t->tail & (SRTP_TCP_QUEUE_PKTS-1)] <= t->start)
+            t->tail++;
     }
+    t->start = 0;
+    t->end = 0;
+    return 0;
 }
 
-#else
-int srtp_sender_callback(uint8_t* data, size_t length)
+/*
+ * the receiver can't keep up, give up on every packet that has not started
+ * to go out and make it wait for the next IDR
+ */
+static void srtp_tcp_drop(struct srtp_session* s)
 {
-    int len = length;
-    if (srtpctx->message_len<length)
-        srtpctx->message = realloc(srtpctx->message ,length);
-    memcpy(srtpctx->message, data, length);
-    srtp_protect(srtpctx->srtp_ctx, srtpctx->message, &len);
-    //printf("send udp msg len=%d\n", length);
-    int ret = sendto(srtpctx->sock, srtpctx->message, length, 0,
-            &srtpctx->raddr, sizeof(struct sockaddr_in));
-    return ret;
+    struct srtp_tcp* t = s->tcp;
+    unsigned keep = t->tail;
+
+    //a packet written in part has to be finished, or the framing is lost
+    if (t->tail!=t->head
+            && t->start > t->pkt_start[t->tail & (SRTP_TCP_QUEUE_PKTS-1)])
+        keep++;
+    t->dropped_packets += t->head - keep;
+    t->end = keep==t->tail ? t->start
+        : t->pkt_end[t->tail & (SRTP_TCP_QUEUE_PKTS-1)];
+    t->head = keep;
+    t->drops++;
+    t->dropping = 1;
+    s->need_keyframe = 1;
+    srtp_keyframe_request(s->layer);
 }
-#endif
 
-void srtp_backend_init()
+/*
+ * append one packet with its RFC 4571 length to the TCP queue
+ * return -1 if the queue was dropped instead
+ */
+static int srtp_tcp_queue(struct srtp_session* s, const void* pkt, int len,
+        int64_t now)
 {
-    printf("called srtp_init()\n");
-    srtp_init();
-    srtpctx = calloc(1,sizeof(struct srtp_sender_context));
+    struct srtp_tcp* t = s->tcp;
+    unsigned slot;
+
+    if (t->tail!=t->head && now - t->pkt_queued[t->tail & (SRTP_TCP_QUEUE_PKTS-1)]
+            > srtpctx->tcp_latency)
+    {
+        srtp_tcp_drop(s);
+        return -1;
+    }
+    if (t->end + 2 + len > SRTP_TCP_QUEUE_BYTES && t->start)
+    {
+        //move the queue to the front, from the start of the oldest packet
+        size_t base = t->tail!=t->head
+            ? t->pkt_start[t->tail & (SRTP_TCP_QUEUE_PKTS-1)] : t->start;
+        memmove(t->buf, t->buf + base, t->end - base);
+        t->start -= base;
+        t->end -= base;
+        for (unsigned i=t->tail; i!=t->head; i++)
+        {
+            t->pkt_start[i & (SRTP_TCP_QUEUE_PKTS-1)] -= base;
+            t->pkt_end[i & (SRTP_TCP_QUEUE_PKTS-1)] -= base;
+        }
+    }
+    if (t->end + 2 + len > SRTP_TCP_QUEUE_BYTES
+            || t->head - t->tail==SRTP_TCP_QUEUE_PKTS)
+    {
+        srtp_tcp_drop(s);
+        return -1;
+    }
+
+    slot = t->head & (SRTP_TCP_QUEUE_PKTS-1);
+    t->pkt_start[slot] = t->end;
+    t->buf[t->end++] = len >> 8;
+    t->buf[t->end++] = len & 0xff;
+    memcpy(t->buf + t->end, pkt, len);
+    t->end += len;
+    t->pkt_end[slot] = t->end;
+    t->pkt_queued[slot] = now;
+    t->head++;
+    if (t->end - t->start > t->max_queued)
+        t->max_queued = t->end - t->start;
+    return 0;
 }
 
+/*
+ * queue a batch on a TCP session and write what the socket takes
+ */
+static void srtp_send_tcp(struct srtp_session* s, struct srtp_send_batch* b)
+{
+    struct srtp_tcp* t = s->tcp;
+    int64_t now = now_ns();
+
+    for (int i=0; i<b->count; i++)
+    {
+        if (t->dropping || srtp_tcp_queue(s, b->iov[i].iov_base,
+                    b->iov[i].iov_len, now))
+            t->dropped_packets++;
+        else
+            s->packets++;
+    }
+    srtp_tcp_flush(s);
+}
+
+/*
+ * send one packet that is not part of a batch
+ */
+static int srtp_send_one(struct srtp_session* s, const void* buf, int len)
+{
+    if (s->mcast)
+        return sendto(s->sock, buf, len, 0, (const struct sockaddr*)&s->raddr,
+                sizeof(s->raddr))==len ? 0 : -1;
+    if (s->send_mode!=SRTP_SEND_TCP)
+        return send(s->sock, buf, len, 0)==len ? 0 : -1;
+    if (srtp_tcp_queue(s, buf, len, now_ns()))
+        return -1;
+    return srtp_tcp_flush(s);
+}
+
+/*
+ * submit what is queued on the io_uring and wait until all of it is sent,
+ * the packets and ops can be reused afterwards
+ */
+static void srtp_uring_complete()
+{
+    struct srtp_uring* u = srtpctx->uring;
+    int pending;
+    int ret;
+
+    if (!u || !u->ops)
+        return;
+    pending = u->ops;
+    u->submits++;
+    ret = uring_submit_and_wait(&u->ring, pending);
+    while (pending && ret==0)
+    {
+        struct io_uring_cqe* cqe = uring_peek_cqe(&u->ring);
+        if (!cqe)
+        {
+            ret = uring_submit_and_wait(&u->ring, pending);
+            continue;
+        }
+        struct srtp_uring_op* op = &u->op[cqe->user_data];
+        if (cqe->res >= 0)
+        {
+            op->s->packets += op->packets;
+            u->packets += op->packets;
+            if (op->fixed)
+                u->fixed_packets++;
+            if (op->gso && op->packets > 1)
+            {
+                op->s->gso_sends++;
+                op->s->gso_segments += op->packets;
+            }
+        }else if (op->gso && (cqe->res==-EIO || cqe->res==-EINVAL
+                    || cqe->res==-ENOPROTOOPT || cqe->res==-EOPNOTSUPP))
+        {
+            fprintf(stderr, "UDP GSO send rejected, fall back to sendmmsg: %s\n",
+                    strerror(-cqe->res));
+            op->s->send_mode = SRTP_SEND_MMSG;
+        }else if (cqe->res!=-ECONNREFUSED)
+            u->errors++;
+        uring_cqe_seen(&u->ring);
+        pending--;
+    }
+    if (ret)
+    {
+        fprintf(stderr, "io_uring submit: %s\n", strerror(-ret));
+        u->errors++;
+    }
+    u->ops = 0;
+    u->iovs = 0;
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        if (srtpctx->sessions[i].in_use && srtpctx->sessions[i].fec)
+            srtpctx->sessions[i].fec->in_batch = 0;
+}
+
+/*
+ * queue a datagram or GSO run with a copy of its message, the batch is
+ * reused before the op completes
+ */
+static void srtp_uring_sendmsg(struct srtp_session* s, const struct msghdr* mh,
+        int gso)
+{
+    struct srtp_uring* u = srtpctx->uring;
+    struct srtp_uring_op* op = &u->op[u->ops];
+    struct io_uring_sqe* sqe = uring_get_sqe(&u->ring);
+
+    op->s = s;
+    op->packets = mh->msg_iovlen;
+    op->gso = gso;
+    op->fixed = 0;
+    op->mh = *mh;
+    op->mh.msg_iov = &u->iov[u->iovs];
+    memcpy(op->mh.msg_iov, mh->msg_iov, mh->msg_iovlen * sizeof(struct iovec));
+    u->iovs += mh->msg_iovlen;
+    if (mh->msg_controllen)
+    {
+        memcpy(op->cmsgs, mh->msg_control, mh->msg_controllen);
+        op->mh.msg_control = op->cmsgs;
+    }
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = s->sock;
+    sqe->addr = (uintptr_t)&op->mh;
+    sqe->len = 1;
+    sqe->user_data = u->ops++;
+}
+
+/*
+ * queue a datagram on a connected socket, straight from the registered
+ * retransmission ring if it is there
+ */
+static void srtp_uring_send(struct srtp_session* s, const struct iovec* iov)
+{
+    struct srtp_uring* u = srtpctx->uring;
+    struct srtp_uring_op* op = &u->op[u->ops];
+    struct io_uring_sqe* sqe = uring_get_sqe(&u->ring);
+    const uint8_t* base = iov->iov_base;
+    const uint8_t* rtx = (const uint8_t*)s->rtx;
+
+    op->s = s;
+    op->packets = 1;
+    op->gso = 0;
+    op->fixed = s->fixed && base >= rtx
+        && base < rtx + SRTP_RTX_RING * sizeof(struct srtp_rtx_slot);
+    u->iovs++;
+    //a write on a connected UDP socket is a send
+    sqe->opcode = op->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_SEND;
+    sqe->buf_index = s - srtpctx->sessions;
+    sqe->fd = s->sock;
+    sqe->addr = (uintptr_t)base;
+    sqe->len = iov->iov_len;
+    sqe->user_data = u->ops++;
+}
+
+/*
+ * queue everything in the batch, it goes out with the next
+ * srtp_uring_complete()
+ */
+static void srtp_uring_queue(struct srtp_session* s, struct srtp_send_batch* b)
+{
+    struct srtp_uring* u = srtpctx->uring;
+
+    if (u->iovs + b->count > SRTP_URING_ENTRIES)
+        srtp_uring_complete();
+    if (s->send_mode==SRTP_SEND_GSO)
+    {
+        int nruns = srtp_gso_runs(s, b);
+        for (int r=0; r<nruns; r++)
+            srtp_uring_sendmsg(s, &b->runs[r].msg_hdr, 1);
+        return;
+    }
+    srtp_set_msgs(s, b, 0);
+    for (int i=0; i<b->count; i++)
+    {
+        const struct msghdr* mh = &b->msgs[i].msg_hdr;
+        if (mh->msg_name || mh->msg_controllen)
+            srtp_uring_sendmsg(s, mh, 0);
+        else
+            srtp_uring_send(s, &b->iov[i]);
+    }
+}
+
+/*
+ * send everything queued in the batch to the receiver of session s,
+ * with io_uring it is only queued
+ */
+static void srtp_flush_batch(struct srtp_session* s, struct srtp_send_batch* b)
+{
+    if (s->send_mode==SRTP_SEND_TCP)
+        srtp_send_tcp(s, b);
+    else if (srtpctx->uring)
+        srtp_uring_queue(s, b);
+    else if (s->send_mode==SRTP_SEND_GSO)
+        srtp_send_mmsg(s, b, srtp_send_gso(s, b));
+    else
+        srtp_send_mmsg(s, b, 0);
+    b->count = 0;
+    //parity slots are reused, queued ones have to be out by then
+    if (s->fec && srtpctx->uring && s->send_mode!=SRTP_SEND_TCP)
+    {
+        if (s->fec->in_batch==SRTP_FEC_RING)
+            srtp_uring_complete();
+    }else if (s->fec)
+        s->fec->in_batch = 0;
+}
+
+static void srtp_pacer_update(struct srtp_pacer* p)
+{
+    p->rate = (p->replaying ? p->replay_multiple : p->multiple)
+        * p->bitrate / 8;
+    if (p->tokens > SRTP_PACE_BURST)
+        p->tokens = SRTP_PACE_BURST;
+}
+
+static void srtp_pacer_refill(struct srtp_pacer* p, int64_t now)
+{
+    //a full bucket is far less than a second, and the product can't overflow
+    int64_t elapsed = now - p->last_refill;
+    if (elapsed > 1000000000)
+        elapsed = 1000000000;
+    p->tokens += elapsed * (int64_t)p->rate / 1000000000;
+    if (p->tokens > SRTP_PACE_BURST)
+        p->tokens = SRTP_PACE_BURST;
+    p->last_refill = now;
+}
+
+/*
+ * wait until len bytes may go out, packets queued so far are sent first
+ * never waits past the deadline of the current buffer
+ * with SO_TXTIME the packet gets the launch time instead and the pacer's
+ * clock runs ahead of the real one until the qdisc has sent it
+ * the lock is released while waiting, return -1 if the session or what is
+ * sent to it changed meanwhile, then nothing more may be sent of it
+ */
+static int srtp_pace(struct srtp_session* s, struct srtp_send_batch* b,
+        size_t len)
+{
+    struct srtp_pacer* p = &srtpctx->pacer;
+    int64_t clock = now_ns();
+    int64_t now = clock;
+
+    if (p->rate)
+    {
+        if (now < p->last_refill)
+            now = p->last_refill;
+        srtp_pacer_refill(p, now);
+        if (p->tokens < (int64_t)len)
+        {
+            int64_t wait = (len - p->tokens) * 1000000000 / p->rate;
+            if (now + wait > p->deadline)
+            {
+                //late already, send at line rate
+                p->deadline_misses++;
+                p->tokens = len;
+            }else if (s->txtime)
+            {
+                p->waits++;
+                p->wait_ns += wait;
+                now += wait;
+                srtp_pacer_refill(p, now);
+            }else
+            {
+                struct timespec ts;
+                srtp_flush_batch(s, b);
+                srtp_uring_complete();
+                ts.tv_sec = (now + wait) / 1000000000;
+                ts.tv_nsec = (now + wait) % 1000000000;
+                //RTCP and the setters don't wait for a paced frame
+                srtpctx->pacing = s;
+                pthread_mutex_unlock(&srtpctx->lock);
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)==EINTR)
+                    ;
+                pthread_mutex_lock(&srtpctx->lock);
+                p->waits++;
+                p->wait_ns += wait;
+                if (srtpctx->pacing!=s)
+                    return -1;
+                srtpctx->pacing = NULL;
+                now = now_ns();
+                srtp_pacer_refill(p, now);
+            }
+        }
+        p->tokens -= len;
+    }
+
+    //one without a launch time would overtake those the qdisc holds
+    b->txtime[b->count] = 0;
+    if (s->txtime && now > clock)
+    {
+        b->txtime[b->count] = now;
+        p->txtime_packets++;
+        if (now - clock > p->txtime_max_lead)
+            p->txtime_max_lead = now - clock;
+    }
+
+    if (p->last_packet)
+    {
+        uint64_t gap = (now - p->last_packet) / 1000;
+        int i = 0;
+        while (i < SRTP_GAP_BUCKETS-1 && gap >= (1ULL<<i))
+            i++;
+        p->gaps[i]++;
+    }
+    p->last_packet = now;
+    return 0;
+}
+
+/*
+ * write the transport-wide sequence number extension to ext and remember
+ * the packet, size is filled in once it is protected
+ */
+static struct srtp_twcc_sent* srtp_twcc_stamp(struct srtp_session* s,
+        uint8_t* ext)
+{
+    struct srtp_twcc* tw = s->twcc;
+    uint16_t seq = tw->seq++;
+    struct srtp_twcc_sent* sent = &tw->history[seq & (SRTP_TWCC_HISTORY-1)];
+
+    ext[0] = RTP_EXT_ONE_BYTE >> 8;
+    ext[1] = RTP_EXT_ONE_BYTE & 0xff;
+    ext[2] = 0;
+    ext[3] = 1;//32 bit words
+    ext[4] = (s->twcc_id << 4) | 1;//element length minus one
+    ext[5] = seq >> 8;
+    ext[6] = seq;
+    ext[7] = 0;
+    sent->seq = seq;
+    sent->size = 0;
+    sent->sent = srtpctx->pacer.last_packet / 1000;
+    return sent;
+}
+
+static void fec_group_reset(struct srtp_fec_group* g, uint16_t sn_base)
+{
+    memset(g->payload, 0, g->max_len);
+    g->sn_base = sn_base;
+    g->count = 0;
+    g->bits[0] = 0;
+    g->bits[1] = 0;
+    g->ts = 0;
+    g->len = 0;
+    g->max_len = 0;
+    g->mask = 0;
+}
+
+/*
+ * XOR a plain (not yet protected) media packet into the group
+ */
+static void fec_group_add(struct srtp_fec_group* g, const struct rtp_msg_t* msg,
+        int payload_len)
+{
+    const uint8_t* hdr = (const uint8_t*)&msg->header;
+    uint16_t offset = ntohs(msg->header.seq) - g->sn_base;
+
+    g->bits[0] ^= hdr[0];
+    g->bits[1] ^= hdr[1];
+    g->ts ^= msg->header.ts;
+    g->len ^= payload_len;
+    for (int i=0; i<payload_len; i++)
+        g->payload[i] ^= msg->body[i];
+    if (payload_len > g->max_len)
+        g->max_len = payload_len;
+    g->mask |= 1ULL << (SRTP_FEC_MASK_BITS - 1 - offset);
+    g->count++;
+}
+
+/*
+ * protect and queue the parity packet of a group, RFC 5109 7.3 and 7.4
+ */
+static int srtp_send_fec(struct srtp_session* s, struct srtp_send_batch* b,
+        struct srtp_fec_group* g)
+{
+    struct srtp_fec* fec = s->fec;
+    struct rtp_msg_t* msg = &fec->slots[fec->next_slot++ & (SRTP_FEC_RING-1)];
+    struct srtp_twcc_sent* sent = NULL;
+    int ext_len = s->twcc ? RTP_TWCC_EXT_LEN : 0;
+    uint8_t* p = msg->body + ext_len;
+    int pkt_len = RTP_HEADER_LEN + ext_len + SRTP_FEC_HEADER_LEN
+        + SRTP_FEC_LEVEL_HEADER_LEN + g->max_len;
+
+    if (srtp_pace(s, b, pkt_len))
+        return -1;
+
+    memset(&msg->header, 0, sizeof(struct srtp_hdr_t));
+    msg->header.version = 2;
+    msg->header.pt = SRTP_FEC_PT;
+    msg->header.seq = htons(++fec->seq[s->layer]);
+    msg->header.ts = s->header.ts;
+    msg->header.ssrc = htonl(s->media_ssrc + 1);
+    //parity uses the same path, congestion control needs to see it
+    if (ext_len)
+    {
+        msg->header.x = 1;
+        sent = srtp_twcc_stamp(s, msg->body);
+    }
+
+    //E=0, L=1 (48 bit mask), recovery of P, X, CC, M, PT
+    p[0] = 0x40 | (g->bits[0] & 0x3f);
+    p[1] = g->bits[1];
+    p[2] = g->sn_base >> 8;
+    p[3] = g->sn_base;
+    memcpy(p + 4, &g->ts, 4);
+    p[8] = g->len >> 8;
+    p[9] = g->len;
+    p += SRTP_FEC_HEADER_LEN;
+    p[0] = g->max_len >> 8;
+    p[1] = g->max_len;
+    for (int i=0; i<6; i++)
+        p[2 + i] = g->mask >> (40 - 8*i);
+    p += SRTP_FEC_LEVEL_HEADER_LEN;
+    memcpy(p, g->payload, g->max_len);
+    fec_group_reset(g, 0);
+
+    if (srtp_protect(s->srtp_ctx, &msg->header, &pkt_len)!=srtp_err_status_ok)
+        return 0;
+    if (sent)
+        sent->size = pkt_len;
+    s->fec_packets++;
+    s->fec_bytes += pkt_len;
+    b->iov[b->count].iov_base = msg;
+    b->iov[b->count].iov_len = pkt_len;
+    //parity slots are reused, don't let a batch wrap over them
+    fec->in_batch++;
+    if (++b->count==b->capacity || fec->in_batch==SRTP_FEC_RING)
+        srtp_flush_batch(s, b);
+    return 0;
+}
+
+/*
+ * bring FEC state of a session in line with the configuration,
+ * return NULL if FEC is off
+ */
+static struct srtp_fec* srtp_fec_session(struct srtp_session* s)
+{
+    struct srtp_fec* fec = s->fec;
+
+    if (!srtpctx->fec_row)
+        return NULL;
+    if (fec && fec->gen==srtpctx->fec_gen)
+        return fec;
+    if (!fec)
+    {
+        fec = s->fec = calloc(1, sizeof(struct srtp_fec));
+        if (!fec)
+            return NULL;
+        srtp_keystream_setup(s);
+    }
+    fec->row = srtpctx->fec_row;
+    fec->col = srtpctx->fec_col;
+    fec->gen = srtpctx->fec_gen;
+    fec->index = 0;
+    fec_group_reset(&fec->row_group, 0);
+    for (int i=0; i<SRTP_FEC_MAX_ROW; i++)
+        fec_group_reset(&fec->col_group[i], 0);
+    return fec;
+}
+
+/*
+ * add a plain media packet to its row and column groups
+ */
+static void srtp_fec_add(struct srtp_fec* fec, const struct rtp_msg_t* msg,
+        int payload_len)
+{
+    int c = fec->index % fec->row;
+    int r = fec->index / fec->row;
+
+    if (c==0)
+        fec_group_reset(&fec->row_group, ntohs(msg->header.seq));
+    fec_group_add(&fec->row_group, msg, payload_len);
+    if (fec->col)
+    {
+        if (r==0)
+            fec_group_reset(&fec->col_group[c], ntohs(msg->header.seq));
+        fec_group_add(&fec->col_group[c], msg, payload_len);
+    }
+}
+
+/*
+ * media packet is queued, send parity of the groups it completed
+ * return -1 if the session changed while pacing
+ */
+static int srtp_fec_complete(struct srtp_session* s, struct srtp_send_batch* b)
+{
+    struct srtp_fec* fec = s->fec;
+    int c = fec->index % fec->row;
+    int r = fec->index / fec->row;
+
+    if (c==fec->row-1 && srtp_send_fec(s, b, &fec->row_group))
+        return -1;
+    if (c==fec->row-1 && (fec->col==0 || r==fec->col-1))
+    {
+        for (int i=0; fec->col && i<fec->row; i++)
+            if (srtp_send_fec(s, b, &fec->col_group[i]))
+                return -1;
+        fec->index = 0;
+    }else
+        fec->index++;
+    return 0;
+}
+
+static void* srtp_protect_worker(void* arg)
+{
+    struct srtp_protect_pool* pool = &srtpctx->pool;
+    int part = (intptr_t)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        unsigned n = 0;
+        while (pool->done_job[part]==pool->job)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        pool->done_job[part] = pool->job;
+        if (part >= pool->parts)
+            continue;
+        srtp_t ctx = pool->srtp_ctx;
+        uint32_t ssrc = pool->ssrc;
+        unsigned count = pool->count;
+        pthread_mutex_unlock(&pool->lock);
+
+        srtp_precompute_keystream_part(ctx, ssrc, count, part, &n);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->packets += n;
+        if (--pool->pending==0)
+            pthread_cond_signal(&pool->done);
+    }
+    return NULL;
+}
+
+/*
+ * runs on sender thread, generate keystream of the next count packets of
+ * ssrc on all threads of the pool and wait for it
+ */
+static void srtp_pool_fill(struct srtp_session* s, uint32_t ssrc,
+        unsigned count)
+{
+    struct srtp_protect_pool* pool = &srtpctx->pool;
+    unsigned missing = 0;
+    unsigned n = 0;
+
+    if (srtp_get_keystream_missing(s->srtp_ctx, ssrc, count, &missing)
+            !=srtp_err_status_ok || missing < SRTP_PROTECT_PARALLEL_MIN)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->srtp_ctx = s->srtp_ctx;
+    pool->ssrc = ssrc;
+    pool->count = count;
+    pool->parts = pool->threads;
+    pool->pending = pool->threads - 1;
+    pool->job++;
+    pool->jobs++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    srtp_precompute_keystream_part(s->srtp_ctx, ssrc, count, 0, &n);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->packets += n;
+    while (pool->pending)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * keystream for the next count media packets and the parity they produce
+ */
+static void srtp_parallel_keystream(struct srtp_session* s,
+        const struct srtp_fec* fec, unsigned count)
+{
+    if (srtpctx->pool.threads < 2)
+        return;
+    srtp_pool_fill(s, s->media_ssrc, count);
+    if (fec)
+        srtp_pool_fill(s, s->media_ssrc + 1, count / fec->row
+                + (fec->col ? count / fec->col : 0) + 1);
+}
+
+/*
+ * protect payloads for one receiver and send them
+ * return -1 if the rest had to be dropped, see srtp_pace()
+ */
+static int srtp_send_payloads(struct srtp_session* s,
+        const struct rtp_payload_list* list, uint32_t ts)
+{
+    struct srtp_send_batch* b = &srtpctx->batch;
+    struct srtp_hdr_t* hdr = &s->header;
+    struct srtp_fec* fec = srtp_fec_session(s);
+
+    for (int i=0; i<list->count; i++)
+    {
+        const struct rtp_payload* pl = &list->items[i];
+        const uint8_t* body = pl->body ? pl->body : pl->data;
+        struct srtp_rtx_slot* slot;
+        struct rtp_msg_t* msg;
+        struct srtp_twcc_sent* sent = NULL;
+        int ext_len = s->twcc ? RTP_TWCC_EXT_LEN : 0;
+        int pkt_len = RTP_HEADER_LEN + ext_len + pl->len;
+
+        //TCP queue gave up on the rest of the frame
+        if (s->tcp && s->tcp->dropping)
+            break;
+        //whatever the idle time did not cover, one cache full at a time
+        if (srtpctx->keystream_packets && i % srtpctx->keystream_packets==0)
+            srtp_parallel_keystream(s, fec, list->count - i);
+        if (srtp_pace(s, b, pkt_len))
+            return -1;
+
+        //update header
+        hdr->m = pl->marker;
+        hdr->seq = ntohs(hdr->seq) + 1;
+        hdr->seq = htons(hdr->seq);
+        hdr->ts = htonl(s->ts_offset + ts);
+
+        //assemble in the retransmission slot, the only copy of the payload
+        slot = &s->rtx[ntohs(hdr->seq) & (SRTP_RTX_RING-1)];
+        msg = &slot->msg;
+        msg->header = *hdr;
+        if (ext_len)
+            sent = srtp_twcc_stamp(s, msg->body);
+        memcpy(msg->body + ext_len, pl->prefix, pl->prefix_len);
+        memcpy(msg->body + ext_len + pl->prefix_len, body, pl->len - pl->prefix_len);
+        srtpctx->slot_copied_bytes += pl->len;
+        //parity covers everything after the fixed header, extension too
+        if (fec)
+            srtp_fec_add(fec, msg, ext_len + pl->len);
+
+        if (srtp_protect(s->srtp_ctx, &msg->header, &pkt_len)!=srtp_err_status_ok)
+        {
+            //parity still covers it
+            slot->len = 0;
+            if (fec && srtp_fec_complete(s, b))
+                return -1;
+            continue;
+        }
+        if (sent)
+            sent->size = pkt_len;
+        slot->seq = ntohs(hdr->seq);
+        slot->len = pkt_len;
+        slot->sent = srtpctx->pacer.last_packet;
+        s->octets += pl->len;
+        srtpctx->protected_bytes += pkt_len;
+        b->iov[b->count].iov_base = msg;
+        b->iov[b->count].iov_len = pkt_len;
+        if (++b->count==b->capacity)
+            srtp_flush_batch(s, b);
+        if (fec && srtp_fec_complete(s, b))
+            return -1;
+    }
+    srtp_flush_batch(s, b);
+    return 0;
+}
+
+/*
+ * packetizer output, keep the payload until it is sent to every receiver
+ */
+static void srtp_queue_payload(void* arg,
+        const uint8_t* prefix, size_t prefix_len,
+        const uint8_t* body, size_t body_len, int marker)
+{
+    struct rtp_payload_list* list = (struct rtp_payload_list*)arg;
+    struct rtp_payload* pl;
+
+    if (list->count==list->capacity)
+    {
+        int n = list->capacity ? list->capacity * 2 : 64;
+        struct rtp_payload* p = realloc(list->items, n * sizeof(struct rtp_payload));
+        if (!p)
+            return;
+        list->items = p;
+        list->capacity = n;
+    }
+    pl = &list->items[list->count++];
+    pl->len = prefix_len + body_len;
+    pl->marker = marker ? 1 : 0;
+    pl->prefix_len = prefix_len;
+    if (prefix_len)
+        memcpy(pl->prefix, prefix, prefix_len);
+    //packetizer's own carry/STAP buffers are reused, copy those
+    if (list->src && body >= list->src
+            && body + body_len <= list->src + list->src_len)
+    {
+        pl->body = body;
+    }else
+    {
+        memcpy(pl->data, body, body_len);
+        pl->body = NULL;
+        list->copied_bytes += body_len;
+    }
+}
+
+void srtp_sender_set_layer_header(int layer, const uint8_t* data,
+        size_t length)
+{
+    struct rtp_payload_list* header = &srtpctx->layers[layer].header;
+    struct h264_packetizer pk;
+    h264_packetizer_init(&pk, RTP_PAYLOAD_MAX);
+
+    pthread_mutex_lock(&srtpctx->lock);
+    //a paced send may be in the middle of the old one
+    srtpctx->pacing = NULL;
+    header->count = 0;
+    h264_packetize(&pk, data, length, H264_NAL_END,
+            srtp_queue_payload, header);
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_stream_header(const uint8_t* data, size_t length)
+{
+    srtp_sender_set_layer_header(SRTP_LAYER_MAIN, data, length);
+}
+
+/*
+ * timestamp for an access unit, pts is what the encoder got from the camera,
+ * without it continue from the last pts using the monotonic clock
+ */
+static void srtp_clock_au_start(struct srtp_media_clock* clock, int64_t pts,
+        int64_t queued)
+{
+    int64_t mono = queued / 1000;
+    int64_t media;
+
+    if (pts!=SRTP_PTS_UNKNOWN)
+    {
+        media = pts;
+        clock->pts_offset = pts - mono;
+        clock->have_pts = 1;
+    }else
+    {
+        media = mono + (clock->have_pts ? clock->pts_offset : 0);
+        clock->pts_missing++;
+    }
+    clock->au_ts = media * RTP_H264_CLOCK / 1000000;
+    clock->mono = queued;
+    clock->valid = 1;
+}
+
+/*
+ * media clock (without per receiver offset) at monotonic time now,
+ * paired with wall clock this is the RTP-to-NTP mapping of sender reports
+ */
+static uint32_t srtp_clock_rtp_at(const struct srtp_media_clock* clock,
+        int64_t now)
+{
+    if (!clock->valid)
+        return 0;
+    return clock->au_ts + (now - clock->mono) * RTP_H264_CLOCK / 1000000000;
+}
+
+/*
+ * send the cached GOP to a receiver that just joined
+ * a packetizer fed the same buffers from the IDR on ends up in the same
+ * state as the live one, so the live stream continues seamlessly
+ */
+static int srtp_replay_gop(struct srtp_session* s)
+{
+    struct gop_cache* gop = &srtpctx->layers[s->layer].gop;
+    struct rtp_payload_list* list = &srtpctx->replay;
+    struct srtp_pacer* p = &srtpctx->pacer;
+    int64_t deadline = p->deadline;
+    int ret = 0;
+
+    //the GOP is late by design, it gets its own deadline, live buffers
+    //queue up in the ring meanwhile
+    p->replaying = 1;
+    p->replay_multiple = srtpctx->gop_pace;
+    srtp_pacer_update(p);
+    p->deadline = now_ns() + SRTP_GOP_REPLAY_LATENCY;
+    h264_packetizer_init(&srtpctx->replay_packetizer, RTP_PAYLOAD_MAX);
+    for (int i=0; i<gop->count && !ret; i++)
+    {
+        const struct gop_entry* e = &gop->entries[i];
+        list->count = 0;
+        list->src = gop->data + e->offset;
+        list->src_len = e->length;
+        h264_packetize(&srtpctx->replay_packetizer, list->src, e->length,
+                e->flags, srtp_queue_payload, list);
+        ret = srtp_send_payloads(s, list, e->ts);
+    }
+    if (!ret)
+        gop->replays++;
+    p->replaying = 0;
+    srtp_pacer_update(p);
+    p->deadline = deadline;
+    return ret;
+}
+
+/*
+ * the receiver missed part of a buffer while the lock was released for
+ * pacing, it continues with the next keyframe if it is still there
+ */
+static void srtp_send_dropped(struct srtp_session* s)
+{
+    if (!s->in_use)
+        return;
+    s->need_keyframe = 1;
+    srtp_keyframe_request(s->layer);
+}
+
+/*
+ * runs on sender thread
+ * breakdown data into NAL units once, then protect and send to every
+ * receiver of the layer
+ */
+static void srtp_send_buffer(int layer, const uint8_t* data, size_t length,
+        int flags, int64_t pts, int64_t queued)
+{
+    struct srtp_layer* l = &srtpctx->layers[layer];
+    struct rtp_payload_list* frame = &srtpctx->frame;
+    struct srtp_media_clock* clock = &l->clock;
+    int64_t start;
+    int idr;
+
+    pthread_mutex_lock(&srtpctx->lock);
+    start = now_ns();
+    srtpctx->pacer.deadline = queued + srtpctx->pacer.latency;
+    srtpctx->pacer.last_packet = 0;
+    if (flags & SRTP_RESYNC)
+    {
+        h264_packetizer_reset(&l->packetizer);
+        clock->au_start = 1;
+    }
+    if (clock->au_start)
+        srtp_clock_au_start(clock, pts, queued);
+    idr = clock->au_start && (flags & SRTP_KEYFRAME);
+    if (clock->au_start)
+    {
+        l->au_bytes = 0;
+        l->au_keyframe = idr;
+    }
+    l->au_bytes += length;
+    clock->au_start = !!(flags & H264_AU_END);
+    frame->count = 0;
+    frame->src = data;
+    frame->src_len = length;
+    h264_packetize(&l->packetizer, data, length,
+            flags & (H264_NAL_END | H264_AU_END),
+            srtp_queue_payload, frame);
+
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+    {
+        struct srtp_session* s = &srtpctx->sessions[i];
+        if (!s->in_use || s->layer!=layer)
+            continue;
+        if (s->need_keyframe)
+        {
+            //need to send key frame first, the cached one if there is one,
+            //a TCP receiver that fell behind would fall further behind,
+            //the other buffers of an IDR carry SRTP_KEYFRAME too
+            int replay = !idr && l->gop.valid
+                && !(s->tcp && s->tcp->dropping);
+            if (!replay && !idr)
+                continue;
+            s->need_keyframe = 0;
+            if (s->tcp)
+                s->tcp->dropping = 0;
+            if (srtp_send_payloads(s, &l->header,
+                    replay ? l->gop.entries[0].ts : clock->au_ts)
+                    || (replay && srtp_replay_gop(s)))
+            {
+                srtp_send_dropped(s);
+                continue;
+            }
+        }
+        if (srtp_send_payloads(s, frame, clock->au_ts))
+            srtp_send_dropped(s);
+    }
+    //one submission for all receivers
+    srtp_uring_complete();
+    if (flags & SRTP_KEYFRAME)
+    {
+        uint64_t t = now_ns() - start;
+        srtpctx->keyframe_sends++;
+        srtpctx->keyframe_send_ns += t;
+        if (t > srtpctx->keyframe_send_max_ns)
+            srtpctx->keyframe_send_max_ns = t;
+    }
+    gop_cache_add(&l->gop, data, length,
+            flags & (H264_NAL_END | H264_AU_END), clock->au_ts, idr);
+    //socket buffers follow the largest keyframe
+    if (clock->au_start && l->au_keyframe
+            && l->au_bytes > srtpctx->keyframe_bytes)
+    {
+        srtpctx->keyframe_bytes = l->au_bytes;
+        for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        {
+            struct srtp_session* s = &srtpctx->sessions[i];
+            if (s->in_use && !s->tcp && srtpctx->sndbuf==SRTP_SNDBUF_AUTO)
+                srtp_socket_sndbuf(s);
+        }
+    }
+
+    srtpctx->payloads += frame->count;
+    srtpctx->encoded_bytes += length;
+    for (int i=0; i<frame->count; i++)
+        srtpctx->payload_bytes += frame->items[i].len;
+    srtpctx->slicer_packets += (length + RTP_PKT_BODY_SIZE - 1) / RTP_PKT_BODY_SIZE;
+    if (flags & H264_AU_END)
+    {
+        srtpctx->frames++;
+        l->frames++;
+    }
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+/*
+ * runs on sender thread while the ring is empty, generate keystream for
+ * at most SRTP_KEYSTREAM_CHUNK packets
+ * return number of packets generated, 0 if every cache is full
+ */
+static int srtp_precompute_keystream_chunk()
+{
+    unsigned budget = SRTP_KEYSTREAM_CHUNK;
+
+    pthread_mutex_lock(&srtpctx->lock);
+    for (int i=0; srtpctx->keystream_packets && i<SRTP_MAX_SESSIONS && budget; i++)
+    {
+        struct srtp_session* s = &srtpctx->sessions[i];
+        unsigned n = 0;
+        if (!s->in_use)
+            continue;
+        srtp_precompute_keystream(s->srtp_ctx, s->media_ssrc, budget, &n);
+        budget -= n;
+        s->keystream_generated += n;
+        if (s->fec && budget)
+        {
+            srtp_precompute_keystream(s->srtp_ctx, s->media_ssrc + 1, budget, &n);
+            budget -= n;
+            s->keystream_generated += n;
+        }
+    }
+    pthread_mutex_unlock(&srtpctx->lock);
+    return SRTP_KEYSTREAM_CHUNK - budget;
+}
+
+static void* srtp_sender_thread(void* arg)
+{
+    for (;;)
+    {
+        struct srtp_ring* r = NULL;
+        struct srtp_ring_entry* e = NULL;
+        unsigned tail = 0;
+        int layer = 0;
+
+        //nothing to send, get ahead on keystream before blocking
+        if (sem_trywait(&srtpctx->ready))
+        {
+            if (errno==EAGAIN && srtp_precompute_keystream_chunk())
+                continue;
+            if (sem_wait(&srtpctx->ready))
+                continue;//EINTR
+        }
+        //oldest buffer of all layers
+        for (int i=0; i<SRTP_LAYERS; i++)
+        {
+            struct srtp_ring* ri = &srtpctx->layers[i].ring;
+            unsigned t = atomic_load_explicit(&ri->tail, memory_order_relaxed);
+            struct srtp_ring_entry* ei = &ri->entries[t & (SRTP_RING_SIZE-1)];
+            if (atomic_load_explicit(&ri->head, memory_order_acquire)==t
+                    || (e && e->queued <= ei->queued))
+                continue;
+            r = ri;
+            e = ei;
+            tail = t;
+            layer = i;
+        }
+
+        srtp_send_buffer(layer, e->data, e->length, e->flags, e->pts, e->queued);
+        if (e->release)
+        {
+            e->release(e->opaque);
+            atomic_fetch_sub(&r->held_now, 1);
+        }
+        atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+int srtp_sender_layer_callback(int layer, const uint8_t* data, size_t length,
+        int flags, int64_t pts, srtp_release_fn release, void* opaque)
+{
+    struct srtp_ring* r = &srtpctx->layers[layer].ring;
+    struct srtp_ring_entry* e;
+    unsigned head, tail;
+    int au_start = r->au_start;
+    int held = 0;
+
+    r->au_start = !!(flags & H264_AU_END);
+    if (r->dropping)
+    {
+        //part of the stream is gone, resume with a complete keyframe
+        if (!au_start || !(flags & SRTP_KEYFRAME))
+        {
+            r->overflows++;
+            return 0;
+        }
+        r->dropping = 0;
+        flags |= SRTP_RESYNC;
+    }
+
+    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail==SRTP_RING_SIZE)
+    {
+        r->overflows++;
+        r->dropping = 1;
+        return 0;
+    }
+
+    e = &r->entries[head & (SRTP_RING_SIZE-1)];
+    if (release && length > SRTP_RING_COPY_MAX
+            && atomic_load(&r->held_now) < SRTP_RING_MAX_HELD)
+    {
+        atomic_fetch_add(&r->held_now, 1);
+        e->data = data;
+        e->release = release;
+        e->opaque = opaque;
+        r->held++;
+        held = 1;
+    }else
+    {
+        if (length > e->copy_size)
+        {
+            uint8_t* p = realloc(e->copy, length);
+            if (!p)
+            {
+                r->overflows++;
+                r->dropping = 1;
+                return 0;
+            }
+            e->copy = p;
+            e->copy_size = length;
+        }
+        memcpy(e->copy, data, length);
+        e->data = e->copy;
+        e->release = NULL;
+        r->copied++;
+        r->copied_bytes += length;
+    }
+    e->length = length;
+    e->flags = flags;
+    e->pts = pts;
+    e->queued = now_ns();
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    sem_post(&srtpctx->ready);
+
+    if (head + 1 - tail > r->max_occupancy)
+        r->max_occupancy = head + 1 - tail;
+    return held;
+}
+
+int srtp_sender_callback(const uint8_t* data, size_t length, int flags,
+        int64_t pts, srtp_release_fn release, void* opaque)
+{
+    return srtp_sender_layer_callback(SRTP_LAYER_MAIN, data, length, flags,
+            pts, release, opaque);
+}
+
+/*
+ * resend one packet from the retransmission ring
+ */
+static void srtp_retransmit(struct srtp_session* s, uint16_t seq, int64_t now)
+{
+    struct srtp_rtx_slot* slot = &s->rtx[seq & (SRTP_RTX_RING-1)];
+
+    s->nacks++;
+    //nothing is lost on TCP, gaps are queue drops waiting for an IDR
+    if (s->tcp || !slot->len || slot->seq!=seq)
+        return;
+    s->rtx_hits++;
+    //duplicate NACKs are common, the first resend may still be in flight
+    if (now - slot->sent < SRTP_RTX_MIN_INTERVAL || s->rtx_tokens < 1)
+    {
+        s->rtx_limited++;
+        return;
+    }
+    if (srtp_send_one(s, &slot->msg, slot->len)==0)
+    {
+        s->rtx_tokens -= 1;
+        s->rtx_packets++;
+        slot->sent = now;
+    }
+}
+
+/*
+ * generic NACK FCI, RFC 4585 6.2.1
+ * every entry is a lost packet id and a bitmask of the following 16
+ */
+static void srtp_handle_nack(struct srtp_session* s, const uint8_t* fci,
+        int len, int64_t now)
+{
+    for (; len >= 4; fci += 4, len -= 4)
+    {
+        uint16_t pid = (fci[0]<<8) | fci[1];
+        uint16_t blp = (fci[2]<<8) | fci[3];
+
+        srtp_retransmit(s, pid, now);
+        for (int i=0; i<16; i++)
+            if (blp & (1<<i))
+                srtp_retransmit(s, pid + i + 1, now);
+    }
+}
+
+static uint32_t rtcp_read32(const uint8_t* p)
+{
+    return ((uint32_t)p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+}
+
+static void rtcp_write32(uint8_t* p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/*
+ * report blocks of a receiver's SR/RR, RFC 3550 6.4.1
+ * only the block about our ssrc matters
+ */
+static void srtp_handle_report_blocks(struct srtp_session* s,
+        const uint8_t* rb, int count, int len)
+{
+    for (; count>0 && len>=24; count--, rb += 24, len -= 24)
+    {
+        if (rtcp_read32(rb)!=s->media_ssrc)
+            continue;
+        s->fraction_lost = rb[4];
+        s->cumulative_lost = (rb[5]<<16) | (rb[6]<<8) | rb[7];
+        s->jitter = rtcp_read32(rb + 12);
+
+        uint32_t lsr = rtcp_read32(rb + 16);
+        uint32_t dlsr = rtcp_read32(rb + 20);
+        if (lsr)
+        {
+            //middle 32 bits of NTP time, 1/65536 s units
+            uint32_t rtt = (uint32_t)(ntp_now() >> 16) - lsr - dlsr;
+            if (rtt < 0x80000000)
+                s->rtt = (int64_t)rtt * 1000000 / 65536;
+        }
+    }
+}
+
+/*
+ * PLI/FIR for the layer the receiver is sent asks for a keyframe,
+ * one for another layer switches to that
+ */
+static void srtp_picture_request(struct srtp_session* s, uint32_t ssrc)
+{
+    int layer = srtp_layer_of(s, ssrc);
+
+    if (layer==s->layer)
+        srtp_keyframe_request(layer);
+    else
+        srtp_switch_layer(s, layer);
+}
+
+/*
+ * FIR FCI, RFC 5104 4.3.1, every entry is a target ssrc and sequence number
+ * a repeated sequence number is a retransmitted request
+ */
+static void srtp_handle_fir(struct srtp_session* s, const uint8_t* fci, int len)
+{
+    for (; len >= 8; fci += 8, len -= 8)
+    {
+        if (srtp_layer_of(s, rtcp_read32(fci)) < 0)
+            continue;
+        s->firs++;
+        if (fci[4]==s->last_fir_seq)
+            continue;
+        s->last_fir_seq = fci[4];
+        srtp_picture_request(s, rtcp_read32(fci));
+    }
+}
+
+/*
+ * transport-cc FCI, draft-holmer-rmcat-transport-wide-cc-extensions-01 3.1
+ * base sequence number, status count, reference time, feedback count,
+ * then packet status chunks and receive deltas of the received packets
+ * return -1 if the feedback can't be used
+ */
+static int srtp_handle_twcc(struct srtp_session* s, const uint8_t* fci,
+        int len, int64_t now)
+{
+    struct srtp_twcc* tw = s->twcc;
+    const uint8_t* end = fci + len;
+    const uint8_t* p = fci + 8;
+    uint16_t base;
+    int count;
+    int32_t reference;
+    int64_t arrival;
+    int n = 0;
+
+    if (!tw || len < 8)
+        return -1;
+    base = (fci[0]<<8) | fci[1];
+    count = (fci[2]<<8) | fci[3];
+    //24 bit signed, multiples of 64 ms
+    reference = (fci[4]<<16) | (fci[5]<<8) | fci[6];
+    if (reference & 0x800000)
+        reference -= 0x1000000;
+    //can't match more than we remember anyway
+    if (count > SRTP_TWCC_HISTORY)
+        return -1;
+
+    for (int i=0; i<count; )
+    {
+        uint16_t chunk;
+        if (p + 2 > end)
+            return -1;
+        chunk = (p[0]<<8) | p[1];
+        p += 2;
+        if (!(chunk & 0x8000))
+        {
+            //run length: symbol, run
+            for (int run = chunk & 0x1fff; run>0 && i<count; run--)
+                tw->status[i++] = (chunk>>13) & 3;
+        }else if (!(chunk & 0x4000))
+        {
+            //14 one bit symbols, received with small delta or not
+            for (int b=13; b>=0 && i<count; b--)
+                tw->status[i++] = (chunk>>b) & 1;
+        }else
+        {
+            //7 two bit symbols
+            for (int b=6; b>=0 && i<count; b--)
+                tw->status[i++] = (chunk>>(2*b)) & 3;
+        }
+    }
+
+    arrival = (int64_t)reference * SRTP_TWCC_REFERENCE_US;
+    for (int i=0; i<count; i++)
+    {
+        uint16_t seq = base + i;
+        struct srtp_twcc_sent* sent = &tw->history[seq & (SRTP_TWCC_HISTORY-1)];
+        struct bwe_packet* pkt = &tw->pkts[n];
+        switch (tw->status[i])
+        {
+            case 0:
+                break;
+            case 1:
+                if (p + 1 > end)
+                    return -1;
+                arrival += p[0] * SRTP_TWCC_DELTA_US;
+                p++;
+                break;
+            case 2:
+                if (p + 2 > end)
+                    return -1;
+                arrival += (int16_t)((p[0]<<8) | p[1]) * SRTP_TWCC_DELTA_US;
+                p += 2;
+                break;
+            default:
+                return -1;
+        }
+        //not ours any more, or never protected
+        if (sent->seq!=seq || !sent->size)
+            continue;
+        pkt->send = sent->sent;
+        pkt->arrival = tw->status[i] ? arrival : BWE_LOST;
+        pkt->size = sent->size;
+        n++;
+    }
+
+    if (srtpctx->twcc_trace)
+        for (int i=0; i<n; i++)
+            fprintf(srtpctx->twcc_trace, "%lld %lld %lld %d\n",
+                    (long long)(now / 1000), (long long)tw->pkts[i].send,
+                    tw->pkts[i].arrival==BWE_LOST ? -1LL
+                    : (long long)tw->pkts[i].arrival, tw->pkts[i].size);
+    bwe_feedback(&tw->bwe, tw->pkts, n, now / 1000);
+    return 0;
+}
+
+/*
+ * walk an unprotected compound RTCP packet, return -1 if it is malformed
+ */
+static int srtp_handle_rtcp(struct srtp_session* s, const uint8_t* buf, int len)
+{
+    int64_t now = now_ns();
+
+    s->rtx_tokens += (double)(now - s->rtx_refill) * SRTP_RTX_PPS / 1000000000;
+    if (s->rtx_tokens > SRTP_RTX_BURST)
+        s->rtx_tokens = SRTP_RTX_BURST;
+    s->rtx_refill = now;
+
+    while (len >= 4)
+    {
+        int fmt = buf[0] & 0x1f;
+        int pt = buf[1];
+        int plen = (((buf[2]<<8) | buf[3]) + 1) * 4;
+
+        if ((buf[0]>>6)!=2 || plen > len)
+            return -1;
+        switch (pt)
+        {
+            case RTCP_PT_SR:
+                if (plen >= 28)
+                    srtp_handle_report_blocks(s, buf + 28, fmt, plen - 28);
+                break;
+            case RTCP_PT_RR:
+                if (plen >= 8)
+                    srtp_handle_report_blocks(s, buf + 8, fmt, plen - 8);
+                break;
+            case RTCP_PT_PSFB:
+                if (fmt==RTCP_FMT_PLI && plen >= 12
+                        && srtp_layer_of(s, rtcp_read32(buf + 8)) >= 0)
+                {
+                    s->plis++;
+                    srtp_picture_request(s, rtcp_read32(buf + 8));
+                }else if (fmt==RTCP_FMT_FIR && plen >= 12)
+                    srtp_handle_fir(s, buf + 12, plen - 12);
+                break;
+            case RTCP_PT_RTPFB:
+                //media source ssrc must be ours
+                if (fmt==RTCP_FMT_NACK && plen >= 12
+                        && rtcp_read32(buf + 8)==s->media_ssrc)
+                    srtp_handle_nack(s, buf + 12, plen - 12, now);
+                //transport-wide, media source ssrc is not meaningful
+                else if (fmt==RTCP_FMT_TWCC && plen >= 12
+                        && srtp_handle_twcc(s, buf + 12, plen - 12, now))
+                    s->twcc_errors++;
+                break;
+            default:
+                break;
+        }
+        buf += plen;
+        len -= plen;
+    }
+    return 0;
+}
+
+/*
+ * compound SR + SDES CNAME, RFC 3550 6.4.1 and 6.5
+ */
+static void srtp_send_sr(struct srtp_session* s)
+{
+    uint8_t buf[RTCP_MAX_PKT_SIZE + SRTP_MAX_TRAILER_LEN + 4];
+    uint64_t ntp = ntp_now();
+    uint32_t rtp = s->ts_offset
+        + srtp_clock_rtp_at(&srtpctx->layers[s->layer].clock, now_ns());
+    int cname_len = strlen(SRTP_RTCP_CNAME);
+    int sdes_len;
+    int len;
+
+    buf[0] = 0x80;
+    buf[1] = RTCP_PT_SR;
+    buf[2] = 0;
+    buf[3] = 6;
+    rtcp_write32(buf + 4, s->media_ssrc);
+    rtcp_write32(buf + 8, ntp >> 32);
+    rtcp_write32(buf + 12, ntp);
+    rtcp_write32(buf + 16, rtp);
+    rtcp_write32(buf + 20, s->packets - s->fec_packets);
+    rtcp_write32(buf + 24, s->octets);
+    len = 28;
+
+    //ssrc, CNAME item, null terminator, padded to 32 bits
+    sdes_len = (4 + 2 + cname_len + 1 + 3) & ~3;
+    memset(buf + len, 0, 4 + sdes_len);
+    buf[len] = 0x81;
+    buf[len + 1] = RTCP_PT_SDES;
+    buf[len + 3] = sdes_len / 4;
+    rtcp_write32(buf + len + 4, s->media_ssrc);
+    buf[len + 8] = RTCP_SDES_CNAME;
+    buf[len + 9] = cname_len;
+    memcpy(buf + len + 10, SRTP_RTCP_CNAME, cname_len);
+    len += 4 + sdes_len;
+
+    if (srtp_protect_rtcp(s->srtp_ctx, buf, &len)!=srtp_err_status_ok)
+        return;
+    if (srtp_send_one(s, buf, len)==0)
+        s->srs++;
+}
+
+/*
+ * periodic sender reports and rate limited keyframe requests
+ */
+static void srtp_rtcp_timers()
+{
+    srtp_keyframe_fn request = NULL;
+    int requested[SRTP_LAYERS] = {0};
+    srtp_bitrate_fn set_bitrate = NULL;
+    int bitrate = 0;
+    int64_t now = now_ns();
+
+    pthread_mutex_lock(&srtpctx->lock);
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+    {
+        struct srtp_session* s = &srtpctx->sessions[i];
+        if (!s->in_use || now < s->next_sr)
+            continue;
+        srtp_send_sr(s);
+        s->next_sr = now + SRTP_SR_INTERVAL;
+    }
+    //merge PLI storms into one IDR per SRTP_IDR_MIN_INTERVAL and layer
+    request = srtpctx->request_keyframe;
+    for (int i=0; request && i<SRTP_LAYERS; i++)
+    {
+        struct srtp_layer* l = &srtpctx->layers[i];
+        if (!l->keyframe_pending
+                || now - l->last_keyframe_request < SRTP_IDR_MIN_INTERVAL)
+            continue;
+        l->keyframe_pending = 0;
+        l->last_keyframe_request = now;
+        srtpctx->keyframes_requested++;
+        requested[i] = 1;
+    }
+
+    //one main encoder for everybody, the slowest receiver decides,
+    //the low layer keeps its own bitrate
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+    {
+        struct srtp_session* s = &srtpctx->sessions[i];
+        if (!s->in_use || !s->twcc || !s->twcc->bwe.feedbacks
+                || s->layer!=SRTP_LAYER_MAIN)
+            continue;
+        if (!bitrate || s->twcc->bwe.bitrate < bitrate)
+            bitrate = s->twcc->bwe.bitrate;
+    }
+    if (bitrate && srtpctx->set_bitrate)
+    {
+        int current = srtpctx->pacer.bitrate;
+        if (bitrate < current * (1 - SRTP_BITRATE_HYSTERESIS)
+                || (bitrate > current * (1 + SRTP_BITRATE_HYSTERESIS)
+                    && now - srtpctx->last_bitrate_change
+                    >= SRTP_BITRATE_INCREASE_INTERVAL))
+        {
+            srtpctx->pacer.bitrate = bitrate;
+            srtp_pacer_update(&srtpctx->pacer);
+            srtpctx->last_bitrate_change = now;
+            srtpctx->bitrate_changes++;
+            set_bitrate = srtpctx->set_bitrate;
+        }
+    }
+    pthread_mutex_unlock(&srtpctx->lock);
+
+    //talks to the encoder, don't hold the lock
+    for (int i=0; i<SRTP_LAYERS; i++)
+        if (requested[i])
+            request(i);
+    if (set_bitrate)
+        set_bitrate(bitrate);
+}
+
+/*
+ * one protected RTCP packet from a receiver
+ */
+static void srtp_rtcp_input(struct srtp_session* s, uint8_t* buf, int len)
+{
+    //RTCP packet types are 192..223, RFC 5761
+    if (len < 8 || buf[1] < 192 || buf[1] > 223)
+        return;
+    s->rtcp_packets++;
+    if (srtp_unprotect_rtcp(s->srtp_ctx, buf, &len)!=srtp_err_status_ok
+            || srtp_handle_rtcp(s, buf, len))
+        s->rtcp_errors++;
+}
+
+/*
+ * TCP session is writable or readable, continue the queue and
+ * handle the RFC 4571 framed RTCP that came in
+ * return -1 once the connection is gone
+ */
+static int srtp_tcp_input(struct srtp_session* s, int revents)
+{
+    struct srtp_tcp* t = s->tcp;
+
+    if ((revents & POLLOUT) && srtp_tcp_flush(s))
+        return -1;
+    if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+        return 0;
+    for (;;)
+    {
+        size_t off = 0;
+        ssize_t ret = recv(s->sock, t->rx + t->rx_len,
+                sizeof(t->rx) - t->rx_len, MSG_DONTWAIT);
+        if (ret<0 && errno==EINTR)
+            continue;
+        if (ret<0)
+            return (errno==EAGAIN || errno==EWOULDBLOCK) ? 0 : -1;
+        if (ret==0)
+            return -1;
+        t->rx_len += ret;
+        while (t->rx_len - off >= 2)
+        {
+            size_t len = (t->rx[off]<<8) | t->rx[off + 1];
+            if (len > RTCP_MAX_PKT_SIZE)
+                return -1;//framing is lost
+            if (t->rx_len - off - 2 < len)
+                break;
+            srtp_rtcp_input(s, t->rx + off + 2, len);
+            off += 2 + len;
+        }
+        memmove(t->rx, t->rx + off, t->rx_len - off);
+        t->rx_len -= off;
+    }
+}
+
+/*
+ * receivers send RTCP to the port we cast from (rtcp-mux),
+ * poll every session socket and handle feedback
+ */
+static void* srtp_rtcp_thread(void* arg)
+{
+    struct pollfd fds[SRTP_MAX_SESSIONS];
+    int tcp[SRTP_MAX_SESSIONS];
+    uint8_t buf[RTCP_MAX_PKT_SIZE + SRTP_MAX_TRAILER_LEN];
+
+    for (;;)
+    {
+        int n = 0;
+
+        pthread_mutex_lock(&srtpctx->lock);
+        for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        {
+            struct srtp_session* s = &srtpctx->sessions[i];
+            if (!s->in_use)
+                continue;
+            fds[n].fd = s->sock;
+            fds[n].events = POLLIN;
+            //queue the sender thread could not write yet
+            if (s->tcp && s->tcp->start < s->tcp->end)
+                fds[n].events |= POLLOUT;
+            tcp[n] = !!s->tcp;
+            n++;
+        }
+        pthread_mutex_unlock(&srtpctx->lock);
+
+        //timeout picks up added receivers and drives the timers
+        int ready = poll(fds, n, 100);
+
+        for (int i=0; ready>0 && i<n; i++)
+        {
+            int len = 0;
+            if (!fds[i].revents || (!tcp[i] && !(fds[i].revents & POLLIN)))
+                continue;
+            //a TCP stream is read under the lock, it belongs to the session
+            if (!tcp[i])
+                len = recv(fds[i].fd, buf, RTCP_MAX_PKT_SIZE, MSG_DONTWAIT);
+
+            //socket may have been closed and reused meanwhile, look up by fd
+            pthread_mutex_lock(&srtpctx->lock);
+            for (int j=0; j<SRTP_MAX_SESSIONS; j++)
+            {
+                struct srtp_session* s = &srtpctx->sessions[j];
+                if (!s->in_use || s->sock!=fds[i].fd || !s->tcp!=!tcp[i])
+                    continue;
+                if (!s->tcp)
+                    srtp_rtcp_input(s, buf, len);
+                else if (srtp_tcp_input(s, fds[i].revents))
+                {
+                    printf("srtp receiver %s:%d closed the connection\n",
+                            inet_ntoa(s->raddr.sin_addr),
+                            ntohs(s->raddr.sin_port));
+                    close_session(s);
+                }
+                break;
+            }
+            pthread_mutex_unlock(&srtpctx->lock);
+        }
+        srtp_rtcp_timers();
+    }
+    return NULL;
+}
+
+void srtp_sender_get_stats(struct srtp_sender_stats* stats)
+{
+    //GOP numbers are the main layer's, the rest adds up all layers
+    struct gop_cache* gop = &srtpctx->layers[SRTP_LAYER_MAIN].gop;
+    uint64_t ring_copied_bytes = 0;
+    uint64_t gop_copied_bytes = 0;
+
+    memset(stats, 0, sizeof(struct srtp_sender_stats));
+    pthread_mutex_lock(&srtpctx->lock);
+    stats->frames = srtpctx->frames;
+    stats->payloads = srtpctx->payloads;
+    stats->slicer_packets = srtpctx->slicer_packets;
+    stats->batch_size = srtpctx->batch.capacity;
+    for (int i=0; i<SRTP_LAYERS; i++)
+    {
+        struct srtp_layer* l = &srtpctx->layers[i];
+        struct srtp_layer_stats* ls = &stats->layers[i];
+        struct h264_packetizer* pk = &l->packetizer;
+        struct srtp_ring* r = &l->ring;
+
+        stats->nals += pk->nals;
+        stats->single_pkts += pk->single_pkts;
+        stats->fu_pkts += pk->fu_pkts;
+        stats->stap_pkts += pk->stap_pkts;
+        stats->ring_occupancy += atomic_load(&r->head) - atomic_load(&r->tail);
+        if (r->max_occupancy > stats->ring_max_occupancy)
+            stats->ring_max_occupancy = r->max_occupancy;
+        stats->ring_copied += r->copied;
+        stats->ring_held += r->held;
+        stats->ring_overflows += r->overflows;
+        stats->pts_missing += l->clock.pts_missing;
+        ring_copied_bytes += r->copied_bytes;
+        gop_copied_bytes += l->gop.copied_bytes;
+        ls->frames = l->frames;
+        ls->ring_overflows = r->overflows;
+        ls->gop_valid = l->gop.valid;
+        ls->gop_bytes = l->gop.used;
+    }
+    stats->ring_copied_bytes = ring_copied_bytes;
+    stats->keyframe_requests = srtpctx->keyframe_requests;
+    stats->keyframes_requested = srtpctx->keyframes_requested;
+    stats->gop_valid = gop->valid;
+    stats->gop_buffers = gop->count;
+    stats->gop_bytes = gop->used;
+    stats->gop_peak_bytes = gop->peak_bytes;
+    stats->gop_memory = gop_cache_memory(gop);
+    stats->gop_max_bytes = gop->max_bytes;
+    stats->gop_overflows = gop->overflows;
+    stats->gop_replays = gop->replays;
+    stats->encoded_bytes = srtpctx->encoded_bytes;
+    stats->copied_bytes = ring_copied_bytes
+        + srtpctx->frame.copied_bytes + srtpctx->slot_copied_bytes
+        + gop_copied_bytes + srtpctx->replay.copied_bytes;
+    //ring copy, payload copy, copy into send slot, copy into rtx ring
+    stats->legacy_copied_bytes = ring_copied_bytes
+        + srtpctx->payload_bytes + srtpctx->slot_copied_bytes
+        + srtpctx->protected_bytes;
+    stats->fec_row = srtpctx->fec_row;
+    stats->fec_col = srtpctx->fec_col;
+    stats->bitrate = srtpctx->pacer.bitrate;
+    stats->bitrate_changes = srtpctx->bitrate_changes;
+    stats->pace_rate = srtpctx->pacer.rate * 8;
+    stats->pace_latency = srtpctx->pacer.latency / 1000;
+    stats->pace_waits = srtpctx->pacer.waits;
+    stats->pace_wait_us = srtpctx->pacer.wait_ns / 1000;
+    stats->pace_deadline_misses = srtpctx->pacer.deadline_misses;
+    stats->txtime = srtpctx->pacer.txtime;
+    stats->txtime_packets = srtpctx->pacer.txtime_packets;
+    stats->txtime_max_lead_us = srtpctx->pacer.txtime_max_lead / 1000;
+    stats->dscp = srtpctx->dscp;
+    stats->priority = srtpctx->priority;
+    stats->sndbuf = srtpctx->sndbuf;
+    stats->keyframe_bytes = srtpctx->keyframe_bytes;
+    if (srtpctx->uring)
+    {
+        struct srtp_uring* u = srtpctx->uring;
+        stats->uring = u->mode;
+        stats->uring_submits = u->submits;
+        stats->uring_enters = u->ring.enters;
+        stats->uring_wakeups = u->ring.wakeups;
+        stats->uring_packets = u->packets;
+        stats->uring_fixed_packets = u->fixed_packets;
+        stats->uring_errors = u->errors;
+    }
+    memcpy(stats->gaps, srtpctx->pacer.gaps, sizeof(stats->gaps));
+    stats->cipher = srtp_get_profile_cipher_description(srtp_profile_aes128_cm_sha1_80);
+    stats->sha1 = srtp_get_sha1_impl_description();
+    stats->keystream_packets = srtpctx->keystream_packets;
+    pthread_mutex_lock(&srtpctx->pool.lock);
+    stats->protect_threads = srtpctx->pool.threads;
+    stats->parallel_jobs = srtpctx->pool.jobs;
+    stats->parallel_packets = srtpctx->pool.packets;
+    pthread_mutex_unlock(&srtpctx->pool.lock);
+    stats->keyframe_sends = srtpctx->keyframe_sends;
+    if (srtpctx->keyframe_sends)
+        stats->keyframe_send_us = srtpctx->keyframe_send_ns
+            / srtpctx->keyframe_sends / 1000;
+    stats->keyframe_send_max_us = srtpctx->keyframe_send_max_ns / 1000;
+    stats->packets = srtpctx->closed_packets;
+    stats->send_calls = srtpctx->closed_send_calls;
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+    {
+        struct srtp_session* s = &srtpctx->sessions[i];
+        struct srtp_session_stats* ss;
+        if (!s->in_use)
+            continue;
+        ss = &stats->sessions[stats->nsessions++];
+        ss->raddr = s->raddr;
+        ss->ssrc = s->ssrc;
+        ss->layer = s->layer;
+        ss->media_ssrc = s->media_ssrc;
+        stats->layers[s->layer].receivers++;
+        ss->send_mode = s->send_mode;
+        ss->need_keyframe = s->need_keyframe;
+        ss->packets = s->packets;
+        ss->send_calls = s->send_calls;
+        ss->gso_sends = s->gso_sends;
+        ss->gso_segments = s->gso_segments;
+        ss->fec_packets = s->fec_packets;
+        ss->fec_bytes = s->fec_bytes;
+        ss->srs = s->srs;
+        ss->plis = s->plis;
+        ss->firs = s->firs;
+        ss->fraction_lost = s->fraction_lost;
+        ss->cumulative_lost = s->cumulative_lost;
+        ss->jitter = s->jitter;
+        ss->rtt = s->rtt;
+        ss->rtcp_packets = s->rtcp_packets;
+        ss->rtcp_errors = s->rtcp_errors;
+        ss->nacks = s->nacks;
+        ss->rtx_hits = s->rtx_hits;
+        ss->rtx_packets = s->rtx_packets;
+        ss->rtx_limited = s->rtx_limited;
+        ss->twcc_id = s->twcc_id;
+        ss->twcc_errors = s->twcc_errors;
+        if (s->twcc)
+        {
+            struct bwe* e = &s->twcc->bwe;
+            ss->bwe_bitrate = e->feedbacks ? e->bitrate : 0;
+            ss->acked_bitrate = e->acked_bitrate;
+            ss->bwe_usage = e->usage;
+            ss->bwe_loss = e->loss;
+            ss->twcc_feedbacks = e->feedbacks;
+            ss->twcc_packets = e->packets;
+            ss->twcc_lost = e->lost;
+            ss->bwe_overuses = e->overuses;
+            ss->bwe_decreases = e->decreases;
+        }
+        ss->keystream_generated = s->keystream_generated;
+        if (s->tcp)
+        {
+            ss->tcp_queued = s->tcp->end - s->tcp->start;
+            ss->tcp_max_queued = s->tcp->max_queued;
+            ss->tcp_drops = s->tcp->drops;
+            ss->tcp_dropped_packets = s->tcp->dropped_packets;
+        }
+        if (s->mcast)
+        {
+            ss->multicast = 1;
+            ss->mcast_ttl = s->mcast->ttl;
+            ss->mcast_viewers = s->mcast->viewers;
+        }
+        ss->sndbuf = s->sndbuf;
+        ss->txtime = s->txtime;
+        ss->fixed = s->fixed;
+        for (int k=0; k<2; k++)
+        {
+            uint64_t hits, misses;
+            if (srtp_get_keystream_stats(s->srtp_ctx, s->media_ssrc + k,
+                        &hits, &misses)==srtp_err_status_ok)
+            {
+                ss->keystream_hits += hits;
+                ss->keystream_misses += misses;
+            }
+        }
+        stats->packets += s->packets;
+        stats->send_calls += s->send_calls;
+    }
+    pthread_mutex_unlock(&srtpctx->lock);
+    stats->send_calls += stats->uring_enters;
+    //failed and retried calls send nothing, they may outnumber the packets
+    stats->syscalls_saved = stats->packets > stats->send_calls
+        ? stats->packets - stats->send_calls : 0;
+}
+
+void srtp_sender_set_keyframe_callback(srtp_keyframe_fn fn)
+{
+    pthread_mutex_lock(&srtpctx->lock);
+    srtpctx->request_keyframe = fn;
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_fec(int row, int col)
+{
+    if (row < 0)
+        row = 0;
+    if (row > SRTP_FEC_MAX_ROW)
+        row = SRTP_FEC_MAX_ROW;
+    if (col < 0 || row==0)
+        col = 0;
+    if (col && row * col > SRTP_FEC_MASK_BITS)
+        col = SRTP_FEC_MASK_BITS / row;
+
+    pthread_mutex_lock(&srtpctx->lock);
+    srtpctx->fec_row = row;
+    srtpctx->fec_col = col;
+    srtpctx->fec_gen++;
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_bitrate(int bitrate)
+{
+    pthread_mutex_lock(&srtpctx->lock);
+    srtpctx->pacer.bitrate = bitrate;
+    srtp_pacer_update(&srtpctx->pacer);
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_bitrate_callback(srtp_bitrate_fn fn,
+        int min_bitrate, int max_bitrate)
+{
+    pthread_mutex_lock(&srtpctx->lock);
+    srtpctx->set_bitrate = fn;
+    srtpctx->bitrate_min = min_bitrate;
+    srtpctx->bitrate_max = max_bitrate;
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+    {
+        struct srtp_session* s = &srtpctx->sessions[i];
+        if (!s->in_use || !s->twcc)
+            continue;
+        s->twcc->bwe.min_bitrate = min_bitrate;
+        s->twcc->bwe.max_bitrate = max_bitrate;
+    }
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+int srtp_sender_set_twcc_trace(const char* path)
+{
+    FILE* f = NULL;
+
+    if (path)
+    {
+        f = fopen(path, "a");
+        if (!f)
+        {
+            perror("open transport-cc trace");
+            return -1;
+        }
+        //line buffered, a trace cut short by a crash is still useful
+        setvbuf(f, NULL, _IOLBF, 0);
+    }
+    pthread_mutex_lock(&srtpctx->lock);
+    if (srtpctx->twcc_trace)
+        fclose(srtpctx->twcc_trace);
+    srtpctx->twcc_trace = f;
+    pthread_mutex_unlock(&srtpctx->lock);
+    return 0;
+}
+
+void srtp_sender_set_gop_cache(size_t max_bytes, double pace)
+{
+    pthread_mutex_lock(&srtpctx->lock);
+    //a paced replay may be in the middle of the cache
+    srtpctx->pacing = NULL;
+    for (int i=0; i<SRTP_LAYERS; i++)
+        gop_cache_set_limit(&srtpctx->layers[i].gop, max_bytes);
+    if (pace >= 0)
+        srtpctx->gop_pace = pace;
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_keystream_precompute(int packets)
+{
+    if (packets < 0)
+        packets = 0;
+
+    pthread_mutex_lock(&srtpctx->lock);
+    srtpctx->keystream_packets = packets;
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        if (srtpctx->sessions[i].in_use)
+            srtp_keystream_setup(&srtpctx->sessions[i]);
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_protect_threads(int threads)
+{
+    struct srtp_protect_pool* pool = &srtpctx->pool;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > SRTP_PROTECT_THREADS_MAX)
+        threads = SRTP_PROTECT_THREADS_MAX;
+
+    //no job runs while we hold the sender lock
+    pthread_mutex_lock(&srtpctx->lock);
+    pthread_mutex_lock(&pool->lock);
+    for (; pool->started < threads - 1; pool->started++)
+    {
+        int part = pool->started + 1;
+        pool->done_job[part] = pool->job;
+        if (pthread_create(&pool->workers[part], NULL, srtp_protect_worker,
+                    (void*)(intptr_t)part))
+        {
+            fprintf(stderr, "can't start srtp protect thread\n");
+            break;
+        }
+    }
+    //workers are never stopped, fewer parts leave the rest idle
+    pool->threads = threads < pool->started + 1 ? threads : pool->started + 1;
+    pthread_mutex_unlock(&pool->lock);
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        if (srtpctx->sessions[i].in_use)
+            srtp_keystream_setup(&srtpctx->sessions[i]);
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_tcp_latency(int latency)
+{
+    pthread_mutex_lock(&srtpctx->lock);
+    srtpctx->tcp_latency = (int64_t)latency * 1000;
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_pacing(double multiple, int latency)
+{
+    pthread_mutex_lock(&srtpctx->lock);
+    if (multiple >= 0)
+        srtpctx->pacer.multiple = multiple;
+    if (latency >= 0)
+        srtpctx->pacer.latency = (int64_t)latency * 1000;
+    srtp_pacer_update(&srtpctx->pacer);
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_txtime(int enable)
+{
+    pthread_mutex_lock(&srtpctx->lock);
+    srtpctx->pacer.txtime = !!enable;
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        if (srtpctx->sessions[i].in_use)
+            srtp_socket_options(&srtpctx->sessions[i]);
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+void srtp_sender_set_socket_options(int dscp, int priority, int sndbuf)
+{
+    pthread_mutex_lock(&srtpctx->lock);
+    if (dscp >= 0)
+        srtpctx->dscp = dscp & 0x3f;
+    if (priority >= 0)
+        srtpctx->priority = priority;
+    if (sndbuf >= 0)
+        srtpctx->sndbuf = sndbuf;
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        if (srtpctx->sessions[i].in_use)
+            srtp_socket_options(&srtpctx->sessions[i]);
+    pthread_mutex_unlock(&srtpctx->lock);
+}
+
+static void srtp_uring_stop()
+{
+    struct srtp_uring* u = srtpctx->uring;
+
+    if (!u)
+        return;
+    srtp_uring_complete();
+    srtpctx->uring = NULL;
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        srtpctx->sessions[i].fixed = 0;
+    uring_exit(&u->ring);
+    free(u);
+}
+
+static int srtp_uring_start(int mode)
+{
+    struct srtp_uring* u = calloc(1, sizeof(struct srtp_uring));
+    int ret;
+
+    if (!u)
+        return -1;
+    //the kernel thread would take turns with the sender thread
+    if (mode==SRTP_URING_SQPOLL && sysconf(_SC_NPROCESSORS_ONLN) < 2)
+    {
+        fprintf(stderr, "io_uring SQPOLL needs a second CPU, submit with syscalls\n");
+        mode = SRTP_URING_ON;
+    }
+    ret = uring_init(&u->ring, SRTP_URING_ENTRIES,
+            mode==SRTP_URING_SQPOLL ? SRTP_URING_SQPOLL_IDLE : 0);
+    if (ret==0 && (!uring_op_supported(&u->ring, IORING_OP_SENDMSG)
+                || !uring_op_supported(&u->ring, IORING_OP_SEND)))
+    {
+        uring_exit(&u->ring);
+        ret = -EOPNOTSUPP;
+    }
+    if (ret)
+    {
+        fprintf(stderr, "io_uring not available, keep sendmmsg: %s\n",
+                strerror(-ret));
+        free(u);
+        return -1;
+    }
+    u->mode = mode;
+    //without registered buffers packets are sent from user memory
+    u->fixed = uring_op_supported(&u->ring, IORING_OP_WRITE_FIXED)
+        && uring_register_buffers(&u->ring, SRTP_MAX_SESSIONS)==0;
+    srtpctx->uring = u;
+    for (int i=0; i<SRTP_MAX_SESSIONS; i++)
+        if (srtpctx->sessions[i].in_use)
+            srtp_uring_register(&srtpctx->sessions[i]);
+    return 0;
+}
+
+int srtp_sender_set_uring(int mode)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&srtpctx->lock);
+    if (!srtpctx->uring || srtpctx->uring->mode!=mode)
+    {
+        srtp_uring_stop();
+        if (mode!=SRTP_URING_OFF)
+            ret = srtp_uring_start(mode);
+    }
+    pthread_mutex_unlock(&srtpctx->lock);
+    return ret;
+}
+
+int srtp_sender_set_aes(int impl)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&srtpctx->lock);
+    if (srtp_set_aes_icm_impl(impl)!=srtp_err_status_ok)
+    {
+        fprintf(stderr, "can't use AES implementation %d\n", impl);
+        ret = -1;
+    }
+    pthread_mutex_unlock(&srtpctx->lock);
+    return ret;
+}
+
+void srtp_backend_init()
+{
+    printf("called srtp_init()\n");
+    srtp_init();
+    printf("srtp cipher: %s\n", srtp_get_profile_cipher_description(srtp_profile_aes128_cm_sha1_80));
+    printf("srtp sha1: %s\n", srtp_get_sha1_impl_description());
+    srtpctx = calloc(1,sizeof(struct srtp_sender_context));
+    pthread_mutex_init(&srtpctx->lock, NULL);
+    srtp_sender_set_batch_size(SRTP_BATCH_DEFAULT);
+    srtpctx->pacer.tokens = SRTP_PACE_BURST;
+    srtpctx->dscp = SRTP_DSCP_DEFAULT;
+    srtpctx->priority = SRTP_PRIORITY_DEFAULT;
+    srtpctx->sndbuf = SRTP_SNDBUF_AUTO;
+    srtpctx->bitrate_min = SRTP_BITRATE_MIN_DEFAULT;
+    for (int i=0; i<SRTP_LAYERS; i++)
+    {
+        struct srtp_layer* l = &srtpctx->layers[i];
+        h264_packetizer_init(&l->packetizer, RTP_PAYLOAD_MAX);
+        l->clock.au_start = 1;
+        gop_cache_init(&l->gop, GOP_CACHE_MAX_BYTES);
+        l->ring.au_start = 1;
+    }
+    srtpctx->gop_pace = SRTP_GOP_PACE_DEFAULT;
+    srtpctx->keystream_packets = SRTP_KEYSTREAM_PACKETS_DEFAULT;
+    srtpctx->tcp_latency = (int64_t)SRTP_TCP_LATENCY_DEFAULT * 1000;
+    pthread_mutex_init(&srtpctx->pool.lock, NULL);
+    pthread_cond_init(&srtpctx->pool.start, NULL);
+    pthread_cond_init(&srtpctx->pool.done, NULL);
+    srtpctx->pool.threads = 1;
+    srandom(time(NULL) ^ getpid());
+    srtp_sender_set_pacing(SRTP_PACE_MULTIPLE_DEFAULT, SRTP_PACE_LATENCY_DEFAULT);
+    srtp_sender_set_protect_threads(SRTP_PROTECT_THREADS_DEFAULT);
+
+    sem_init(&srtpctx->ready, 0, 0);
+    if (pthread_create(&srtpctx->thread, NULL, srtp_sender_thread, NULL))
+    {
+        fprintf(stderr, "can't start srtp sender thread\n");
+        exit(-1);
+    }
+    if (pthread_create(&srtpctx->rtcp_thread, NULL, srtp_rtcp_thread, NULL))
+    {
+        fprintf(stderr, "can't start rtcp thread\n");
+        exit(-1);
+    }
+}
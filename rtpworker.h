@@ -4,15 +4,61 @@
 #include <stdint.h>
 #include <srtp.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <sys/types.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/ip.h> 
 
+#include "rtp_h264.h"
+#include "bwe.h"
+#include "gop_cache.h"
+#include "uring.h"
+
 #define RTP_PKT_SIZE 1378
 #define RTP_HEADER_LEN 12
 #define RTP_PKT_BODY_SIZE (RTP_PKT_SIZE-RTP_HEADER_LEN)
 
+/*
+ * transport-wide sequence number, RFC 8285 one-byte header extension
+ * (draft-holmer-rmcat-transport-wide-cc-extensions-01)
+ * profile, length, id/len, 16 bit sequence number, one byte padding
+ */
+#define RTP_EXT_ONE_BYTE 0xBEDE
+#define RTP_TWCC_EXT_LEN 8
+//largest payload the packetizer may emit, leaves room for the extension
+#define RTP_PAYLOAD_MAX (RTP_PKT_BODY_SIZE-RTP_TWCC_EXT_LEN)
+
+/*
+ * last protected packets of a session, for NACK (RFC 4585) retransmission
+ * slot is sequence number modulo SRTP_RTX_RING
+ * packets are assembled and sent from here too
+ */
+#define SRTP_RTX_RING 512//must be power of 2
+#define SRTP_RTX_PPS 200//max retransmitted packets per second
+#define SRTP_RTX_BURST 50
+#define SRTP_RTX_MIN_INTERVAL 20000000//ns before the same packet is resent
+
+//number of packets handed to one sendmmsg()
+#define SRTP_BATCH_DEFAULT 32
+//a batch must not wrap around the retransmission ring
+#define SRTP_BATCH_MAX (UIO_MAXIOV < SRTP_RTX_RING ? UIO_MAXIOV : SRTP_RTX_RING)
+
+//UDP generic segmentation offload limits
+#define SRTP_GSO_MAX_SEGMENTS 64
+#define SRTP_GSO_MAX_BYTES (0xffff - 20 - 8)
+
+enum srtp_send_mode {
+    SRTP_SEND_MMSG = 0,//one datagram per mmsghdr
+    SRTP_SEND_GSO,//equal sized packets as one UDP_SEGMENT super-datagram
+    SRTP_SEND_TCP,//RFC 4571 framing over a TCP connection to the receiver
+};
+
 struct srtp_hdr_t{
     unsigned char cc : 4;      /* CSRC count             */
     unsigned char x : 1;       /* header extension flag  */
@@ -27,25 +73,862 @@ struct srtp_hdr_t{
 
 struct rtp_msg_t {
     struct srtp_hdr_t header;
-    uint8_t body[RTP_PKT_BODY_SIZE];
+    uint8_t body[RTP_PKT_BODY_SIZE + SRTP_MAX_TRAILER_LEN];//room for auth tag
 };
 
-struct srtp_sender_context{
-    struct rtp_msg_t message;//the message we want to send
+/*
+ * payload is copied once, right behind the header, and protected in place
+ */
+struct srtp_rtx_slot {
+    uint16_t seq;
+    uint16_t len;//0 if empty
+    int64_t sent;//ns, last (re)transmission
+    struct rtp_msg_t msg;
+};
+
+/*
+ * protected packets waiting to be sent with one sendmmsg()
+ * iov points into retransmission ring slots
+ */
+//control messages of one datagram or GSO run, segment size and launch time
+#define SRTP_CMSG_SPACE (CMSG_SPACE(sizeof(uint16_t)) + CMSG_SPACE(sizeof(uint64_t)))
+
+struct srtp_send_batch {
+    struct iovec* iov;
+    struct mmsghdr* msgs;
+    int capacity;
+    int count;
+
+    //GSO mode, one mmsghdr per run of equal sized packets
+    struct mmsghdr* runs;
+    uint8_t* cmsgs;
+    int64_t* txtime;//ns, launch time per packet, 0 sends right away
+};
+
+//RTP clock rate for video, RFC 6184
+#define RTP_H264_CLOCK 90000
+//no presentation time for this buffer
+#define SRTP_PTS_UNKNOWN INT64_MIN
+
+/*
+ * media clock of the stream, shared by all receivers
+ * every receiver adds its own random offset
+ */
+struct srtp_media_clock {
+    int au_start;//next buffer starts an access unit
+    uint32_t au_ts;//90 kHz timestamp of the current access unit
+    int have_pts;
+    int64_t pts_offset;//us, pts minus monotonic time, used if pts is missing
+
+    //RTP-to-NTP mapping, au_ts belongs to monotonic time mono
+    int valid;
+    int64_t mono;//ns
+
+    uint64_t pts_missing;//access units timed by the fallback clock
+};
+
+/*
+ * simulcast, a second encode at lower resolution goes out as another SSRC
+ * of the same srtp session: layer l is ssrc + l * SRTP_LAYER_SSRC_STEP,
+ * its parity stream the SSRC after that
+ * a receiver is sent the layer it selected and nothing is protected or
+ * sent for it from the other one, it switches with
+ * srtp_sender_select_layer() or by sending PLI/FIR for the other SSRC
+ */
+#define SRTP_LAYERS 2
+#define SRTP_LAYER_MAIN 0
+#define SRTP_LAYER_LOW 1
+#define SRTP_LAYER_SSRC_STEP 2
+
+//max number of receivers we cast to at the same time
+#define SRTP_MAX_SESSIONS 8
+
+/*
+ * srtp_sender_callback() flag, buffer belongs to a keyframe
+ * used on top of H264_NAL_END/H264_AU_END
+ */
+#define SRTP_KEYFRAME 0x10
+
+/*
+ * RTP payloads of one encoder buffer, packetized once
+ * and then protected separately for every receiver
+ * a payload is FU/NAL header prefix and body, body refers to the
+ * encoder buffer if it can, otherwise it is copied to data
+ */
+struct rtp_payload {
+    uint16_t len;
+    uint8_t marker;
+    uint8_t prefix_len;
+    uint8_t prefix[H264_FU_HEADER_LEN];
+    const uint8_t* body;//NULL if the body is in data
+    uint8_t data[RTP_PKT_BODY_SIZE];
+};
+
+struct rtp_payload_list {
+    struct rtp_payload* items;
+    int count;
+    int capacity;
+    //bytes in [src, src+src_len) stay valid while the list is sent
+    const uint8_t* src;
+    size_t src_len;
+    uint64_t copied_bytes;
+};
+
+#define RTCP_PT_SR 200
+#define RTCP_PT_RR 201
+#define RTCP_PT_SDES 202
+#define RTCP_PT_RTPFB 205
+#define RTCP_PT_PSFB 206
+#define RTCP_FMT_NACK 1
+#define RTCP_FMT_PLI 1
+#define RTCP_FMT_FIR 4
+#define RTCP_FMT_TWCC 15
+#define RTCP_SDES_CNAME 1
+#define RTCP_MAX_PKT_SIZE 1500
+
+#define SRTP_RTCP_CNAME "camera_daemon"
+#define SRTP_SR_INTERVAL 1000000000//ns between sender reports
+//PLI/FIR within this many ns of the last IDR are merged into the next one
+#define SRTP_IDR_MIN_INTERVAL 500000000
+
+//ask the encoder of a layer for an IDR frame
+typedef void (*srtp_keyframe_fn)(int layer);
+
+/*
+ * transport-wide congestion control, every packet (media and parity) gets
+ * the next transport-wide sequence number, transport-cc feedback
+ * (RTPFB FMT 15) reports arrival times, see bwe.h for the estimator
+ * the encoder runs at the lowest estimate of all receivers
+ */
+#define SRTP_TWCC_ID_DEFAULT 5//extension id, 0 turns it off
+#define SRTP_TWCC_HISTORY 2048//sent packets remembered, power of 2
+#define SRTP_TWCC_DELTA_US 250
+#define SRTP_TWCC_REFERENCE_US 64000
+#define SRTP_BITRATE_MIN_DEFAULT 100000
+//decreases are passed to the encoder right away, increases at most this often
+#define SRTP_BITRATE_INCREASE_INTERVAL 1000000000//ns
+//smaller changes are not worth reconfiguring the encoder
+#define SRTP_BITRATE_HYSTERESIS 0.05
+
+//set encoder bitrate, bits per second
+typedef void (*srtp_bitrate_fn)(int bitrate);
+
+struct srtp_twcc_sent {
+    uint16_t seq;
+    uint16_t size;//protected packet, 0 if not sent
+    int64_t sent;//us, CLOCK_MONOTONIC
+};
+
+struct srtp_twcc {
+    uint16_t seq;//next transport-wide sequence number
+    struct srtp_twcc_sent history[SRTP_TWCC_HISTORY];
+    //scratch space for one feedback message
+    uint8_t status[SRTP_TWCC_HISTORY];
+    struct bwe_packet pkts[SRTP_TWCC_HISTORY];
+    struct bwe bwe;
+};
+
+/*
+ * XOR parity FEC, RFC 5109 (ULPFEC) packets with the 48 bit mask
+ * media packets are laid out row by row in blocks of row x col packets,
+ * every row and every column of the block gets one parity packet
+ * parity goes out as its own stream: ssrc + 1, own sequence numbers,
+ * payload type SRTP_FEC_PT
+ */
+#define SRTP_FEC_PT 100
+#define SRTP_FEC_MASK_BITS 48
+#define SRTP_FEC_MAX_ROW SRTP_FEC_MASK_BITS//packets per row
+#define SRTP_FEC_HEADER_LEN 10
+#define SRTP_FEC_LEVEL_HEADER_LEN 8//protection length, 48 bit mask
+#define SRTP_FEC_RING 64//parity packets queued in one batch at most
+
+struct srtp_fec_group {
+    uint16_t sn_base;
+    int count;
+    uint8_t bits[2];//P, X, CC, M, PT recovery
+    uint32_t ts;//network order
+    uint16_t len;//length recovery
+    uint16_t max_len;//protection length
+    uint64_t mask;
+    uint8_t payload[RTP_PKT_BODY_SIZE];
+};
+
+struct srtp_fec {
+    int row;//packets per row, 0 is off
+    int col;//rows per block, 0 is row parity only
+    int gen;//configuration this state was built for
+    int index;//position of next media packet in the block
+    struct srtp_fec_group row_group;
+    struct srtp_fec_group col_group[SRTP_FEC_MAX_ROW];
+    struct rtp_msg_t slots[SRTP_FEC_RING];
+    int next_slot;
+    int in_batch;
+    uint16_t seq[SRTP_LAYERS];//every layer has its own parity stream
+};
+
+/*
+ * RTP over TCP, RFC 4571, every packet is prefixed with its 16 bit length
+ * for receivers behind firewalls that drop UDP
+ * writes never block, packets wait in a bounded queue; once the oldest one
+ * has waited longer than the latency budget (or the queue is full) all of
+ * them that have not started to go out are dropped, the receiver gets
+ * nothing more until the next IDR
+ * RTCP comes back on the same connection, framed the same way
+ */
+#define SRTP_TCP_QUEUE_BYTES (512*1024)
+#define SRTP_TCP_QUEUE_PKTS 1024//must be power of 2
+#define SRTP_TCP_LATENCY_DEFAULT 500000//us
+#define SRTP_TCP_CONNECT_TIMEOUT 3//s
+#define SRTP_TCP_SNDBUF (128*1024)//socket send buffer, keeps most of the queue ours
+
+struct srtp_tcp {
+    uint8_t* buf;//SRTP_TCP_QUEUE_BYTES of framed packets
+    size_t start;//first byte not written yet
+    size_t end;//one past the last queued byte
+    //queued packets, oldest at tail
+    size_t pkt_start[SRTP_TCP_QUEUE_PKTS];
+    size_t pkt_end[SRTP_TCP_QUEUE_PKTS];
+    int64_t pkt_queued[SRTP_TCP_QUEUE_PKTS];//ns
+    unsigned head;
+    unsigned tail;
+    int dropping;//until the next keyframe
+
+    //RTCP from the receiver, incomplete frame at the end
+    uint8_t rx[2 + RTCP_MAX_PKT_SIZE];
+    size_t rx_len;
+
+    //statistics
+    size_t max_queued;//bytes
+    uint64_t drops;
+    uint64_t dropped_packets;
+};
+
+/*
+ * multicast output: the session sends to a group address instead of a
+ * receiver, every viewer of the group shares its key, srtp context and
+ * packets, so protecting and sending cost the same for any number of
+ * viewers
+ * the socket is not connected, feedback comes from the viewers' own
+ * addresses; transport-cc stays off since one estimate can't fit them all
+ */
+#define SRTP_MULTICAST_TTL_DEFAULT 1//stay on the LAN
+#define SRTP_MULTICAST_KEY_MAX 64//base64 master key and salt
+
+struct srtp_multicast {
+    struct in_addr iface;//outgoing interface, INADDR_ANY for the routing table
+    int ttl;
+    int viewers;//joins not removed yet
+    char key[SRTP_MULTICAST_KEY_MAX];//group key, handed to every viewer
+};
+
+/*
+ * one receiver, keyed by address and ssrc
+ */
+struct srtp_session {
+    int in_use;
+    int need_keyframe;//joined mid GOP, wait for next keyframe
+    struct sockaddr_in raddr;//receiver's address, need to parser from receiver_ip and receiver_port
+    uint32_t ssrc;
+    int layer;//the one sent, SRTP_LAYER_MAIN at first
+    uint32_t media_ssrc;//of that layer
+    struct srtp_hdr_t header;//header template, carries seq/ts of last packet
+    struct srtp_hdr_t layer_header[SRTP_LAYERS];//where the other layers left off
+    uint32_t ts_offset;//random, RFC 3550 5.1
     srtp_t srtp_ctx;
     int sock;
-    struct sockaddr_in raddr;//receiver's address, need to parser from receiver_ip and receiver_port
+    int send_mode;
+    int txtime;//SO_TXTIME is on, paced packets carry a launch time
+    int sndbuf;//bytes, as reported by the kernel
+    int fixed;//rtx ring is an io_uring registered buffer
+
+    struct srtp_rtx_slot* rtx;
+    double rtx_tokens;
+    int64_t rtx_refill;//ns
+
+    struct srtp_fec* fec;//allocated when FEC is turned on
+    struct srtp_tcp* tcp;//SRTP_SEND_TCP only
+    struct srtp_multicast* mcast;//multicast group only
+    int twcc_id;//header extension id, 0 if off
+    struct srtp_twcc* twcc;
+
+    int64_t next_sr;//ns
+    int last_fir_seq;//-1 before first FIR
+
+    //from receiver reports
+    int fraction_lost;//out of 256
+    int cumulative_lost;
+    uint32_t jitter;//timestamp units
+    int64_t rtt;//us, -1 unknown
+
+    //statistics
+    uint64_t packets;
+    uint64_t octets;//payload octets, for sender reports
+    uint64_t send_calls;//number of sendmmsg() syscalls
+    uint64_t gso_sends;//super-datagrams handed to the kernel
+    uint64_t gso_segments;
+    uint64_t fec_packets;
+    uint64_t fec_bytes;
+    uint64_t srs;//sender reports sent
+    uint64_t plis;
+    uint64_t firs;
+    uint64_t rtcp_packets;//compound packets received
+    uint64_t rtcp_errors;//failed to unprotect or parse
+    uint64_t nacks;//sequence numbers requested
+    uint64_t rtx_hits;//requested packet still in the ring
+    uint64_t rtx_packets;//retransmitted
+    uint64_t rtx_limited;//not resent, rate limit or resent recently
+    uint64_t twcc_errors;//feedback we could not use
+    uint64_t keystream_generated;//packets of keystream precomputed
+};
+
+/*
+ * encoder buffers queued between the camera callback (producer)
+ * and the sender thread (consumer)
+ */
+#define SRTP_RING_SIZE 64//must be power of 2
+//smaller buffers are copied into the ring, larger ones are held until sent
+#define SRTP_RING_COPY_MAX (32*1024)
+//max number of buffers held at the same time, the rest is copied
+#define SRTP_RING_MAX_HELD 2
+//internal flag, ring overflowed before this buffer, restart the packetizer
+#define SRTP_RESYNC 0x20
+
+//give a held buffer back to its owner
+typedef void (*srtp_release_fn)(void* opaque);
+
+struct srtp_ring_entry {
+    const uint8_t* data;
+    size_t length;
+    int flags;
+    int64_t pts;//us, SRTP_PTS_UNKNOWN if missing
+    int64_t queued;//ns, CLOCK_MONOTONIC
+    srtp_release_fn release;//NULL if data points to copy
+    void* opaque;
+    uint8_t* copy;//owned by this slot, grows as needed
+    size_t copy_size;
+};
+
+struct srtp_ring {
+    struct srtp_ring_entry entries[SRTP_RING_SIZE];
+    atomic_uint head;//only written by producer
+    atomic_uint tail;//only written by consumer
+    atomic_int held_now;//buffers not released yet
+
+    //producer side state
+    int dropping;//overflowed, skip until next keyframe access unit
+    int au_start;//next buffer starts an access unit
+
+    //statistics, written by producer
+    unsigned max_occupancy;
+    uint64_t copied;
+    uint64_t copied_bytes;
+    uint64_t held;
+    uint64_t overflows;//buffers dropped
 };
 
-void prepare_srtp_sender(const char* receiver_ip, const int receiver_port,
-        const int ssrc, const uint8_t * input_key);
+/*
+ * token bucket pacer, spreads large frames (keyframes) over time
+ * instead of sending them at line rate
+ */
+#define SRTP_PACE_MULTIPLE_DEFAULT 4.0//pacing rate = multiple * encoder bitrate
+#define SRTP_PACE_LATENCY_DEFAULT 30000//us a buffer may be delayed by pacing
+#define SRTP_PACE_BURST (8*RTP_PKT_SIZE)//bucket depth in bytes
+
+/*
+ * media socket options, DSCP AF41 for interactive video (RFC 8837) and a
+ * priority that lands in the video access category of WMM
+ * the send buffer grows to the largest keyframe seen, with SO_TXTIME the
+ * packets the qdisc holds back are charged to it
+ */
+#define SRTP_DSCP_DEFAULT 34
+#define SRTP_PRIORITY_DEFAULT 5
+#define SRTP_SNDBUF_AUTO 0
+
+//GOP replay to a joining receiver, 0 sends it at line rate
+#define SRTP_GOP_PACE_DEFAULT 0.0
+//a paced replay may take this long, the rest goes at line rate
+#define SRTP_GOP_REPLAY_LATENCY 200000000//ns
+
+/*
+ * keystream of the next packets of every stream is generated while the
+ * sender thread waits for the encoder, srtp_protect() then only XORs it
+ * room for a full media packet or parity packet each
+ */
+#define SRTP_KEYSTREAM_PACKETS_DEFAULT 128
+#define SRTP_KEYSTREAM_LEN (RTP_PKT_BODY_SIZE + SRTP_FEC_HEADER_LEN \
+        + SRTP_FEC_LEVEL_HEADER_LEN)
+//packets generated at a time, a buffer arriving meanwhile waits that long
+#define SRTP_KEYSTREAM_CHUNK 8
+
+/*
+ * keystream of a large frame is generated by several threads at once,
+ * the sender thread does part 0 and workers the others, srtp_protect()
+ * stays on the sender thread and only XORs, packets leave in order
+ */
+#define SRTP_PROTECT_THREADS_DEFAULT 1//including the sender thread
+#define SRTP_PROTECT_THREADS_MAX 4
+//fewer missing packets of keystream are not worth waking the workers for
+#define SRTP_PROTECT_PARALLEL_MIN 16
+
+/*
+ * io_uring transmit engine for UDP receivers, packets of a frame for all
+ * receivers are queued and submitted at once, with SQPOLL a kernel thread
+ * picks them up and the sender thread makes no syscalls while it keeps up
+ * the retransmission ring of every receiver, where packets are assembled,
+ * is a registered buffer
+ * everything queued completes before the next frame, so packet memory and
+ * ops are never in flight twice
+ */
+enum srtp_uring_mode {
+    SRTP_URING_OFF = 0,//sendmmsg()
+    SRTP_URING_ON,
+    SRTP_URING_SQPOLL,
+};
+
+#define SRTP_URING_ENTRIES SRTP_BATCH_MAX//a full batch fits at least
+#define SRTP_URING_SQPOLL_IDLE 1000//ms the kernel thread polls for work
+
+struct srtp_uring_op {
+    struct srtp_session* s;
+    int packets;
+    int gso;
+    int fixed;
+    struct msghdr mh;
+    uint8_t cmsgs[SRTP_CMSG_SPACE];
+};
+
+struct srtp_uring {
+    struct uring ring;
+    int mode;
+    int fixed;//registered buffer table, one entry per session slot
+    int ops;//queued, the op index is the user data
+    int iovs;
+    struct iovec iov[SRTP_URING_ENTRIES];
+    struct srtp_uring_op op[SRTP_URING_ENTRIES];
+
+    //statistics
+    uint64_t submits;
+    uint64_t packets;
+    uint64_t fixed_packets;//sent from registered buffers
+    uint64_t errors;
+};
+
+struct srtp_protect_pool {
+    int threads;//1 generates keystream on the sender thread only
+    int started;//workers running, never stopped
+    pthread_t workers[SRTP_PROTECT_THREADS_MAX];
+    unsigned done_job[SRTP_PROTECT_THREADS_MAX];//last job of every part
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned job;//incremented for every job
+    int pending;//workers not done with the job
+
+    //the job, next count packets of ssrc split in parts
+    srtp_t srtp_ctx;
+    uint32_t ssrc;
+    unsigned count;
+    int parts;
+
+    //statistics
+    uint64_t jobs;
+    uint64_t packets;
+};
+
+//inter-packet gap histogram, bucket i counts gaps below (1<<i) us
+#define SRTP_GAP_BUCKETS 16
+
+struct srtp_pacer {
+    int bitrate;//encoder bitrate, bits per second
+    double multiple;//0 disables pacing
+    uint64_t rate;//bytes per second
+    int64_t latency;//ns
+    int64_t tokens;//bytes
+    int64_t last_refill;//ns
+    int64_t deadline;//ns, current buffer must be out by then
+    int64_t last_packet;//ns, 0 at start of a buffer
+    int txtime;//launch times instead of sleeps where the socket takes them
+    int replaying;//a GOP replay is paced with replay_multiple
+    double replay_multiple;
+
+    //statistics
+    uint64_t waits;
+    uint64_t wait_ns;
+    uint64_t txtime_packets;//handed to the kernel with a launch time
+    int64_t txtime_max_lead;//ns, furthest launch time ahead of the clock
+    uint64_t deadline_misses;//gave up pacing to meet the deadline
+    uint64_t gaps[SRTP_GAP_BUCKETS];
+};
+
+/*
+ * one encode of the camera with its own producer, packetizer, media clock
+ * and GOP
+ */
+struct srtp_layer {
+    struct srtp_ring ring;
+    struct h264_packetizer packetizer;
+    struct rtp_payload_list header;//SPS/PPS, sent before the first keyframe
+    struct srtp_media_clock clock;
+    //buffers since the last IDR, ts is the access unit's media clock
+    struct gop_cache gop;
+    int keyframe_pending;//PLI/FIR or new receiver, not passed to encoder yet
+    int64_t last_keyframe_request;//ns
+    uint64_t frames;
+    size_t au_bytes;//access unit so far
+    int au_keyframe;
+};
+
+struct srtp_sender_context{
+    pthread_mutex_t lock;//protects sessions
+    struct srtp_session sessions[SRTP_MAX_SESSIONS];
+    int nsessions;
+
+    struct srtp_layer layers[SRTP_LAYERS];
+    sem_t ready;//number of ring entries to be sent, all layers
+    struct rtp_payload_list frame;//payloads of the current encoder buffer
+    struct srtp_send_batch batch;//shared by all sessions
+    //sender thread waits for the pacer without the lock, whatever takes
+    //away what it sends clears it
+    struct srtp_session* pacing;
+    pthread_t thread;
+    pthread_t rtcp_thread;
+
+    srtp_keyframe_fn request_keyframe;
+    srtp_bitrate_fn set_bitrate;
+    int bitrate_min;
+    int bitrate_max;
+    int64_t last_bitrate_change;//ns
+    uint64_t bitrate_changes;
+    FILE* twcc_trace;//feedback is dumped here if set, see bwe.h
+    uint64_t keyframe_requests;
+    uint64_t keyframes_requested;//calls to request_keyframe
+    struct srtp_pacer pacer;
+
+    double gop_pace;//pacing multiple for the replay, 0 is a burst
+    struct h264_packetizer replay_packetizer;
+    struct rtp_payload_list replay;
+
+    //FEC configuration, applied to every receiver
+    int fec_row;
+    int fec_col;
+    int fec_gen;
+
+    int keystream_packets;//precomputed per stream, 0 is off
+    int64_t tcp_latency;//ns a packet may wait in a TCP queue
+    int dscp;
+    int priority;
+    int sndbuf;//bytes, SRTP_SNDBUF_AUTO follows keyframe_bytes
+    size_t keyframe_bytes;//largest keyframe, all layers
+    struct srtp_uring* uring;//NULL sends with sendmmsg()
+    struct srtp_protect_pool pool;
+
+    //statistics
+    uint64_t frames;
+    uint64_t payloads;
+    uint64_t slicer_packets;//packets the fixed size slicer would have sent
+    uint64_t closed_packets;//sent by receivers that are gone
+    uint64_t closed_send_calls;
+    uint64_t encoded_bytes;//handed to us by the encoder
+    uint64_t payload_bytes;//packetizer output
+    uint64_t slot_copied_bytes;//payload copied into session slots
+    uint64_t protected_bytes;//packets after srtp_protect()
+    uint64_t keyframe_sends;//keyframe buffers protected and sent
+    uint64_t keyframe_send_ns;//total time spent on them
+    uint64_t keyframe_send_max_ns;
+};
+
+struct srtp_session_stats {
+    struct sockaddr_in raddr;
+    uint32_t ssrc;
+    int layer;
+    uint32_t media_ssrc;
+    int send_mode;
+    int need_keyframe;
+    uint64_t packets;
+    uint64_t send_calls;
+    uint64_t gso_sends;
+    uint64_t gso_segments;
+    uint64_t fec_packets;
+    uint64_t fec_bytes;
+    uint64_t srs;
+    uint64_t plis;
+    uint64_t firs;
+    int fraction_lost;
+    int cumulative_lost;
+    uint32_t jitter;
+    int64_t rtt;
+    uint64_t rtcp_packets;
+    uint64_t rtcp_errors;
+    uint64_t nacks;
+    uint64_t rtx_hits;
+    uint64_t rtx_packets;
+    uint64_t rtx_limited;
+    int twcc_id;
+    int bwe_bitrate;//0 before the first feedback
+    int acked_bitrate;
+    int bwe_usage;
+    double bwe_loss;
+    uint64_t twcc_feedbacks;
+    uint64_t twcc_packets;
+    uint64_t twcc_lost;
+    uint64_t twcc_errors;
+    uint64_t bwe_overuses;
+    uint64_t bwe_decreases;
+    uint64_t keystream_generated;
+    uint64_t keystream_hits;//packets protected with precomputed keystream
+    uint64_t keystream_misses;
+    size_t tcp_queued;//bytes waiting in the TCP queue
+    size_t tcp_max_queued;
+    uint64_t tcp_drops;//times the queue was dropped
+    uint64_t tcp_dropped_packets;
+    int multicast;
+    int mcast_ttl;
+    int mcast_viewers;
+    int sndbuf;
+    int txtime;
+    int fixed;
+};
+
+struct srtp_layer_stats {
+    uint64_t frames;
+    int receivers;//sessions sent this layer
+    uint64_t ring_overflows;
+    int gop_valid;
+    size_t gop_bytes;
+};
+
+struct srtp_sender_stats {
+    uint64_t frames;
+    uint64_t payloads;//packets produced by the packetizer
+    uint64_t packets;//packets sent, summed over receivers
+    uint64_t slicer_packets;
+    uint64_t nals;
+    uint64_t single_pkts;
+    uint64_t fu_pkts;
+    uint64_t stap_pkts;
+    uint64_t send_calls;
+    uint64_t syscalls_saved;//compared to one sendto() per packet, at least 0
+    int batch_size;
+    unsigned ring_occupancy;
+    unsigned ring_max_occupancy;
+    uint64_t ring_copied;
+    uint64_t ring_copied_bytes;
+    uint64_t ring_held;
+    uint64_t ring_overflows;
+    uint64_t keyframe_requests;
+    uint64_t keyframes_requested;
+    uint64_t pts_missing;
+    int gop_valid;
+    int gop_buffers;
+    size_t gop_bytes;
+    size_t gop_peak_bytes;
+    size_t gop_memory;
+    size_t gop_max_bytes;
+    uint64_t gop_overflows;
+    uint64_t gop_replays;
+    uint64_t encoded_bytes;
+    uint64_t copied_bytes;//all memcpy() of stream data
+    uint64_t legacy_copied_bytes;//what the copy per stage design would copy
+    int fec_row;
+    int fec_col;
+    int bitrate;//encoder target
+    uint64_t bitrate_changes;
+    uint64_t pace_rate;//bits per second, 0 if pacing is off
+    int pace_latency;//us
+    uint64_t pace_waits;
+    uint64_t pace_wait_us;
+    uint64_t pace_deadline_misses;
+    int txtime;
+    uint64_t txtime_packets;
+    uint64_t txtime_max_lead_us;
+    int dscp;
+    int priority;
+    int sndbuf;//configured, SRTP_SNDBUF_AUTO
+    size_t keyframe_bytes;
+    int uring;//srtp_uring_mode
+    uint64_t uring_submits;
+    uint64_t uring_enters;//io_uring_enter() calls
+    uint64_t uring_wakeups;
+    uint64_t uring_packets;
+    uint64_t uring_fixed_packets;
+    uint64_t uring_errors;
+    uint64_t gaps[SRTP_GAP_BUCKETS];
+    const char* cipher;//AES-ICM implementation libsrtp picked for this CPU
+    const char* sha1;//SHA-1 implementation of HMAC-SHA1
+    int keystream_packets;
+    int protect_threads;
+    uint64_t parallel_jobs;//frames whose keystream was split over threads
+    uint64_t parallel_packets;
+    uint64_t keyframe_sends;
+    uint64_t keyframe_send_us;//average, packetize, protect and send
+    uint64_t keyframe_send_max_us;
+    struct srtp_layer_stats layers[SRTP_LAYERS];
+    int nsessions;
+    struct srtp_session_stats sessions[SRTP_MAX_SESSIONS];
+};
+
+/*
+ * add a receiver, a session with the same address and ssrc is replaced
+ * send_mode is SRTP_SEND_MMSG or SRTP_SEND_GSO, GSO falls back to
+ * SRTP_SEND_MMSG when the kernel rejects UDP_SEGMENT
+ * SRTP_SEND_TCP connects to the receiver's address instead
+ * twcc_id is the transport-wide sequence number extension id, 1..14,
+ * 0 sends no extension and leaves the receiver out of bitrate control
+ * return 0 on success
+ */
+int prepare_srtp_sender(const char* receiver_ip, const int receiver_port,
+        const int ssrc, const uint8_t * input_key, int send_mode, int twcc_id);
+/*
+ * add a viewer of multicast group:port, the first one creates the stream
+ * with input_key, later ones only count and get the key in use, the
+ * encoder is asked for a keyframe since the cached GOP can't be replayed
+ * to everyone
+ * ttl and iface (local IPv4 address, NULL for default) apply to a new
+ * group, send_mode is SRTP_SEND_MMSG or SRTP_SEND_GSO
+ * the group parameters are copied to info
+ * return 0 on success
+ */
+int srtp_sender_join_multicast(const char* group, const int port,
+        const int ssrc, const uint8_t* input_key, int send_mode, int ttl,
+        const char* iface, struct srtp_multicast* info);
+/*
+ * a multicast group is closed once its last viewer is removed
+ */
+int remove_srtp_receiver(const char* receiver_ip, const int receiver_port,
+        const int ssrc);
+/*
+ * remove all receivers
+ */
 void destroy_srtp_sender();
+int srtp_sender_receivers();
+
+/*
+ * send the receiver layer SRTP_LAYER_MAIN or SRTP_LAYER_LOW from its next
+ * keyframe on, return 0 on success
+ */
+int srtp_sender_select_layer(const char* receiver_ip, const int receiver_port,
+        const int ssrc, int layer);
+
+/*
+ * SPS/PPS from the encoder, sent to every receiver before its first keyframe
+ */
+void srtp_sender_set_stream_header(const uint8_t* data, size_t length);
+void srtp_sender_set_layer_header(int layer, const uint8_t* data,
+        size_t length);
+
+/*
+ * call this in camera encoder output callback, only from one thread
+ * keep calling it without receivers, the GOP cache needs the stream
+ * flags are H264_NAL_END/H264_AU_END, see rtp_h264.h, and SRTP_KEYFRAME
+ * pts is presentation time in us or SRTP_PTS_UNKNOWN, the RTP timestamp
+ * of an access unit comes from the pts of its first buffer
+ * the buffer is queued for the sender thread, small buffers are copied,
+ * large ones are kept if release is given
+ * return 1 if data is held, release(opaque) is called once it is sent,
+ * 0 if the caller can reuse the buffer right away
+ */
+int srtp_sender_callback(const uint8_t* data, size_t length, int flags,
+        int64_t pts, srtp_release_fn release, void* opaque);
+/*
+ * same for the encoder of another layer, each layer may have its own
+ * producer thread
+ */
+int srtp_sender_layer_callback(int layer, const uint8_t* data, size_t length,
+        int flags, int64_t pts, srtp_release_fn release, void* opaque);
+
+void srtp_sender_get_stats(struct srtp_sender_stats* stats);
+
+/*
+ * max number of packets sent by one syscall, 1..SRTP_BATCH_MAX
+ */
+void srtp_sender_set_batch_size(int n);
+
+/*
+ * called from RTCP thread on PLI/FIR or when a receiver joins,
+ * at most once per SRTP_IDR_MIN_INTERVAL and layer
+ */
+void srtp_sender_set_keyframe_callback(srtp_keyframe_fn fn);
+
+/*
+ * one parity packet per row of row media packets, and with col > 0 one per
+ * column of blocks of col rows, row 0 turns FEC off
+ * row * col is limited to SRTP_FEC_MASK_BITS
+ */
+void srtp_sender_set_fec(int row, int col);
 
 /*
- * call this in camera encoder output callback
+ * encoder bitrate in bits per second, pacing rate follows it
+ * with TWCC feedback this is only the starting point
  */
-int srtp_sender_callback(uint8_t* data, size_t length);
+void srtp_sender_set_bitrate(int bitrate);
+/*
+ * called from RTCP thread when the estimate moves the encoder bitrate,
+ * within [min_bitrate, max_bitrate]
+ */
+void srtp_sender_set_bitrate_callback(srtp_bitrate_fn fn,
+        int min_bitrate, int max_bitrate);
+/*
+ * append every transport-cc feedback to path in the bwe.h trace format,
+ * NULL stops tracing, return 0 on success
+ */
+int srtp_sender_set_twcc_trace(const char* path);
+/*
+ * a receiver that joins mid GOP is sent the cached GOP, max_bytes 0
+ * disables the cache and the receiver waits for a keyframe
+ * the replay is paced at pace * bitrate, 0 sends it as one burst,
+ * a negative value keeps the current setting
+ */
+void srtp_sender_set_gop_cache(size_t max_bytes, double pace);
+/*
+ * keystream for the next packets packets of every stream is generated
+ * while no encoder buffer is waiting, 0 turns precomputation off
+ */
+void srtp_sender_set_keystream_precompute(int packets);
+/*
+ * keystream the idle time did not cover is generated by threads threads
+ * at once, 1 keeps it on the sender thread, needs keystream precompute
+ */
+void srtp_sender_set_protect_threads(int threads);
+/*
+ * longest time in us a packet may wait in the queue of a TCP receiver
+ * before the queue is dropped up to the next keyframe
+ */
+void srtp_sender_set_tcp_latency(int latency);
+/*
+ * pace at multiple * bitrate, 0 disables pacing
+ * latency is the max delay in us pacing may add to a buffer
+ * a negative value keeps the current setting
+ */
+void srtp_sender_set_pacing(double multiple, int latency);
+/*
+ * hand paced packets to the kernel with their launch time (SO_TXTIME)
+ * instead of sleeping until then, only the fq qdisc on the outgoing
+ * interface holds them back, with any other qdisc they leave right away
+ * TCP receivers keep sleeping
+ */
+void srtp_sender_set_txtime(int enable);
+/*
+ * DSCP (0..63) and SO_PRIORITY of every media socket, sndbuf is SO_SNDBUF
+ * in bytes or SRTP_SNDBUF_AUTO to hold the largest keyframe so far, auto
+ * never shrinks the kernel default, TCP keeps its own buffer size
+ * a negative value keeps the current setting
+ */
+void srtp_sender_set_socket_options(int dscp, int priority, int sndbuf);
+/*
+ * send UDP receivers' packets through io_uring, see srtp_uring_mode
+ * return -1 if the kernel can't do it, sendmmsg() stays in use then
+ */
+int srtp_sender_set_uring(int mode);
+/*
+ * AES implementation of receivers added from now on, srtp_aes_icm_impl_t,
+ * bitsliced is slower than the tables but leaks no timing
+ * return -1 if libsrtp can't use it on this CPU
+ */
+int srtp_sender_set_aes(int impl);
 
+/*
+ * initialize libsrtp, start the sender thread and the RTCP receive thread
+ */
 void srtp_backend_init();
 
 #endif
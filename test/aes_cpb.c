@@ -0,0 +1,126 @@
+/*
+ * speed of the AES block implementations of libsrtp on this CPU, and a
+ * check that they all encrypt the same
+ *
+ * usage: aes_cpb [rounds [MHz]]
+ * the best of rounds runs is timed with the monotonic clock, with the core
+ * clock in MHz (1500 on a Pi 4) that is cycles per byte, without it
+ * nanoseconds per byte, under qemu-user only the check means anything
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "aes.h"
+#include "aes_bs.h"
+#include "aes_hw.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//a 1366 byte packet of keystream and then some
+#define BLOCKS 96
+#define CALLS 20
+
+typedef void (*blocks_func)(v128_t* blocks, int num_blocks,
+        const srtp_aes_expanded_key_t* exp_key);
+
+struct impl {
+    const char* name;
+    blocks_func func;
+    int bitsliced;
+    int available;
+};
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    double mhz = argc > 2 ? atof(argv[2]) : 0;
+    struct impl impls[] = {
+        {"table", srtp_aes_encrypt_blocks, 0, 1},
+        {"bitsliced 64 bit", srtp_aes_bs_scalar_blocks, 1, 1},
+        {"bitsliced 128 bit vector", srtp_aes_bs_vector_blocks, 1,
+            srtp_aes_bs_vector_available()},
+        {srtp_aes_hw_name(), srtp_aes_hw_encrypt_blocks, 0,
+            srtp_aes_hw_available()},
+    };
+    static v128_t ref[BLOCKS], blocks[BLOCKS];
+    srtp_aes_expanded_key_t table_key, bs_key;
+    uint8_t key[32];
+    int failed = 0;
+
+    if (rounds < 1)
+        rounds = 1;
+    for (int i=0; i<(int)sizeof(key); i++)
+        key[i] = i * 7 + 1;
+    for (int i=0; i<BLOCKS; i++)
+        for (int j=0; j<16; j++)
+            ref[i].v8[j] = i + j;
+
+    for (int len=16; len<=32; len+=16)
+    {
+        v128_t expected[BLOCKS];
+
+        srtp_aes_expand_encryption_key(key, len, &table_key);
+        srtp_aes_bs_expand_encryption_key(key, len, &bs_key);
+        memcpy(expected, ref, sizeof(ref));
+        for (int i=0; i<BLOCKS; i++)
+            srtp_aes_encrypt(&expected[i], &table_key);
+
+        for (int k=0; k<(int)(sizeof(impls) / sizeof(impls[0])); k++)
+        {
+            const srtp_aes_expanded_key_t* ek = impls[k].bitsliced ? &bs_key
+                : &table_key;
+            int64_t best = -1;
+
+            if (!impls[k].available)
+            {
+                printf("AES-%d %-26s not on this CPU\n", len * 8,
+                        impls[k].name);
+                continue;
+            }
+            //every count up to BLOCKS, partial passes included
+            for (int n=1; n<=BLOCKS; n++)
+            {
+                memcpy(blocks, ref, sizeof(ref));
+                impls[k].func(blocks, n, ek);
+                if (memcmp(blocks, expected, n * sizeof(v128_t))
+                        || memcmp(blocks + n, ref + n,
+                            (BLOCKS - n) * sizeof(v128_t)))
+                {
+                    printf("AES-%d %s: FAIL at %d blocks\n", len * 8,
+                            impls[k].name, n);
+                    failed = 1;
+                    break;
+                }
+            }
+
+            for (int r=0; r<rounds; r++)
+            {
+                int64_t t = now_ns();
+                for (int c=0; c<CALLS; c++)
+                    impls[k].func(blocks, BLOCKS, ek);
+                t = now_ns() - t;
+                if (best < 0 || t < best)
+                    best = t;
+            }
+            if (mhz > 0)
+                printf("AES-%d %-26s %7.2f cycles/byte\n", len * 8,
+                        impls[k].name,
+                        best * mhz / 1000 / CALLS / (BLOCKS * 16));
+            else
+                printf("AES-%d %-26s %7.3f ns/byte\n", len * 8,
+                        impls[k].name, (double)best / CALLS / (BLOCKS * 16));
+        }
+    }
+    return failed;
+}
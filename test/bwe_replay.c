@@ -0,0 +1,90 @@
+/*
+ * replay a feedback trace (see bwe.h) through the bandwidth estimator
+ *
+ * usage: bwe_replay <trace> [<final bitrate> <overuses>]
+ * without expectations the target bitrate after every feedback is printed,
+ * with them the final bitrate has to be within 1% and the number of
+ * overuses the same, the target never leaves [min, max]
+ */
+#include "bwe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//what the sender recorded the traces in data/ with
+#define START_BITRATE 300000
+#define MIN_BITRATE 100000
+#define MAX_BITRATE 2000000
+
+#define FEEDBACK_MAX 4096
+
+int main(int argc, char** argv)
+{
+    static struct bwe_packet pkts[FEEDBACK_MAX];
+    struct bwe e;
+    FILE* f;
+    long long feedback, send, arrival, last = -1;
+    int size, n = 0, errors = 0;
+    int verbose = argc < 4;
+
+    if (argc < 2 || !(f = fopen(argv[1], "r")))
+    {
+        fprintf(stderr, "usage: %s <trace> [<final bitrate> <overuses>]\n",
+                argv[0]);
+        return 2;
+    }
+    bwe_init(&e, START_BITRATE, MIN_BITRATE, MAX_BITRATE);
+
+    for (;;)
+    {
+        int got = fscanf(f, "%lld %lld %lld %d", &feedback, &send, &arrival,
+                &size);
+        //packets of one feedback message share its time
+        if (n && (got!=4 || feedback!=last || n==FEEDBACK_MAX))
+        {
+            int bitrate = bwe_feedback(&e, pkts, n, last);
+            if (bitrate < MIN_BITRATE || bitrate > MAX_BITRATE)
+            {
+                fprintf(stderr, "bitrate %d at %lld\n", bitrate, last);
+                errors++;
+            }
+            if (verbose)
+                printf("%lld %d %d\n", last, bitrate, e.usage);
+            n = 0;
+        }
+        if (got!=4)
+            break;
+        last = feedback;
+        pkts[n].send = send;
+        pkts[n].arrival = arrival < 0 ? BWE_LOST : arrival;
+        pkts[n].size = size;
+        n++;
+    }
+    fclose(f);
+
+    printf("%llu feedbacks, %llu packets, %llu lost, %llu overuses, "
+            "%llu decreases, final bitrate %d\n",
+            (unsigned long long)e.feedbacks, (unsigned long long)e.packets,
+            (unsigned long long)e.lost, (unsigned long long)e.overuses,
+            (unsigned long long)e.decreases, e.bitrate);
+    if (!verbose)
+    {
+        long long bitrate = atoll(argv[2]);
+        unsigned long long overuses = strtoull(argv[3], NULL, 10);
+        if (llabs(e.bitrate - bitrate) * 100 > bitrate
+                || e.overuses!=overuses)
+        {
+            fprintf(stderr, "expected final bitrate %lld, %llu overuses\n",
+                    bitrate, overuses);
+            errors++;
+        }
+    }
+    if (errors)
+    {
+        printf("FAIL\n");
+        return 1;
+    }
+    if (!verbose)
+        printf("ok\n");
+    return 0;
+}
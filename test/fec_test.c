@@ -0,0 +1,245 @@
+/*
+ * loopback test of the sender's FEC, RFC 5109
+ *
+ * frames go through the sender to a socket of ours with row and column
+ * parity on, then every media packet is dropped in turn and rebuilt from
+ * each parity packet that covers it, it has to come out unchanged
+ */
+#include "rtpworker.h"
+#include "util.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define ROW 4
+#define COL 3
+#define FRAMES 30
+#define SSRC 1234
+#define PACKETS_MAX 4096
+#define PACKET_MAX 2048
+
+//the sender sends from the receiver's port, so the receiver is not 127.0.0.1
+#define RECEIVER_IP "127.0.0.2"
+
+static const char* key64 = "AAECAwQFBgcICQoLDA0ODxAREhMUFRYXGBkaGxwd";
+
+struct packet {
+    int len;
+    uint8_t data[PACKET_MAX];
+};
+
+static struct packet media[65536];//by sequence number
+static struct packet parity[PACKETS_MAX];
+static int nparity;
+
+static int receiver_socket(int port)
+{
+    struct sockaddr_in addr;
+    struct timeval tv = {0, 100000};
+    int flag = 1;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_aton(RECEIVER_IP, &addr.sin_addr);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+        perror("bind receiver");
+        exit(1);
+    }
+    //quiet for that long, the sender is done
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return sock;
+}
+
+/*
+ * the sender encrypts only, without a tag, srtp_unprotect() would take the
+ * tag length of an HMAC policy off the payload
+ */
+static srtp_t receiver_session()
+{
+    static uint8_t key[64];
+    srtp_policy_t policy;
+    srtp_t ctx;
+    int pad;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_aes_cm_128_null_auth(&policy.rtp);
+    srtp_crypto_policy_set_aes_cm_128_null_auth(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_inbound;
+    base64_string_to_octet_string((char*)key, &pad, key64, strlen(key64));
+    policy.key = key;
+    if (srtp_create(&ctx, &policy)!=srtp_err_status_ok)
+    {
+        fprintf(stderr, "can't create receiver session\n");
+        exit(1);
+    }
+    return ctx;
+}
+
+static void receive(int sock, srtp_t ctx)
+{
+    struct packet p;
+
+    for (;;)
+    {
+        int len = recv(sock, p.data, sizeof(p.data), 0);
+        if (len <= 0)
+            break;
+        //sender reports
+        if (p.data[1] >= 192 && p.data[1] <= 223)
+            continue;
+        if (srtp_unprotect(ctx, p.data, &len)!=srtp_err_status_ok)
+        {
+            fprintf(stderr, "can't unprotect\n");
+            exit(1);
+        }
+        p.len = len;
+        if ((p.data[1] & 0x7f)==SRTP_FEC_PT)
+        {
+            if (nparity < PACKETS_MAX)
+                parity[nparity++] = p;
+        }else
+            media[(p.data[2] << 8) | p.data[3]] = p;
+    }
+}
+
+/*
+ * one frame at a time, socket buffers don't hold a burst of all of them
+ */
+static void send_frames(int sock, srtp_t ctx)
+{
+    static uint8_t au[60000];
+
+    srand(11);
+    for (int f=0; f<FRAMES; f++)
+    {
+        size_t len = f==0 ? sizeof(au) : 200 + rand() % 9000;
+        int flags = H264_AU_END | (f==0 ? SRTP_KEYFRAME : 0);
+
+        memcpy(au, "\0\0\0\1", 4);
+        au[4] = f==0 ? 0x65 : 0x41;
+        for (size_t i=5; i<len; i++)
+            au[i] = rand() % 255 + 1;
+        srtp_sender_callback(au, len, flags, f * 33333, NULL, NULL);
+        receive(sock, ctx);
+    }
+}
+
+/*
+ * rebuild packet seq from parity packet f and the other packets it covers,
+ * RFC 5109 10.1 and 10.2, return 0 if it matches the one received
+ */
+static int recover(const struct packet* f, uint16_t seq)
+{
+    const uint8_t* fec = f->data + RTP_HEADER_LEN;
+    const uint8_t* level = fec + SRTP_FEC_HEADER_LEN;
+    uint16_t base = (fec[2] << 8) | fec[3];
+    int protection = (level[0] << 8) | level[1];
+    uint8_t bits[2] = {fec[0], fec[1]};
+    uint8_t ts[4];
+    uint16_t len = (fec[8] << 8) | fec[9];
+    uint8_t payload[PACKET_MAX];
+    uint8_t rebuilt[PACKET_MAX];
+    uint64_t mask = 0;
+
+    for (int i=0; i<6; i++)
+        mask = (mask << 8) | level[2 + i];
+    memcpy(ts, fec + 4, 4);
+    memset(payload, 0, sizeof(payload));
+    memcpy(payload, level + SRTP_FEC_LEVEL_HEADER_LEN, protection);
+
+    for (int b=0; b<SRTP_FEC_MASK_BITS; b++)
+    {
+        const struct packet* m = &media[(uint16_t)(base + b)];
+        if (!(mask & (1ULL << (SRTP_FEC_MASK_BITS - 1 - b)))
+                || (uint16_t)(base + b)==seq)
+            continue;
+        bits[0] ^= m->data[0];
+        bits[1] ^= m->data[1];
+        for (int i=0; i<4; i++)
+            ts[i] ^= m->data[4 + i];
+        len ^= m->len - RTP_HEADER_LEN;
+        for (int i=0; i<m->len - RTP_HEADER_LEN; i++)
+            payload[i] ^= m->data[RTP_HEADER_LEN + i];
+    }
+
+    rebuilt[0] = 0x80 | (bits[0] & 0x3f);
+    rebuilt[1] = bits[1];
+    rebuilt[2] = seq >> 8;
+    rebuilt[3] = seq;
+    memcpy(rebuilt + 4, ts, 4);
+    memcpy(rebuilt + 8, media[seq].data + 8, 4);//SSRC is not protected
+    memcpy(rebuilt + RTP_HEADER_LEN, payload, len);
+    return len + RTP_HEADER_LEN!=media[seq].len
+        || memcmp(rebuilt, media[seq].data, media[seq].len);
+}
+
+int main()
+{
+    int port = 20000 + getpid() % 20000;
+    int sock = receiver_socket(port);
+    srtp_t ctx;
+    int rows = 0, cols = 0, recovered = 0, errors = 0;
+
+    srtp_backend_init();
+    ctx = receiver_session();
+    srtp_sender_set_pacing(0, -1);
+    srtp_sender_set_fec(ROW, COL);
+    if (prepare_srtp_sender(RECEIVER_IP, port, SSRC, (const uint8_t*)key64,
+                SRTP_SEND_MMSG, 0))
+        return 1;
+    send_frames(sock, ctx);
+
+    for (int i=0; i<nparity; i++)
+    {
+        const uint8_t* fec = parity[i].data + RTP_HEADER_LEN;
+        const uint8_t* level = fec + SRTP_FEC_HEADER_LEN;
+        uint16_t base = (fec[2] << 8) | fec[3];
+        uint64_t mask = 0;
+        int covered = 0;
+
+        for (int k=0; k<6; k++)
+            mask = (mask << 8) | level[2 + k];
+        //a row is consecutive packets, a column every ROW-th one
+        if (mask & (1ULL << (SRTP_FEC_MASK_BITS - 2)))
+            rows++;
+        else
+            cols++;
+        for (int b=0; b<SRTP_FEC_MASK_BITS; b++)
+        {
+            uint16_t seq = base + b;
+            if (!(mask & (1ULL << (SRTP_FEC_MASK_BITS - 1 - b))))
+                continue;
+            covered++;
+            if (!media[seq].len || recover(&parity[i], seq))
+            {
+                fprintf(stderr, "packet %u not rebuilt from parity %d\n",
+                        seq, i);
+                errors++;
+            }else
+                recovered++;
+        }
+        if (covered!=(mask & (1ULL << (SRTP_FEC_MASK_BITS - 2)) ? ROW : COL))
+        {
+            fprintf(stderr, "parity %d covers %d packets\n", i, covered);
+            errors++;
+        }
+    }
+
+    printf("%d row and %d column parity packets, %d packets rebuilt\n",
+            rows, cols, recovered);
+    if (!rows || !cols || errors)
+    {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
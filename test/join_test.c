@@ -0,0 +1,348 @@
+/*
+ * receivers that come in in the middle of an IDR split over encoder
+ * buffers, the way MMAL hands out large keyframes, with the GOP cache off
+ *
+ * every buffer of such an IDR carries SRTP_KEYFRAME, only the first one
+ * starts a decodable stream: a receiver that joins between the buffers,
+ * or a TCP receiver whose queue was dropped inside the IDR, has to get
+ * nothing until the next IDR, not its tail
+ */
+#include "rtpworker.h"
+#include "util.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SSRC 1234
+#define PACKET_MAX 2048
+#define FRAME_US 33333
+
+//the sender sends from the receiver's port, so the receiver is not 127.0.0.1
+#define RECEIVER_IP "127.0.0.2"
+
+static const char* key64 = "AAECAwQFBgcICQoLDA0ODxAREhMUFRYXGBkaGxwd";
+
+static const uint8_t header[] = {0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1f, 0xda,
+    0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80};
+
+static uint8_t buf[1<<22];
+static int64_t pts;
+static uint64_t fed;
+
+/*
+ * what a receiver made of the packets so far, lost is set while it has
+ * nothing to decode from
+ */
+struct stream {
+    srtp_t ctx;
+    int lost;
+    int in_fu;
+    int have_seq;
+    uint16_t seq;
+    int gaps;
+    int idrs;
+    int errors;
+};
+
+static int receiver_socket(int port)
+{
+    struct sockaddr_in addr;
+    struct timeval tv = {0, 100000};
+    int flag = 1;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_aton(RECEIVER_IP, &addr.sin_addr);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+        perror("bind receiver");
+        exit(1);
+    }
+    //quiet for that long, the sender is done
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return sock;
+}
+
+/*
+ * the sender encrypts only, without a tag, srtp_unprotect() would take the
+ * tag length of an HMAC policy off the payload
+ */
+static void stream_init(struct stream* st)
+{
+    static uint8_t key[64];
+    srtp_policy_t policy;
+    int pad;
+
+    memset(st, 0, sizeof(*st));
+    st->lost = 1;
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_aes_cm_128_null_auth(&policy.rtp);
+    srtp_crypto_policy_set_aes_cm_128_null_auth(&policy.rtcp);
+    policy.ssrc.type = ssrc_any_inbound;
+    base64_string_to_octet_string((char*)key, &pad, key64, strlen(key64));
+    policy.key = key;
+    if (srtp_create(&st->ctx, &policy)!=srtp_err_status_ok)
+    {
+        fprintf(stderr, "can't create receiver session\n");
+        exit(1);
+    }
+}
+
+/*
+ * one packet as it arrives, a NAL unit that is not a parameter set is
+ * only fine after the start of an IDR once something went missing, an FU-A
+ * fragment only after the start of its NAL unit
+ */
+static void stream_packet(struct stream* st, uint8_t* pkt, int len)
+{
+    uint16_t seq;
+    int type, start = 1;
+
+    //sender reports
+    if (pkt[1] >= 192 && pkt[1] <= 223)
+        return;
+    if (srtp_unprotect(st->ctx, pkt, &len)!=srtp_err_status_ok)
+    {
+        fprintf(stderr, "can't unprotect\n");
+        st->errors++;
+        return;
+    }
+    seq = (pkt[2] << 8) | pkt[3];
+    if (st->have_seq && seq!=(uint16_t)(st->seq + 1))
+    {
+        st->gaps++;
+        st->lost = 1;
+        st->in_fu = 0;
+    }
+    st->have_seq = 1;
+    st->seq = seq;
+
+    type = pkt[RTP_HEADER_LEN] & 0x1f;
+    if (type==H264_NAL_FU_A)
+    {
+        start = pkt[RTP_HEADER_LEN + 1] & 0x80;
+        type = pkt[RTP_HEADER_LEN + 1] & 0x1f;
+        if (!start && !st->in_fu)
+        {
+            fprintf(stderr, "seq %u: fragment of a NAL unit of type %d "
+                    "without its start\n", seq, type);
+            st->errors++;
+        }
+        st->in_fu = !(pkt[RTP_HEADER_LEN + 1] & 0x40);
+    }else
+        st->in_fu = 0;
+
+    if (type==H264_NAL_SPS || type==H264_NAL_PPS || type==H264_NAL_STAP_A)
+        return;
+    if (type==5 && start)
+    {
+        st->lost = 0;
+        st->idrs++;
+    }else if (st->lost && start)
+    {
+        fprintf(stderr, "seq %u: NAL unit of type %d before an IDR\n", seq,
+                type);
+        st->errors++;
+    }
+}
+
+static void receive(int sock, struct stream* st)
+{
+    uint8_t pkt[PACKET_MAX];
+
+    for (;;)
+    {
+        int len = recv(sock, pkt, sizeof(pkt), 0);
+        if (len <= 0)
+            break;
+        stream_packet(st, pkt, len);
+    }
+}
+
+/*
+ * RFC 4571 framed packets, as much as the socket has
+ */
+static void receive_tcp(int sock, struct stream* st)
+{
+    static uint8_t data[1<<16];
+    static size_t have;
+
+    for (;;)
+    {
+        int n = recv(sock, data + have, sizeof(data) - have, 0);
+        size_t off = 0;
+        if (n <= 0)
+            break;
+        have += n;
+        while (have - off >= 2)
+        {
+            size_t len = (data[off] << 8) | data[off + 1];
+            if (have - off < 2 + len)
+                break;
+            stream_packet(st, data + off + 2, len);
+            off += 2 + len;
+        }
+        memmove(data, data + off, have - off);
+        have -= off;
+    }
+}
+
+/*
+ * until the sender thread is done with everything fed to it
+ */
+static void wait_sent()
+{
+    struct srtp_sender_stats stats;
+
+    for (int i=0; i<2000; i++)
+    {
+        srtp_sender_get_stats(&stats);
+        if (stats.encoded_bytes >= fed)
+            return;
+        usleep(1000);
+    }
+    fprintf(stderr, "sender thread is stuck\n");
+    exit(1);
+}
+
+/*
+ * one encoder buffer, a NAL unit of type nal starts it unless 0
+ */
+static void feed(int nal, size_t len, int flags)
+{
+    size_t i = 0;
+
+    if (nal)
+    {
+        memcpy(buf, "\0\0\0\1", 4);
+        buf[4] = nal;
+        i = 5;
+    }
+    for (; i<len; i++)
+        buf[i] = rand() % 255 + 1;
+    srtp_sender_callback(buf, len, flags, pts, NULL, NULL);
+    fed += len;
+    if (flags & H264_AU_END)
+        pts += FRAME_US;
+    wait_sent();
+}
+
+/*
+ * a UDP receiver added between the two buffers of an IDR
+ */
+static int join_udp(int port)
+{
+    int sock = receiver_socket(port);
+    struct stream st;
+
+    stream_init(&st);
+    feed(0x65, 20000, SRTP_KEYFRAME);
+    if (prepare_srtp_sender(RECEIVER_IP, port, SSRC, (const uint8_t*)key64,
+                SRTP_SEND_MMSG, 0))
+        return 1;
+    feed(0, 20000, SRTP_KEYFRAME | H264_NAL_END | H264_AU_END);
+    feed(0x41, 3000, H264_NAL_END | H264_AU_END);
+    feed(0x65, 20000, SRTP_KEYFRAME | H264_NAL_END | H264_AU_END);
+    receive(sock, &st);
+    close(sock);
+
+    printf("udp join: %d IDRs\n", st.idrs);
+    if (st.idrs!=1 || st.errors)
+        return 1;
+    return 0;
+}
+
+/*
+ * a TCP receiver that reads nothing while the first buffer of an IDR goes
+ * out, its queue is dropped and the second buffer must not resume it
+ */
+static int drop_tcp(int port)
+{
+    struct sockaddr_in addr;
+    struct timeval tv = {0, 100000};
+    int rcvbuf = 4096;
+    int flag = 1;
+    int lsock = socket(AF_INET, SOCK_STREAM, 0);
+    int sock;
+    struct stream st;
+
+    setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    //a small window the connection starts with
+    setsockopt(lsock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_aton(RECEIVER_IP, &addr.sin_addr);
+    if (bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) || listen(lsock, 1))
+    {
+        perror("tcp receiver");
+        exit(1);
+    }
+    if (prepare_srtp_sender(RECEIVER_IP, port, SSRC, (const uint8_t*)key64,
+                SRTP_SEND_TCP, 0))
+        return 1;
+    sock = accept(lsock, NULL, NULL);
+    close(lsock);
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    stream_init(&st);
+    feed(0x65, 20000, SRTP_KEYFRAME | H264_NAL_END | H264_AU_END);
+    feed(0x41, 3000, H264_NAL_END | H264_AU_END);
+    //more than the queue and the socket buffers hold
+    feed(0x65, 3 * SRTP_TCP_QUEUE_BYTES, SRTP_KEYFRAME);
+    rcvbuf = 4 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    receive_tcp(sock, &st);
+    feed(0, 20000, SRTP_KEYFRAME | H264_NAL_END | H264_AU_END);
+    receive_tcp(sock, &st);
+    feed(0x41, 3000, H264_NAL_END | H264_AU_END);
+    receive_tcp(sock, &st);
+    feed(0x65, 20000, SRTP_KEYFRAME | H264_NAL_END | H264_AU_END);
+    receive_tcp(sock, &st);
+    //what is still queued goes out with the next frames
+    for (int i=0; i<3; i++)
+    {
+        feed(0x41, 3000, H264_NAL_END | H264_AU_END);
+        receive_tcp(sock, &st);
+    }
+    close(sock);
+
+    //the first, the start of the dropped one and the one after it
+    printf("tcp drop: %d gaps, %d IDRs\n", st.gaps, st.idrs);
+    if (!st.gaps || st.idrs!=3 || st.lost || st.errors)
+        return 1;
+    return 0;
+}
+
+int main()
+{
+    int port = 20000 + getpid() % 20000;
+    int failed;
+
+    srand(5);
+    srtp_backend_init();
+    srtp_sender_set_pacing(0, -1);
+    srtp_sender_set_gop_cache(0, -1);
+    srtp_sender_set_stream_header(header, sizeof(header));
+    //a stream that is already running
+    feed(0x65, 20000, SRTP_KEYFRAME | H264_NAL_END | H264_AU_END);
+    feed(0x41, 3000, H264_NAL_END | H264_AU_END);
+
+    failed = join_udp(port);
+    failed |= drop_tcp(port + 1);
+    if (failed)
+    {
+        printf("FAIL\n");
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * keystream of a frame generated by 1..SRTP_PROTECT_THREADS_MAX threads,
+ * the way the sender's protect pool splits it
+ *
+ * every split has to give the same packets as a single thread, the best
+ * time of rounds fills of SRTP_KEYSTREAM_PACKETS_DEFAULT packets is printed
+ * usage: protect_bench [rounds]
+ */
+#include "rtpworker.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SSRC 1234
+#define PACKETS SRTP_KEYSTREAM_PACKETS_DEFAULT
+
+struct part {
+    pthread_t thread;
+    srtp_t ctx;
+    unsigned index;
+};
+
+static uint8_t key[SRTP_AES_ICM_128_KEY_LEN_WSALT];
+static uint8_t packets[PACKETS][RTP_HEADER_LEN + RTP_PKT_BODY_SIZE
+    + SRTP_MAX_TRAILER_LEN];
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static srtp_t create(unsigned parts)
+{
+    srtp_policy_t policy;
+    srtp_t ctx;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_rtp_default(&policy.rtp);
+    srtp_crypto_policy_set_rtcp_default(&policy.rtcp);
+    policy.ssrc.type = ssrc_specific;
+    policy.ssrc.value = SSRC;
+    policy.key = key;
+    if (srtp_create(&ctx, &policy)!=srtp_err_status_ok
+            || srtp_set_keystream_cache(ctx, SSRC, PACKETS,
+                SRTP_KEYSTREAM_LEN)!=srtp_err_status_ok
+            || srtp_set_keystream_parallel(ctx, SSRC, parts)!=srtp_err_status_ok)
+    {
+        fprintf(stderr, "can't set up %u parts\n", parts);
+        exit(1);
+    }
+    return ctx;
+}
+
+static void* run_part(void* arg)
+{
+    struct part* p = (struct part*)arg;
+    unsigned n;
+    srtp_precompute_keystream_part(p->ctx, SSRC, PACKETS, p->index, &n);
+    return NULL;
+}
+
+static void fill(srtp_t ctx, unsigned parts)
+{
+    struct part p[SRTP_PROTECT_THREADS_MAX];
+
+    for (unsigned i=0; i<parts; i++)
+    {
+        p[i].ctx = ctx;
+        p[i].index = i;
+    }
+    for (unsigned i=1; i<parts; i++)
+        pthread_create(&p[i].thread, NULL, run_part, &p[i]);
+    run_part(&p[0]);
+    for (unsigned i=1; i<parts; i++)
+        pthread_join(p[i].thread, NULL);
+}
+
+/*
+ * protect PACKETS packets from the cache, return -1 if one differs from
+ * the single thread ones (check 0 records those)
+ */
+static int protect_all(srtp_t ctx, int check)
+{
+    int errors = 0;
+
+    for (int i=0; i<PACKETS; i++)
+    {
+        uint8_t pkt[sizeof(packets[0])];
+        struct srtp_hdr_t* hdr = (struct srtp_hdr_t*)pkt;
+        int len = RTP_HEADER_LEN + RTP_PKT_BODY_SIZE;
+
+        memset(pkt, i, sizeof(pkt));
+        memset(hdr, 0, RTP_HEADER_LEN);
+        hdr->version = 2;
+        hdr->pt = 96;
+        hdr->seq = htons(i);
+        hdr->ssrc = htonl(SSRC);
+        if (srtp_protect(ctx, hdr, &len)!=srtp_err_status_ok)
+            return -1;
+        if (!check)
+            memcpy(packets[i], pkt, len);
+        else if (memcmp(packets[i], pkt, len))
+            errors++;
+    }
+    return errors ? -1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 50;
+    int failed = 0;
+
+    if (rounds < 1)
+        rounds = 1;
+    srtp_init();
+    for (int i=0; i<(int)sizeof(key); i++)
+        key[i] = i;
+
+    for (unsigned parts=1; parts<=SRTP_PROTECT_THREADS_MAX; parts++)
+    {
+        int64_t best = -1;
+        unsigned missing = 0;
+        srtp_t ctx;
+
+        for (int r=0; r<rounds; r++)
+        {
+            int64_t t;
+            ctx = create(parts);
+            t = now_us();
+            fill(ctx, parts);
+            t = now_us() - t;
+            if (best < 0 || t < best)
+                best = t;
+            if (r < rounds - 1)
+                srtp_dealloc(ctx);
+        }
+        srtp_get_keystream_missing(ctx, SSRC, PACKETS, &missing);
+        if (missing || protect_all(ctx, parts > 1))
+        {
+            printf("%u threads: FAIL, %u packets missing\n", parts, missing);
+            failed = 1;
+        }else
+            printf("%u threads: %d packets in %lld us\n", parts, PACKETS,
+                    (long long)best);
+        srtp_dealloc(ctx);
+    }
+    return failed;
+}
@@ -0,0 +1,321 @@
+/*
+ * round trip test of the H.264 packetizer
+ *
+ * random Annex B access units are cut into random encoder buffers, the
+ * RTP payloads are depacketized again (single NAL unit, STAP-A, FU-A)
+ * and the NAL units have to come out unchanged, with the marker bit on
+ * the last packet of every access unit only
+ */
+#include "rtp_h264.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STREAM_MAX (1<<18)
+
+struct depacketizer {
+    size_t max_payload;
+    //NAL units seen, each preceded by its length as a size_t
+    uint8_t nals[1<<20];
+    size_t nals_len;
+    uint8_t fu[STREAM_MAX];
+    size_t fu_len;
+    int in_fu;
+    int packets;
+    int marker;
+    int errors;
+};
+
+static void add_nal(struct depacketizer* d, const uint8_t* nal, size_t len)
+{
+    memcpy(d->nals + d->nals_len, &len, sizeof(len));
+    d->nals_len += sizeof(len);
+    memcpy(d->nals + d->nals_len, nal, len);
+    d->nals_len += len;
+}
+
+static void error(struct depacketizer* d, const char* what)
+{
+    fprintf(stderr, "%s\n", what);
+    d->errors++;
+}
+
+static void emit(void* arg, const uint8_t* prefix, size_t prefix_len,
+        const uint8_t* body, size_t body_len, int marker)
+{
+    struct depacketizer* d = arg;
+    uint8_t p[H264_STAP_A_MAX_PAYLOAD + H264_FU_HEADER_LEN];
+    size_t n = prefix_len + body_len;
+    size_t o, l;
+
+    d->packets++;
+    d->marker = marker;
+    if (n == 0 || n > d->max_payload)
+    {
+        error(d, "bad payload size");
+        return;
+    }
+    if (prefix_len)
+        memcpy(p, prefix, prefix_len);
+    memcpy(p + prefix_len, body, body_len);
+
+    switch (p[0] & 0x1f)
+    {
+        case H264_NAL_STAP_A:
+            for (o = 1; o + 2 <= n; o += l)
+            {
+                l = (p[o] << 8) | p[o+1];
+                o += 2;
+                if (o + l > n)
+                    break;
+                add_nal(d, p + o, l);
+            }
+            if (o != n)
+                error(d, "STAP-A length mismatch");
+            break;
+        case H264_NAL_FU_A:
+            if (n < H264_FU_HEADER_LEN)
+            {
+                error(d, "short FU-A");
+                break;
+            }
+            if (p[1] & 0x80)
+            {
+                if (d->in_fu)
+                    error(d, "FU-A start inside a NAL unit");
+                d->in_fu = 1;
+                d->fu_len = 0;
+                d->fu[d->fu_len++] = (p[0] & 0xe0) | (p[1] & 0x1f);
+            }else if (!d->in_fu)
+                error(d, "FU-A without start");
+            memcpy(d->fu + d->fu_len, p + 2, n - 2);
+            d->fu_len += n - 2;
+            if (p[1] & 0x40)
+            {
+                add_nal(d, d->fu, d->fu_len);
+                d->in_fu = 0;
+            }
+            break;
+        default:
+            add_nal(d, p, n);
+            break;
+    }
+}
+
+/*
+ * random NAL unit body without 00 00 0x sequences (emulation prevention)
+ * and without a trailing zero, len >= 1
+ */
+static void random_nal(uint8_t* nal, size_t len)
+{
+    static const uint8_t types[] = {1, 5, 6, 7, 8};
+    size_t i;
+
+    nal[0] = 0x60 | types[rand() % sizeof(types)];
+    for (i = 1; i < len; i++)
+    {
+        nal[i] = rand() % 3 ? rand() : 0;
+        if (i >= 2 && nal[i-1] == 0 && nal[i-2] == 0 && nal[i] <= 3)
+            nal[i] = 4 + rand() % 200;
+    }
+    if (nal[len-1] == 0)
+        nal[len-1] = 0x80;
+}
+
+static size_t random_len(size_t max_payload)
+{
+    switch (rand() % 4)
+    {
+        case 0:
+            return 1 + rand() % 10;
+        case 1:
+            return 1 + rand() % (max_payload + 5);
+        case 2:
+            return max_payload - 3 + rand() % 8;
+        default:
+            return 1 + rand() % 5000;
+    }
+}
+
+/*
+ * buffer sizes, often tiny so that start codes and zero runs get split
+ */
+static size_t random_cut(void)
+{
+    switch (rand() % 4)
+    {
+        case 0:
+            return 1;
+        case 1:
+            return 1 + rand() % 4;
+        default:
+            return 1 + rand() % 3000;
+    }
+}
+
+/*
+ * packetize the access unit stream[0, len) in buffers of the sizes
+ * cut() returns
+ */
+static void packetize_au(struct h264_packetizer* pk, struct depacketizer* d,
+        const uint8_t* stream, size_t len, size_t (*cut)(void))
+{
+    size_t p = 0, c;
+    int flags, before;
+
+    while (p < len)
+    {
+        c = cut();
+        if (p + c > len)
+            c = len - p;
+        flags = (p + c == len) ? H264_AU_END : 0;
+        before = d->packets;
+        d->marker = -1;
+        h264_packetize(pk, stream + p, c, flags, emit, d);
+        if (d->packets > before && d->marker != (flags ? 1 : 0))
+            error(d, flags ? "no marker at the end of the access unit" :
+                    "marker inside the access unit");
+        p += c;
+    }
+}
+
+static int check(struct depacketizer* d, const uint8_t* expect,
+        size_t expect_len, const char* name)
+{
+    if (d->in_fu)
+        error(d, "unfinished FU-A");
+    if (d->nals_len != expect_len || memcmp(d->nals, expect, expect_len))
+        error(d, "NAL units differ");
+    if (d->errors)
+        fprintf(stderr, "FAIL %s\n", name);
+    return d->errors;
+}
+
+static size_t one_byte(void)
+{
+    return 1;
+}
+
+/*
+ * the start code of the second NAL unit split at every position, with
+ * trailing_zero_8bits of the first one in front of it
+ */
+static int test_split_start_code(void)
+{
+    static struct h264_packetizer pk;
+    static struct depacketizer d;
+    static const uint8_t a[] = {0x65, 0x11, 0x22};
+    static const uint8_t b[] = {0x41, 0x33, 0x44};
+    uint8_t stream[32], expect[64];
+    size_t sl, el, zeros, cut, i;
+    int errors = 0;
+
+    for (zeros = 0; zeros <= 4; zeros++)
+    {
+        sl = 0;
+        stream[sl++] = 0; stream[sl++] = 0; stream[sl++] = 1;
+        memcpy(stream + sl, a, sizeof(a));
+        sl += sizeof(a);
+        for (i = 0; i < zeros; i++)
+            stream[sl++] = 0;
+        stream[sl++] = 0; stream[sl++] = 0; stream[sl++] = 1;
+        memcpy(stream + sl, b, sizeof(b));
+        sl += sizeof(b);
+
+        el = 0;
+        i = sizeof(a);
+        memcpy(expect + el, &i, sizeof(i));
+        el += sizeof(i);
+        memcpy(expect + el, a, sizeof(a));
+        el += sizeof(a);
+        i = sizeof(b);
+        memcpy(expect + el, &i, sizeof(i));
+        el += sizeof(i);
+        memcpy(expect + el, b, sizeof(b));
+        el += sizeof(b);
+
+        //two buffers cut anywhere
+        for (cut = 1; cut < sl; cut++)
+        {
+            memset(&d, 0, sizeof(d));
+            h264_packetizer_init(&pk, 1400);
+            d.max_payload = pk.max_payload;
+            h264_packetize(&pk, stream, cut, 0, emit, &d);
+            h264_packetize(&pk, stream + cut, sl - cut, H264_AU_END, emit, &d);
+            errors += check(&d, expect, el, "two buffers");
+        }
+
+        //one byte per buffer
+        memset(&d, 0, sizeof(d));
+        h264_packetizer_init(&pk, 1400);
+        d.max_payload = pk.max_payload;
+        packetize_au(&pk, &d, stream, sl, one_byte);
+        errors += check(&d, expect, el, "one byte buffers");
+    }
+    return errors;
+}
+
+static int test_random(unsigned seed, int iterations)
+{
+    static struct h264_packetizer pk;
+    static struct depacketizer d;
+    static uint8_t stream[STREAM_MAX];
+    static uint8_t expect[1<<20];
+    size_t sl, el, len;
+    int i, a, k, z, aus, nals;
+
+    srand(seed);
+    for (i = 0; i < iterations; i++)
+    {
+        memset(&d, 0, sizeof(d));
+        h264_packetizer_init(&pk, 100 + rand() % 1300);
+        d.max_payload = pk.max_payload;
+        el = 0;
+
+        aus = 1 + rand() % 4;
+        for (a = 0; a < aus; a++)
+        {
+            sl = 0;
+            nals = 1 + rand() % 5;
+            for (k = 0; k < nals; k++)
+            {
+                //zero_byte of a 4 byte start code
+                if (rand() % 2)
+                    stream[sl++] = 0;
+                stream[sl++] = 0;
+                stream[sl++] = 0;
+                stream[sl++] = 1;
+                len = random_len(pk.max_payload);
+                random_nal(stream + sl, len);
+                memcpy(expect + el, &len, sizeof(len));
+                el += sizeof(len);
+                memcpy(expect + el, stream + sl, len);
+                el += len;
+                sl += len;
+                //trailing_zero_8bits
+                if (rand() % 4 == 0)
+                    for (z = rand() % 6; z > 0; z--)
+                        stream[sl++] = 0;
+            }
+            packetize_au(&pk, &d, stream, sl, random_cut);
+        }
+        if (check(&d, expect, el, "random"))
+        {
+            fprintf(stderr, "seed %u iteration %d\n", seed, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+    int errors = 0;
+
+    errors += test_split_start_code();
+    errors += test_random(seed, 5000);
+    printf("%s\n", errors ? "FAIL" : "ok");
+    return errors ? 1 : 0;
+}
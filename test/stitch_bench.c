@@ -0,0 +1,198 @@
+/*
+ * srtp_protect() per packet of AES_CM_128_HMAC_SHA1_80 with every AES and
+ * SHA-1 implementation this CPU runs, and a check that what it protects
+ * in one pass (srtp_protect_stitched()) unprotects again
+ *
+ * usage: stitch_bench [rounds [MHz]]
+ * encryption alone plus authentication alone is what the two passes cost,
+ * both at once is the one pass, the best of rounds runs is printed in
+ * cycles with the core clock in MHz (1500 on a Pi 4), in ns without
+ *
+ * the sender itself only encrypts (sec_serv_conf in rtpworker.c), which
+ * doesn't take the one pass path, this measures what authenticating would
+ * cost
+ */
+#include "srtp.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SSRC 0x1234
+#define CALLS 20
+#define CHECK_PACKETS 3000
+#define PACKET_MAX 1600
+
+static const int sizes[] = {160, 524, 1036, 1378};
+
+static uint8_t key[SRTP_AES_ICM_128_KEY_LEN_WSALT];
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static srtp_t create(srtp_sec_serv_t sec_serv, srtp_ssrc_type_t type)
+{
+    srtp_policy_t policy;
+    srtp_t ctx;
+
+    memset(&policy, 0, sizeof(policy));
+    srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtp);
+    srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&policy.rtcp);
+    policy.rtp.sec_serv = sec_serv;
+    policy.rtcp.sec_serv = sec_serv;
+    policy.ssrc.type = type;
+    policy.ssrc.value = SSRC;
+    policy.key = key;
+    if (srtp_create(&ctx, &policy)!=srtp_err_status_ok)
+    {
+        fprintf(stderr, "can't create session\n");
+        exit(1);
+    }
+    return ctx;
+}
+
+/*
+ * random packets with CSRCs and header extensions through the one pass
+ * and back through srtp_unprotect(), return the number that differ
+ */
+static int check()
+{
+    srtp_t tx = create(sec_serv_conf_and_auth, ssrc_specific);
+    srtp_t rx = create(sec_serv_conf_and_auth, ssrc_any_inbound);
+    int errors = 0;
+
+    srand(7);
+    for (int i=0; i<CHECK_PACKETS; i++)
+    {
+        uint8_t pkt[PACKET_MAX + SRTP_MAX_TRAILER_LEN];
+        uint8_t orig[PACKET_MAX];
+        int cc = rand() % 3, x = rand() % 2, ext = rand() % 4;
+        int hdr = 12 + 4 * cc;
+        int len, orig_len;
+
+        memset(pkt, 0, sizeof(pkt));
+        pkt[0] = 0x80 | (x << 4) | cc;
+        pkt[1] = 96;
+        pkt[2] = i >> 8;
+        pkt[3] = i;
+        *(uint32_t*)(pkt + 8) = htonl(SSRC);
+        if (x)
+        {
+            pkt[hdr] = 0xbe;
+            pkt[hdr + 1] = 0xde;
+            pkt[hdr + 3] = ext;
+            hdr += 4 + 4 * ext;
+        }
+        len = hdr + rand() % (PACKET_MAX - hdr);
+        for (int k=hdr; k<len; k++)
+            pkt[k] = rand();
+        memcpy(orig, pkt, len);
+        orig_len = len;
+
+        if (srtp_protect(tx, pkt, &len)!=srtp_err_status_ok
+                || srtp_unprotect(rx, pkt, &len)!=srtp_err_status_ok
+                || len!=orig_len || memcmp(pkt, orig, len))
+            errors++;
+    }
+    srtp_dealloc(tx);
+    srtp_dealloc(rx);
+    return errors;
+}
+
+/*
+ * best time of rounds runs of CALLS packets of len octets in ns
+ */
+static double protect_ns(srtp_sec_serv_t sec_serv, int len, int rounds)
+{
+    static uint8_t pkt[PACKET_MAX + SRTP_MAX_TRAILER_LEN];
+    srtp_t ctx = create(sec_serv, ssrc_specific);
+    uint16_t seq = 0;
+    int64_t best = -1;
+
+    memset(pkt, 0, sizeof(pkt));
+    pkt[0] = 0x80;
+    pkt[1] = 96;
+    *(uint32_t*)(pkt + 8) = htonl(SSRC);
+    for (int r=0; r<rounds; r++)
+    {
+        int64_t t = now_ns();
+        for (int c=0; c<CALLS; c++)
+        {
+            int n = len;
+            seq++;
+            pkt[2] = seq >> 8;
+            pkt[3] = seq;
+            srtp_protect(ctx, pkt, &n);
+        }
+        t = now_ns() - t;
+        if (best < 0 || t < best)
+            best = t;
+    }
+    srtp_dealloc(ctx);
+    return (double)best / CALLS;
+}
+
+int main(int argc, char** argv)
+{
+    static const srtp_aes_icm_impl_t aes[] = {srtp_aes_icm_impl_table,
+        srtp_aes_icm_impl_bitsliced, srtp_aes_icm_impl_hw};
+    static const srtp_sha1_impl_t sha1[] = {srtp_sha1_impl_scalar,
+        srtp_sha1_impl_vector, srtp_sha1_impl_hw};
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    double mhz = argc > 2 ? atof(argv[2]) : 0;
+    double scale = mhz > 0 ? mhz / 1000 : 1;
+    int failed = 0;
+
+    if (rounds < 1)
+        rounds = 1;
+    srtp_init();
+    for (int i=0; i<(int)sizeof(key); i++)
+        key[i] = i * 7 + 1;
+
+    printf("%s per packet: encrypt + authenticate = two passes, one pass\n",
+            mhz > 0 ? "cycles" : "ns");
+    for (int a=0; a<3; a++)
+    {
+        if (srtp_set_aes_icm_impl(aes[a])!=srtp_err_status_ok)
+            continue;
+        for (int s=0; s<3; s++)
+        {
+            int errors;
+
+            if (srtp_set_sha1_impl(sha1[s])!=srtp_err_status_ok)
+                continue;
+            errors = check();
+            printf("%s, %s%s\n",
+                    srtp_get_profile_cipher_description(
+                        srtp_profile_aes128_cm_sha1_80),
+                    srtp_get_sha1_impl_description(),
+                    errors ? ": FAIL" : "");
+            if (errors)
+            {
+                printf("%d of %d packets don't unprotect\n", errors,
+                        CHECK_PACKETS);
+                failed = 1;
+                continue;
+            }
+            for (int i=0; i<(int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+            {
+                double conf = protect_ns(sec_serv_conf, sizes[i], rounds);
+                double auth = protect_ns(sec_serv_auth, sizes[i], rounds);
+                double both = protect_ns(sec_serv_conf_and_auth, sizes[i],
+                        rounds);
+                printf("  %4d octets: %7.0f + %7.0f = %7.0f, %7.0f\n",
+                        sizes[i], conf * scale, auth * scale,
+                        (conf + auth) * scale, both * scale);
+            }
+        }
+    }
+    srtp_set_aes_icm_impl(srtp_aes_icm_impl_auto);
+    srtp_set_sha1_impl(srtp_sha1_impl_auto);
+    return failed;
+}
@@ -0,0 +1,232 @@
+/*
+ * minimal io_uring, see uring.h
+ *
+ * the rings are mapped once, the head and tail indexes the kernel writes
+ * are read with acquire and ours are written with release semantics
+ */
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int sys_setup(unsigned entries, struct io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete,
+        unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+            NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, void* arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, op, arg, nr_args);
+}
+
+int uring_init(struct uring* u, unsigned entries, unsigned sqpoll_idle)
+{
+    struct io_uring_params p;
+
+    memset(u, 0, sizeof(struct uring));
+    memset(&p, 0, sizeof(p));
+    if (sqpoll_idle)
+    {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = sqpoll_idle;
+    }
+    u->fd = sys_setup(entries, &p);
+    if (u->fd < 0)
+        return -errno;
+    u->entries = p.sq_entries;
+    u->sqpoll = !!sqpoll_idle;
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_ring_size > u->sq_ring_size)
+            u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = u->sq_ring_size;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring==MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ring = u->sq_ring;
+    else
+    {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring==MAP_FAILED)
+            goto fail;
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes==MAP_FAILED)
+        goto fail;
+
+    u->sq_head = (unsigned*)((char*)u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned*)((char*)u->sq_ring + p.sq_off.tail);
+    u->sq_mask = (unsigned*)((char*)u->sq_ring + p.sq_off.ring_mask);
+    u->sq_flags = (unsigned*)((char*)u->sq_ring + p.sq_off.flags);
+    u->sq_array = (unsigned*)((char*)u->sq_ring + p.sq_off.array);
+    u->cq_head = (unsigned*)((char*)u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned*)((char*)u->cq_ring + p.cq_off.tail);
+    u->cq_mask = (unsigned*)((char*)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)((char*)u->cq_ring + p.cq_off.cqes);
+    u->sqe_tail = u->sqe_head = *u->sq_tail;
+    return 0;
+
+fail:
+    {
+        int err = -errno;
+        uring_exit(u);
+        return err;
+    }
+}
+
+void uring_exit(struct uring* u)
+{
+    if (u->sqes && u->sqes!=MAP_FAILED)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring!=MAP_FAILED && u->cq_ring!=u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring && u->sq_ring!=MAP_FAILED)
+        munmap(u->sq_ring, u->sq_ring_size);
+    if (u->fd >= 0)
+        close(u->fd);
+    memset(u, 0, sizeof(struct uring));
+    u->fd = -1;
+}
+
+int uring_op_supported(struct uring* u, int op)
+{
+    size_t len = sizeof(struct io_uring_probe)
+        + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, len);
+    int ret = 0;
+
+    if (!probe)
+        return 0;
+    if (sys_register(u->fd, IORING_REGISTER_PROBE, probe, 256)==0)
+        ret = op <= probe->last_op
+            && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ret;
+}
+
+int uring_register_buffers(struct uring* u, unsigned nr)
+{
+    struct io_uring_rsrc_register reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.nr = nr;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (sys_register(u->fd, IORING_REGISTER_BUFFERS2, &reg, sizeof(reg))<0)
+        return -errno;
+    return 0;
+}
+
+int uring_set_buffer(struct uring* u, unsigned index, void* base, size_t len)
+{
+    struct iovec iov = {base, base ? len : 0};
+    struct io_uring_rsrc_update2 up;
+
+    memset(&up, 0, sizeof(up));
+    up.offset = index;
+    up.data = (uint64_t)(uintptr_t)&iov;
+    up.nr = 1;
+    if (sys_register(u->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up))<0)
+        return -errno;
+    return 0;
+}
+
+struct io_uring_sqe* uring_get_sqe(struct uring* u)
+{
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe* sqe;
+
+    if (u->sqe_tail - head >= u->entries)
+        return NULL;
+    sqe = &u->sqes[u->sqe_tail & *u->sq_mask];
+    u->sq_array[u->sqe_tail & *u->sq_mask] = u->sqe_tail & *u->sq_mask;
+    u->sqe_tail++;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+static unsigned uring_cq_ready(struct uring* u)
+{
+    return __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - *u->cq_head;
+}
+
+int uring_submit_and_wait(struct uring* u, unsigned wait_nr)
+{
+    unsigned to_submit = u->sqe_tail - u->sqe_head;
+    unsigned flags = 0;
+
+    __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+    u->sqe_head = u->sqe_tail;
+    if (u->sqpoll)
+    {
+        //the thread checks for work before it sets the flag
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (to_submit && (__atomic_load_n(u->sq_flags, __ATOMIC_RELAXED)
+                    & IORING_SQ_NEED_WAKEUP))
+        {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+            u->wakeups++;
+        }
+        if (!flags && uring_cq_ready(u) < wait_nr)
+        {
+            int64_t end = now_ns() + URING_SPIN_NS;
+            while (uring_cq_ready(u) < wait_nr && now_ns() < end)
+                ;
+        }
+        if (uring_cq_ready(u) >= wait_nr)
+            wait_nr = 0;
+        to_submit = 0;
+    }
+    if (wait_nr)
+        flags |= IORING_ENTER_GETEVENTS;
+    if (!to_submit && !flags)
+        return 0;
+    while (sys_enter(u->fd, to_submit, wait_nr, flags)<0)
+    {
+        u->enters++;
+        if (errno!=EINTR)
+            return -errno;
+    }
+    u->enters++;
+    return 0;
+}
+
+struct io_uring_cqe* uring_peek_cqe(struct uring* u)
+{
+    if (!uring_cq_ready(u))
+        return NULL;
+    return &u->cqes[*u->cq_head & *u->cq_mask];
+}
+
+void uring_cqe_seen(struct uring* u)
+{
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,87 @@
+#ifndef _URING_
+#define _URING_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/*
+ * just enough io_uring on raw syscalls for the packet sender, there is no
+ * liburing on the target
+ * one thread at a time, the owner serializes submissions and completions
+ * functions returning int return 0 or a negative errno
+ */
+
+//how long to poll for completions before sleeping in the kernel with SQPOLL
+#define URING_SPIN_NS 500000
+
+struct uring {
+    int fd;
+    unsigned entries;
+    int sqpoll;
+
+    //submission queue, shared with the kernel
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_flags;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned sqe_tail;//filled, published by uring_submit()
+    unsigned sqe_head;//published
+
+    //completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    //statistics
+    uint64_t enters;//io_uring_enter() calls
+    uint64_t wakeups;//of the SQPOLL thread
+};
+
+/*
+ * sqpoll_idle is how long in ms the kernel thread polls the submission
+ * queue before it goes to sleep, 0 submits with io_uring_enter() instead
+ */
+int uring_init(struct uring* u, unsigned entries, unsigned sqpoll_idle);
+void uring_exit(struct uring* u);
+
+/*
+ * 1 if the kernel knows opcode op
+ */
+int uring_op_supported(struct uring* u, int op);
+
+/*
+ * table of nr empty registered buffers, filled by uring_set_buffer(),
+ * base NULL empties an entry again
+ */
+int uring_register_buffers(struct uring* u, unsigned nr);
+int uring_set_buffer(struct uring* u, unsigned index, void* base, size_t len);
+
+/*
+ * next free submission entry, zeroed, NULL if the queue is full
+ */
+struct io_uring_sqe* uring_get_sqe(struct uring* u);
+
+/*
+ * publish filled entries and wait until at least wait_nr completions
+ * are there, with SQPOLL this only enters the kernel to wake the thread
+ * or to sleep
+ */
+int uring_submit_and_wait(struct uring* u, unsigned wait_nr);
+
+/*
+ * oldest completion or NULL, uring_cqe_seen() hands it back
+ */
+struct io_uring_cqe* uring_peek_cqe(struct uring* u);
+void uring_cqe_seen(struct uring* u);
+
+#endif